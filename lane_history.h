@@ -0,0 +1,161 @@
+//Memory-mapped ring file of lane metrics written by the simulator (--history).
+//
+//The file is a header followed by capacity fixed-size records. The simulator
+//appends one record per sample interval, overwriting the oldest once the ring
+//is full. Another process can map the same file read-only and read the
+//history at any time without talking to the simulator. The file is a
+//MAP_SHARED mapping, so what was written is still there after a crash.
+//
+//Single writer. Each record carries its own sequence number, cleared while
+//the record is rewritten and set last, so a reader can detect a record that
+//was overwritten under it and skip it.
+#ifndef LANE_HISTORY_H
+#define LANE_HISTORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LANE_HISTORY_MAGIC 0x54534948u  //"HIST"
+#define LANE_HISTORY_VERSION 1
+#define LANE_HISTORY_LANES 8             //A-D signalled, then a-d free left turns
+
+typedef struct {
+    _Atomic uint64_t sequence;           //index of this record + 1; 0 while it is being written
+    uint64_t wallMs;                     //CLOCK_REALTIME when sampled
+    uint32_t ticksMs;                    //simulator clock (SDL_GetTicks) when sampled
+    int32_t activeLane;                  //lane the controller is serving, -1 between greens
+    uint32_t greenMovements;             //MOVEMENT_BIT set of the current green
+    uint16_t priorityMode;               //0 normal, 1 priority
+    uint16_t frameMs;                    //duration of the last frame
+    int32_t waiting[LANE_HISTORY_LANES]; //vehicles not yet in the junction, backlog included
+    uint64_t arrivals[LANE_HISTORY_LANES];   //cumulative since the simulator started
+    uint64_t departures[LANE_HISTORY_LANES]; //cumulative entries into the junction
+} LaneHistoryRecord;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t capacity;
+    uint32_t intervalMs;
+    uint32_t laneCount;
+    _Alignas(64) _Atomic uint64_t head;  //records ever written; the newest is head - 1
+    _Alignas(64) LaneHistoryRecord records[];
+} LaneHistory;
+
+static inline size_t laneHistoryBytes(uint32_t capacity)
+{
+    return sizeof(LaneHistory) + (size_t)capacity * sizeof(LaneHistoryRecord);
+}
+
+static inline bool laneHistoryCompatible(const LaneHistory *history)
+{
+    return history->magic == LANE_HISTORY_MAGIC && history->version == LANE_HISTORY_VERSION &&
+           history->recordSize == sizeof(LaneHistoryRecord) && history->laneCount == LANE_HISTORY_LANES;
+}
+
+//Writer: map path, continuing its history if it already holds a ring of the
+//same layout and capacity, otherwise starting a new one. Returns NULL and sets
+//errno on failure.
+static inline LaneHistory *laneHistoryOpen(const char *path, uint32_t capacity, uint32_t intervalMs)
+{
+    if (capacity == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return NULL;
+
+    size_t bytes = laneHistoryBytes(capacity);
+    struct stat st;
+    bool reuse = false;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size == bytes) {
+        LaneHistory *old = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+        if (old != MAP_FAILED) {
+            reuse = laneHistoryCompatible(old) && old->capacity == capacity;
+            munmap(old, bytes);
+        }
+    }
+    if (!reuse && (ftruncate(fd, 0) != 0 || ftruncate(fd, bytes) != 0)) {
+        close(fd);
+        return NULL;
+    }
+
+    LaneHistory *history = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (history == MAP_FAILED) return NULL;
+    if (!reuse) {
+        history->version = LANE_HISTORY_VERSION;
+        history->recordSize = sizeof(LaneHistoryRecord);
+        history->capacity = capacity;
+        history->laneCount = LANE_HISTORY_LANES;
+        atomic_store(&history->head, 0);
+        atomic_thread_fence(memory_order_release);
+        history->magic = LANE_HISTORY_MAGIC;
+    }
+    history->intervalMs = intervalMs;
+    return history;
+}
+
+//Reader: map path read-only. Returns NULL and sets errno on failure.
+static inline LaneHistory *laneHistoryMap(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(LaneHistory)) {
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+    LaneHistory *history = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (history == MAP_FAILED) return NULL;
+    if (!laneHistoryCompatible(history) || laneHistoryBytes(history->capacity) != (size_t)st.st_size) {
+        munmap(history, st.st_size);
+        errno = EPROTO;
+        return NULL;
+    }
+    return history;
+}
+
+static inline void laneHistoryUnmap(LaneHistory *history)
+{
+    munmap(history, laneHistoryBytes(history->capacity));
+}
+
+//Writer: append record (its sequence is filled in here)
+static inline void laneHistoryAppend(LaneHistory *history, const LaneHistoryRecord *record)
+{
+    uint64_t index = atomic_load_explicit(&history->head, memory_order_relaxed);
+    LaneHistoryRecord *slot = &history->records[index % history->capacity];
+    atomic_store_explicit(&slot->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy((char *)slot + sizeof(slot->sequence), (const char *)record + sizeof(record->sequence),
+           sizeof(LaneHistoryRecord) - sizeof(record->sequence));
+    atomic_store_explicit(&slot->sequence, index + 1, memory_order_release);
+    atomic_store_explicit(&history->head, index + 1, memory_order_release);
+}
+
+//Reader: copy record index (0 is the first ever written) into out. False if it
+//has been overwritten or is being written right now.
+static inline bool laneHistoryRead(const LaneHistory *history, uint64_t index, LaneHistoryRecord *out)
+{
+    const LaneHistoryRecord *slot = &history->records[index % history->capacity];
+    if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != index + 1) return false;
+    memcpy((char *)out + sizeof(out->sequence), (const char *)slot + sizeof(slot->sequence),
+           sizeof(LaneHistoryRecord) - sizeof(out->sequence));
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) != index + 1) return false;
+    atomic_store_explicit(&out->sequence, index + 1, memory_order_relaxed);
+    return true;
+}
+
+#endif
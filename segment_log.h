@@ -0,0 +1,76 @@
+//Naming and discovery of arrival log segments, shared by traffic_generator and the simulator.
+//
+//In segmented mode the generator writes BASE.000001, BASE.000002, ... and starts a
+//new segment once the current one reaches the size cap, always at a record
+//boundary. A segment is never written again once the next one exists, so the
+//simulator can delete it as soon as it has read past its end.
+#ifndef SEGMENT_LOG_H
+#define SEGMENT_LOG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define SEGMENT_DIGITS 6
+#define SEGMENT_DEFAULT_SIZE (64L * 1024 * 1024)
+
+static inline void segmentPath(char *out, size_t size, const char *base, long segment)
+{
+    snprintf(out, size, "%s.%0*ld", base, SEGMENT_DIGITS, segment);
+}
+
+static inline bool segmentExists(const char *base, long segment)
+{
+    char path[512];
+    struct stat st;
+    segmentPath(path, sizeof(path), base, segment);
+    return stat(path, &st) == 0;
+}
+
+//Lowest and highest segment numbers above `above` present for base; false if
+//there are none
+static inline bool segmentRangeAbove(const char *base, long above, long *lowest, long *highest)
+{
+    char dir[512];
+    const char *name = strrchr(base, '/');
+    if (name) {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(name - base), base);
+        name++;
+    } else {
+        snprintf(dir, sizeof(dir), ".");
+        name = base;
+    }
+
+    DIR *d = opendir(dir[0] ? dir : "/");
+    if (!d) return false;
+
+    size_t nameLength = strlen(name);
+    bool found = false;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        const char *candidate = entry->d_name;
+        if (strncmp(candidate, name, nameLength) != 0 || candidate[nameLength] != '.') continue;
+
+        const char *digits = candidate + nameLength + 1;
+        char *end;
+        long segment = strtol(digits, &end, 10);
+        if (end - digits != SEGMENT_DIGITS || *end != '\0' || segment <= above) continue;
+
+        if (!found || segment < *lowest) *lowest = segment;
+        if (!found || segment > *highest) *highest = segment;
+        found = true;
+    }
+    closedir(d);
+    return found;
+}
+
+//Lowest and highest segment numbers present for base; false if there are none
+static inline bool segmentRange(const char *base, long *lowest, long *highest)
+{
+    return segmentRangeAbove(base, 0, lowest, highest);
+}
+
+#endif
@@ -8,19 +8,119 @@
 #include <stdlib.h>
 #include <math.h>
 #include <time.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include "vehicle_ring.h"
+#include "segment_log.h"
+#include "lane_history.h"
 
-#define MAX_LINE_LENGTH 20
+#define READ_BUFFER_SIZE (1 << 20)  //bytes read from the vehicle file per read() call
+#define PARSE_BATCH_RECORDS 4096    //records enqueued per mutex hold
+#define ENQUEUE_LOG_EACH_MAX 16     //larger batches log one summary line instead of every vehicle
+#define FILE_POLL_INTERVAL_MS 1000  //reader sleep once it has caught up with the file
+#define FILE_WAIT_INTERVAL_MS 2000  //reader sleep while there is no file to read yet
+#define RING_STATS_INTERVAL_MS 5000 //how often the ring reader logs ingest latency
+#define DEFAULT_CHECKPOINT_INTERVAL_MS 1000 //how often the read offset is fsync'd
+#define CHECKPOINT_VERSION 1
+#define PLATE_INDEX_MIN_CAPACITY 1024
+#define PLATE_INDEX_LOAD_NUM 4     //plate index grows past 4/5 full
+#define PLATE_INDEX_LOAD_DEN 5
+#define DEFAULT_MICRO_DEPTH 32      //waiting vehicles per lane simulated as full nodes (--micro-depth)
+#define BACKLOG_MIN_CAPACITY 256
+
+//per-lane capacity (--lane-capacity, --overflow)
+#define OVERFLOW_RETRY_MS 50        //how often a blocked reader or the spool re-checks for room
+
+//local query API (--query-socket)
+#define DEFAULT_QUERY_SOCKET "/tmp/junction.sock"
+#define QUERY_PUBLISH_INTERVAL_MS 100 //how often the main loop publishes state for queries
+#define QUERY_MAX_CLIENTS 64
+#define QUERY_LINE_MAX 128
+
+//thread activity trace (--trace)
+#define TRACE_EVENTS_PER_THREAD (1 << 18) //a thread stops recording once its buffer is full
+#define TRACE_MAX_THREADS 16
+
+//queue mutex profile (--lock-profile)
+#define LOCK_HISTOGRAM_BUCKETS 32          //bucket b counts times in [2^(b-1), 2^b) ns, the last one open-ended
+#define DEFAULT_LOCK_HOLD_THRESHOLD_MS 16  //one frame
+#define LOCK_REPORT_MAX_SITES 64
+
+//journey latency percentiles (--latency)
+#define LATENCY_SUB_BITS 6  //32 linear sub-buckets per power of two of ms, exact below 64 ms; at most 1/32 high
+#define LATENCY_BUCKETS ((34 - LATENCY_SUB_BITS) << (LATENCY_SUB_BITS - 1))  //covers every Uint32
+#define DEFAULT_LATENCY_REPORT_MS 60000
+
+//lane metrics history file (--history)
+#define DEFAULT_HISTORY_INTERVAL_MS 1000
+#define DEFAULT_HISTORY_RECORDS 10800     //three hours at one record per second
+
+//offscreen video capture (--capture)
+#define DEFAULT_CAPTURE_FPS 30
+#define CAPTURE_TILE 16             //changed regions are found and converted in tiles this many pixels square
+#define CAPTURE_RANDOM_SEED 2024    //turn choices, fixed so captures of the same file match
+#define SIM_CLOCK_MAX_THREADS 4     //threads that sleep on the simulation clock
+
+//whole-simulation snapshots (--snapshot)
+#define SNAPSHOT_MAGIC 0x50414E53u  //"SNAP"
+#define SNAPSHOT_VERSION 5
+
+//transport benchmark (--bench-transport)
+#define BENCH_TRANSPORT_RECORDS 5000000
+#define BENCH_TRANSPORT_RATE 200000       //records per second in the paced run
+#define BENCH_TRANSPORT_PACED_MS 3000
+#define BENCH_TRANSPORT_BATCH 1024
+#define BENCH_LOOKUPS 1000000             //--bench-parser plate lookups through the index
+#define BENCH_SCAN_LOOKUPS 200            //and by scanning the queues, for comparison
+#define BENCH_MEMORY_DEFAULT 10000000     //--bench-memory vehicles
+#define BENCH_UPDATE_DEFAULT 1024         //--bench-update largest vehicles per lane
+#define BENCH_UPDATE_TICKS 3600           //one minute of 60 Hz frames per lane depth
+#define BENCH_UPDATE_PHASE_TICKS 300      //green switches between the two axes this often
 #define MAIN_FONT "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf"
-#define WINDOW_WIDTH 800
-#define WINDOW_HEIGHT 800
+
+//junction layout (--layout); the defaults are the built-in four-way junction
+#define DEFAULT_WINDOW_WIDTH 800
+#define DEFAULT_WINDOW_HEIGHT 800
+#define DEFAULT_LANE_WIDTH 50
+#define LANES_PER_ROAD 3            //L1 outgoing, L2 queued, L3 left turn
+#define LAYOUT_MIN_MARGIN 100       //window space needed around the junction for lights and labels
+#define WINDOW_WIDTH (layout.windowWidth)
+#define WINDOW_HEIGHT (layout.windowHeight)
 #define SCALE 1
-#define ROAD_WIDTH 150
-#define LANE_WIDTH 50
+#define ROAD_WIDTH (LANES_PER_ROAD * layout.laneWidth)
+#define LANE_WIDTH (layout.laneWidth)
 
 //checkQueue constants
 #define PRIORITY_THRESHOLD_HIGH 10
 #define PRIORITY_THRESHOLD_LOW 5
 #define TIME_PER_VEHICLE 2  // seconds per vehicle
+#define ROUND_ROBIN_MAX_VEHICLES 6
+#define LONGEST_QUEUE_MAX_VEHICLES 8
+
+//actuated green (--actuated): end the green early once the lane stops discharging
+#define DEFAULT_MIN_GREEN_MS 3000
+#define DEFAULT_MAX_GREEN_MS 30000
+#define DEFAULT_GAP_MS 2000
+#define ACTUATED_POLL_MS 50
+
+//policy benchmark harness (--bench-policy)
+#define BENCH_SAMPLE_COUNT 4096
+#define BENCH_DECISIONS 2000000
+#define BENCH_HORIZON_S 3600.0
+#define BENCH_LANE_CAPACITY 4096
+
+//discrete-event engine (--event-sim)
+#define EVENT_SIM_DEFAULT_HOURS 24.0
+#define EVENT_SIM_DEFAULT_RATES {1080, 540, 540, 540}  //vehicles per hour on A B C D
+#define EVENT_SIM_IDLE_S 0.2  //nothing to serve: decide again after this, like checkQueue
 
 //vehicle box dimensions
 #define VEHICLE_WIDTH 20
@@ -28,6 +128,16 @@
 #define VEHICLE_SPEED 100.0f  //pixels per second
 #define VEHICLE_GAP 15        //gap between vehicles
 
+//car-following mode (--idm): Intelligent Driver Model in pixel units, with
+//VEHICLE_SPEED as the desired speed and VEHICLE_GAP as the standstill gap
+#define IDM_ACCELERATION 80.0f   //maximum acceleration, px/s^2
+#define IDM_DECELERATION 120.0f  //comfortable braking, px/s^2
+#define IDM_TIME_HEADWAY 1.5f    //desired time gap to the vehicle ahead, s
+
+//count of a lane's vehicles queued beyond the window edge
+#define HIDDEN_INDICATOR_WIDTH 72
+#define HIDDEN_INDICATOR_HEIGHT 28
+
 //Turn probability (0-100, where 50 means 50% chance to turn right)
 #define TURN_RIGHT_PROBABILITY 50
 
@@ -67,7 +177,14 @@
 #define INTERSECTION_CENTER_X (WINDOW_WIDTH / 2)
 #define INTERSECTION_CENTER_Y (WINDOW_HEIGHT / 2)
 
-//Visual-only lane positions (L1 and L3 - no queue, just visual)
+//Junction box edges, the area where movements can cross each other
+#define JUNCTION_LEFT (WINDOW_WIDTH / 2 - ROAD_WIDTH / 2)
+#define JUNCTION_RIGHT (WINDOW_WIDTH / 2 + ROAD_WIDTH / 2)
+#define JUNCTION_TOP (WINDOW_HEIGHT / 2 - ROAD_WIDTH / 2)
+#define JUNCTION_BOTTOM (WINDOW_HEIGHT / 2 + ROAD_WIDTH / 2)
+
+//Outer lane positions: L3 is each road's free left-turn lane, L1 the outgoing
+//lane those left turns join
 //Lanes go CLOCKWISE: AL1,AL2,AL3,CL1,CL2,CL3,BL1,BL2,BL3,DL1,DL2,DL3
 
 //Road A (top, vehicles go DOWN): AL1=leftmost, AL2=middle, AL3=rightmost
@@ -86,15 +203,17 @@
 #define LANE_DL1_Y (WINDOW_HEIGHT / 2 - ROAD_WIDTH / 2 + LANE_WIDTH * 2 + LANE_WIDTH / 2 - VEHICLE_HEIGHT / 2)  //bottommost
 #define LANE_DL3_Y (WINDOW_HEIGHT / 2 - ROAD_WIDTH / 2 + LANE_WIDTH / 2 - VEHICLE_HEIGHT / 2)  //topmost
 
-//Visual vehicle spawn interval (in milliseconds)
-#define VISUAL_SPAWN_INTERVAL_MIN 1000
-#define VISUAL_SPAWN_INTERVAL_MAX 3000
-#define MAX_VISUAL_VEHICLES 50
-
 const char *VEHICLE_FILE = "vehicles.data";
 
 typedef struct QueueData QueueData;
 
+//One parsed line of the vehicle file; plate points into the read buffer, it is not NUL terminated
+typedef struct {
+    const char *plate;
+    int plateLength;
+    char road;
+} VehicleRecord;
+
 typedef struct
 {
     int currentLight;
@@ -106,108 +225,963 @@ typedef struct
 //Turn direction enum
 typedef enum {
     TURN_STRAIGHT = 0,
-    TURN_RIGHT = 1
+    TURN_RIGHT = 1,
+    TURN_LEFT = 2,   //only from the free left-turn lanes, never signalled
+    TURN_COUNT
 } TurnDirection;
 
-//Visual-only vehicle (for L1 and L3 lanes - no queue needed)
-typedef struct {
-    float x, y;
-    bool active;
-    bool hasCompletedTurn;  //true after turn complete, now moving to exit
-} VisualVehicle;
-
-//Global visual vehicle arrays
-VisualVehicle visualVehiclesAL3[MAX_VISUAL_VEHICLES];  //AL3 outgoing to CL1 (turns left)
-VisualVehicle visualVehiclesCL3[MAX_VISUAL_VEHICLES];  //CL3 outgoing to BL1 (turns left)
-VisualVehicle visualVehiclesBL3[MAX_VISUAL_VEHICLES];  //BL3 outgoing to DL1 (turns left)
-VisualVehicle visualVehiclesDL3[MAX_VISUAL_VEHICLES];  //DL3 outgoing to AL1 (turns left)
-
-Uint32 lastSpawnTimeAL3 = 0;
-Uint32 nextSpawnIntervalAL3 = 0;
-Uint32 lastSpawnTimeCL3 = 0;
-Uint32 nextSpawnIntervalCL3 = 0;
-Uint32 lastSpawnTimeBL3 = 0;
-Uint32 nextSpawnIntervalBL3 = 0;
-Uint32 lastSpawnTimeDL3 = 0;
-Uint32 nextSpawnIntervalDL3 = 0;
-
-// Node for queue
+//Vehicle coordinates. Build with -DVEHICLE_FIXED_POINT to store them as 16-bit
+//fixed point (quarter pixels, saturating at about +-8191 px) for very large
+//backlogs; vehicles further back than that wait at the edge of the range and
+//move up as the queue advances. Always read through fromCoord/toCoord.
+#ifdef VEHICLE_FIXED_POINT
+typedef int16_t VehicleCoord;
+#define COORD_SCALE 4.0f
+
+static inline float fromCoord(VehicleCoord coord)
+{
+    return coord / COORD_SCALE;
+}
+
+static inline VehicleCoord toCoord(float value)
+{
+    float scaled = value * COORD_SCALE;
+    if (scaled > INT16_MAX) return INT16_MAX;
+    if (scaled < INT16_MIN) return INT16_MIN;
+    return (VehicleCoord)lrintf(scaled);
+}
+#else
+typedef float VehicleCoord;
+
+static inline float fromCoord(VehicleCoord coord)
+{
+    return coord;
+}
+
+static inline VehicleCoord toCoord(float value)
+{
+    return value;
+}
+#endif
+
+//Nodes live in one pool array and link by 32-bit index (see allocVehicleNode)
+#define VEHICLE_INDEX_BITS 26
+#define VEHICLE_NONE ((1u << VEHICLE_INDEX_BITS) - 1)  //end of list
+#define VEHICLE_POOL_CAPACITY VEHICLE_NONE
+#define ARRIVAL_TICKS_BITS 25                           //arrival time wraps every 9.3 hours
+#define ARRIVAL_TICKS_MASK ((1u << ARRIVAL_TICKS_BITS) - 1)
+
+// Node for queue: 32 bytes, 24 with VEHICLE_FIXED_POINT
 typedef struct VehicleNode
 {
-    char vehicleNumber[10];
-    char road;
-    float x, y;
-    float targetX, targetY;
-    bool isMoving;
-    bool hasCrossed;
-    bool isTurning;           //true if vehicle is currently in turning phase
-    bool hasCompletedTurn;    //true if turn is complete, now going straight
-    TurnDirection turnDirection;
-    struct VehicleNode *next;
+    uint64_t plate;                   //packPlate() of the vehicle number
+    VehicleCoord x, y;
+    VehicleCoord targetX, targetY;
+    uint32_t next : VEHICLE_INDEX_BITS;  //pool index of the next vehicle, VEHICLE_NONE at the rear
+    uint32_t turnDirection : 2;       //TurnDirection
+    bool isMoving : 1;
+    bool hasCrossed : 1;
+    bool isTurning : 1;               //true if vehicle is currently in turning phase
+    bool hasCompletedTurn : 1;        //true if turn is complete, now going straight
+    uint32_t arrivalTicks : ARRIVAL_TICKS_BITS;  //low bits of SDL_GetTicks() at enqueue, see vehicleWaitedMs
+    uint32_t road : 7;                //'A' 'B' 'C' 'D', lower case in the free left-turn lanes
 } VehicleNode;
 
+//Vehicle pool, see allocVehicleNode
+static VehicleNode *vehiclePool = NULL;
+static uint32_t vehiclePoolUsed = 0;      //high-water mark
+static uint32_t vehicleFreeList = VEHICLE_NONE;
+
+//Speed of each pool node in px/s, only allocated with --idm so the node stays 32 bytes
+static bool carFollowing = false;
+static float *vehicleSpeed = NULL;
+
+//When a vehicle reached the stop line and entered the junction, kept per pool
+//node in a parallel array that only exists with --latency
+typedef struct {
+    Uint32 stopLineTicks;
+    Uint32 enteredTicks;
+    bool atStopLine : 1;
+    bool entered : 1;
+    bool priority : 1;       //priority mode was on when it entered
+} JourneyStamps;
+
+//Journey stamps per pool node, --latency only
+static bool journeyLatency = false;
+static JourneyStamps *journeyStamps = NULL;
+
+//Simulation clock: SDL_GetTicks, or with --capture a virtual clock the main
+//loop moves one fixed step per frame, as fast as frames render. Threads that
+//pace themselves with simDelay are registered before they start, and the clock
+//only moves once all of them sleep and none is due, so a green lasts the same
+//simulated time however fast the frames go. The file readers are among them:
+//the clock waits while they ingest, and they poll for more in simulated time.
+typedef struct {
+    bool isVirtual;
+    _Atomic Uint32 ticks;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    int threads;                           //registered with simClockRegister
+    int claimed;                           //of those, slots taken by their first simDelay
+    int asleep;                            //in simDelay and not yet due
+    Uint32 wakeAt[SIM_CLOCK_MAX_THREADS];
+    bool sleeping[SIM_CLOCK_MAX_THREADS];
+} SimClock;
+
+static SimClock simClock = {.mutex = PTHREAD_MUTEX_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER};
+static _Thread_local int simClockSlot = -1;
+
+static inline Uint32 simTicks(void)
+{
+    return simClock.isVirtual ? atomic_load_explicit(&simClock.ticks, memory_order_acquire) : SDL_GetTicks();
+}
+
+//Switch to the virtual clock, starting where SDL's clock is now
+static void simClockStart(void)
+{
+    atomic_store(&simClock.ticks, SDL_GetTicks());
+    simClock.isVirtual = true;
+}
+
+//Call before creating a thread that sleeps with simDelay
+static void simClockRegister(void)
+{
+    pthread_mutex_lock(&simClock.mutex);
+    simClock.threads++;
+    pthread_mutex_unlock(&simClock.mutex);
+}
+
+static void simDelay(Uint32 ms)
+{
+    if (!simClock.isVirtual) {
+        SDL_Delay(ms);
+        return;
+    }
+    pthread_mutex_lock(&simClock.mutex);
+    if (simClockSlot < 0) simClockSlot = simClock.claimed++;
+    int slot = simClockSlot;
+    simClock.wakeAt[slot] = atomic_load(&simClock.ticks) + (ms > 0 ? ms : 1);
+    simClock.sleeping[slot] = true;
+    simClock.asleep++;
+    pthread_cond_broadcast(&simClock.changed);
+    while (simClock.sleeping[slot]) {
+        pthread_cond_wait(&simClock.changed, &simClock.mutex);
+    }
+    pthread_mutex_unlock(&simClock.mutex);
+}
+
+//Main loop, virtual clock only: wait until every registered thread sleeps,
+//then move the clock to ticks and wake the threads that are due
+static void simClockAdvance(Uint32 ticks)
+{
+    pthread_mutex_lock(&simClock.mutex);
+    while (simClock.asleep < simClock.threads) {
+        pthread_cond_wait(&simClock.changed, &simClock.mutex);
+    }
+    atomic_store_explicit(&simClock.ticks, ticks, memory_order_release);
+    for (int slot = 0; slot < simClock.claimed; slot++) {
+        if (simClock.sleeping[slot] && (int32_t)(ticks - simClock.wakeAt[slot]) >= 0) {
+            simClock.sleeping[slot] = false;
+            simClock.asleep--;
+        }
+    }
+    pthread_cond_broadcast(&simClock.changed);
+    pthread_mutex_unlock(&simClock.mutex);
+}
+
+static inline VehicleNode *vehicleAt(uint32_t index)
+{
+    return index == VEHICLE_NONE ? NULL : &vehiclePool[index];
+}
+
+static inline uint32_t vehicleIndex(const VehicleNode *node)
+{
+    return node == NULL ? VEHICLE_NONE : (uint32_t)(node - vehiclePool);
+}
+
+static inline VehicleNode *nextVehicle(const VehicleNode *node)
+{
+    return vehicleAt(node->next);
+}
+
+static inline void setNextVehicle(VehicleNode *node, const VehicleNode *next)
+{
+    node->next = vehicleIndex(next);
+}
+
+static inline Uint32 vehicleWaitedMs(const VehicleNode *node, Uint32 now)
+{
+    return (now - node->arrivalTicks) & ARRIVAL_TICKS_MASK;
+}
+
+//Waiting vehicles queued behind the first microQueueDepth of a lane. They
+//only wait and shuffle forward, so they are kept as plate and arrival time in
+//arrival order, and promoted to full nodes as the queue ahead moves up.
+typedef struct {
+    uint64_t plate;
+    Uint32 arrivalTicks;      //SDL_GetTicks() at enqueue, kept for wait times
+} BackloggedVehicle;
+
+typedef struct {
+    BackloggedVehicle *items; //ring buffer
+    size_t head;
+    size_t count;
+    size_t capacity;          //power of two
+    uint64_t popped;          //vehicles ever promoted: the oldest has sequence number popped
+    int lane;                 //queued lane, for the backlog index
+} VehicleBacklog;
+
 // Queue
 typedef struct Queue
 {
     VehicleNode *front;
     VehicleNode *rear;
-    int size;
+    int size;                 //vehicle nodes; see getQueueSize for the whole lane
+    VehicleBacklog backlog;
 } Queue;
 
+//Waiting vehicles per lane kept as nodes, 0 for no limit; set by --micro-depth
+int microQueueDepth = DEFAULT_MICRO_DEPTH;
+
+//i-th oldest backlogged vehicle
+static inline BackloggedVehicle *backlogAt(VehicleBacklog *backlog, size_t i)
+{
+    return &backlog->items[(backlog->head + i) & (backlog->capacity - 1)];
+}
+
+#define LANE_COUNT 4
+#define QUEUED_LANE_COUNT (LANE_COUNT * 2)  //the signalised L2 lanes A-D, then the free left-turn L3 lanes a-d
+
+//Road letter of queued lane: 'A'-'D' for L2, 'a'-'d' for L3
+static inline char laneRoad(int lane)
+{
+    return lane < LANE_COUNT ? 'A' + lane : 'a' + lane - LANE_COUNT;
+}
+
+//Queued lane of a road letter, -1 if it names none
+static inline int roadLane(char road)
+{
+    if (road >= 'A' && road < 'A' + LANE_COUNT) return road - 'A';
+    if (road >= 'a' && road < 'a' + LANE_COUNT) return road - 'a' + LANE_COUNT;
+    return -1;
+}
+
+//Junction shape, loaded by loadLayout. Roads keep their compass positions:
+//A enters from the top, B from the bottom, C from the right, D from the left.
+typedef struct {
+    int windowWidth;
+    int windowHeight;
+    int laneWidth;
+    bool roadPresent[LANE_COUNT];  //a T-junction leaves one road out
+    const char *name;              //layout file, for messages
+} JunctionLayout;
+
+JunctionLayout layout = {DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT, DEFAULT_LANE_WIDTH, {true, true, true, true},
+                         "built-in four-way"};
+
+//What the simulation and renderer need about one queued lane, precomputed
+//from the layout by buildRoadGeometry. Entries 0-3 are roads A-D and their
+//signalised L2 lanes, 4-7 the free left-turn L3 lanes, whose "turn" is left. Points are vehicle top-left corners. Progress is
+//a point projected on the approach direction (x * dirX + y * dirY), so it
+//grows as a vehicle drives towards and through the junction.
+typedef struct {
+    bool present;
+    bool straightAllowed;       //the road straight ahead exists
+    bool rightAllowed;          //the road a right turn joins exists
+    char rightTurnTo;
+    float dirX, dirY;           //unit approach direction
+    float length;               //vehicle extent along the approach
+    float stopX, stopY;         //first stop slot, slot k is k * (length + VEHICLE_GAP) further back
+    float spawnProgress;        //where the first vehicle appears, just off screen
+    float entryProgress;        //front of the vehicle reaches the junction box
+    float exitProgress;         //straight-ahead target, off screen
+    float turnProgress;         //turning vehicles leave the approach lane here
+    float turnDirX, turnDirY;   //direction after the turn
+    float turnExitX, turnExitY; //turn target, off screen in the outgoing lane
+    SDL_Rect arm;               //road surface from the window edge to the junction box
+    SDL_Rect light;             //traffic light housing
+    SDL_Rect hidden;            //"+N" box for vehicles queued beyond the window
+    int labelX, labelY;
+} RoadGeometry;
+
+RoadGeometry roadGeometry[QUEUED_LANE_COUNT];
+
+static inline const RoadGeometry *geometryOf(char road)
+{
+    return &roadGeometry[roadLane(road)];
+}
+
+static inline float roadProgress(const RoadGeometry *geometry, float x, float y)
+{
+    return x * geometry->dirX + y * geometry->dirY;
+}
+
+//Point of the approach lane at progress
+static inline void roadPoint(const RoadGeometry *geometry, float progress, float *x, float *y)
+{
+    float back = roadProgress(geometry, geometry->stopX, geometry->stopY) - progress;
+    *x = geometry->stopX - geometry->dirX * back;
+    *y = geometry->stopY - geometry->dirY * back;
+}
+
+//The legs of a vehicle's path, per road and turn direction, so updateVehicles
+//moves every vehicle with the same few multiply-adds instead of asking the
+//road and turn what to do. Progress on a leg is x * dirX + y * dirY.
+typedef enum {
+    PHASE_APPROACH,  //queueing up to the stop line and driving to the junction
+    PHASE_CROSSING,  //straight through to the exit, or up to the turn point
+    PHASE_TURNED,    //after a right turn, along the outgoing lane
+    PHASE_COUNT
+} KinematicsPhaseIndex;
+
+typedef struct {
+    float dirX, dirY;
+    float stopAt;    //movement is clamped here; on the approach, the first stop slot
+    float doneAt;    //leg ends: junction entry, turn point or far enough off screen to remove
+    bool exits;      //reaching doneAt removes the vehicle
+} KinematicsPhase;
+
+KinematicsPhase kinematics[QUEUED_LANE_COUNT][TURN_COUNT][PHASE_COUNT];
+
+//Plates are at most 8 characters (the generator writes LL D LL DDD) and are
+//stored as their ASCII bytes in one integer, zero padded, so copying and
+//comparing a plate is a single 64-bit operation.
+#define PLATE_LENGTH 8
+
+typedef struct {
+    char text[PLATE_LENGTH + 1];
+} PlateText;
+
+static inline uint64_t packPlate(const char *plate, int length)
+{
+    uint64_t packed = 0;
+    if (length > PLATE_LENGTH) length = PLATE_LENGTH;
+    memcpy(&packed, plate, length);
+    return packed;
+}
+
+//Printable form of a packed plate, for logging: plateText(node->plate).text
+static inline PlateText plateText(uint64_t plate)
+{
+    PlateText out;
+    memcpy(out.text, &plate, PLATE_LENGTH);
+    out.text[PLATE_LENGTH] = '\0';
+    return out;
+}
+
+//Open-addressing (linear probing) index from plate to queued vehicle, so a
+//vehicle can be found without scanning the four queues. Slots hold vehicle
+//pool indices (4 bytes each); the plate itself is read from the node.
+typedef struct {
+    uint32_t *slots;           //VEHICLE_NONE marks an empty slot
+    size_t capacity;
+    size_t count;
+} PlateIndex;
+
+//The same for backlogged vehicles, which have no node. A slot holds the lane
+//and the vehicle's sequence number in that lane's backlog (4 bytes); the plate
+//is read from the backlog. backlogPush inserts and backlogPop removes, so
+//every entry names a vehicle still in a backlog. Sequence numbers are kept
+//modulo 2^28, more than any one lane's backlog holds.
+#define BACKLOG_INDEX_EMPTY 0
+#define BACKLOG_INDEX_USED 0x80000000u
+#define BACKLOG_SEQUENCE_MASK 0x0FFFFFFFu
+typedef struct {
+    uint32_t *slots;           //BACKLOG_INDEX_USED | sequence << 3 | lane, 0 when empty
+    size_t capacity;
+    size_t count;
+} BacklogIndex;
+
+//Answer to a findVehicle() query
+typedef struct {
+    char road;
+    bool crossed;              //past the stop line, in or leaving the junction
+    float x, y;
+    Uint32 waitedMs;           //since the vehicle was enqueued
+} VehicleLocation;
+
+//A movement is a (road, turnDirection) pair; green is granted per movement
+#define MOVEMENT_COUNT (LANE_COUNT * 2)
+#define MOVEMENT_BIT(lane, turn) (1u << ((lane) * 2 + (turn)))
+#define LANE_MOVEMENTS(lane) (MOVEMENT_BIT(lane, TURN_STRAIGHT) | MOVEMENT_BIT(lane, TURN_RIGHT))
+
+//Green length settings; fixed mode sleeps through the policy's green time
+typedef struct {
+    bool actuated;
+    int minGreenMs;
+    int maxGreenMs;
+    int gapMs;         //gap-out after this long with no stop line crossing
+} GreenTiming;
+
+//Counters for judging how well green time is used
+typedef struct {
+    Uint32 lastCrossingTicks[LANE_COUNT];  //last time a vehicle crossed the stop line, per lane
+    long greenPhases;
+    long gapOuts;
+    long maxOuts;
+    long totalGreenMs;
+    long deadGreenMs;   //green time after the last stop line crossing of that green
+    long servedVehicles;
+    double totalWaitMs; //arrival to stop line crossing, summed over served vehicles
+    long freeLeftServed;     //the same for the free left-turn lanes
+    double freeLeftWaitMs;
+} GreenStats;
+
+//Log-linear histogram of milliseconds (HDR style): fixed size however many
+//samples it takes
+typedef struct {
+    uint32_t counts[LATENCY_BUCKETS];
+    long samples;
+    Uint32 maxMs;
+} LatencyHistogram;
+
+typedef enum {
+    JOURNEY_WAIT,            //arrival to entering the junction, as in the average wait
+    JOURNEY_HELD,            //at the front of the lane: stop line to entering
+    JOURNEY_CROSSING,        //entering to leaving the screen
+    JOURNEY_METRIC_COUNT
+} JourneyMetric;
+
+//How far the reader has enqueued; segment 0 means the plain VEHICLE_FILE
+typedef struct {
+    long segment;
+    long offset;
+    unsigned long inode;
+} ReadPosition;
+
+//Arrivals read and vehicles entering the junction per queued lane since
+//startup, under queueData->mutex (--history)
+typedef struct {
+    long arrivals[QUEUED_LANE_COUNT];
+    long departures[QUEUED_LANE_COUNT];
+    long rejected[QUEUED_LANE_COUNT];  //arrivals for a lane the layout leaves out, not in arrivals
+} LaneCounters;
+
+//Where a reader starts in an existing backlog (--start)
+typedef enum {
+    START_AUTO = 0,     //replay for VEHICLE_FILE, checkpoint for the segmented log
+    START_TAIL,         //skip the backlog, only new arrivals
+    START_CHECKPOINT,   //continue after the last saved read position
+    START_REPLAY        //everything still on disk
+} StartMode;
+
+//What enqueueRecords does with an arrival for a full lane (--overflow)
+typedef enum {
+    OVERFLOW_BLOCK = 0, //hold the reader until the lane has room
+    OVERFLOW_DROP,      //discard the newest arrivals
+    OVERFLOW_SPILL      //append them to the lane's spool file, re-admitted in order later
+} OverflowPolicy;
+
+//Admission accounting for full lanes, under queueData->mutex
+typedef struct {
+    long dropped[LANE_COUNT];
+    long spilled[LANE_COUNT];      //written to the spool file
+    long readmitted[LANE_COUNT];   //taken back from the spool file
+    long spoolPending[LANE_COUNT]; //spilled and not yet re-admitted
+    long spoolBytes[LANE_COUNT];   //end of the spool file
+    long spoolReadPos[LANE_COUNT]; //start of the first vehicle not yet re-admitted
+    long blockedMs;                //reader time spent waiting for room
+    bool full[LANE_COUNT];         //lane refused its last arrival, for logging transitions
+} OverflowStats;
+
 typedef struct QueueData
 {
     Queue *queueA;
     Queue *queueB;
     Queue *queueC;
     Queue *queueD;
+    Queue *freeLeft[LANE_COUNT];//free left-turn lanes AL3..DL3, served without a signal
     int currentLane;  // 0 1 2 3 for A B C D
     int priorityMode; // 0 for normal and 1 fr priority
     SDL_mutex *mutex;
-    int activeLane;//which lane has green light
+    int activeLane;//lane the policy chose for the current green
+    unsigned greenMovements;//MOVEMENT_BIT set of (road, turn) movements with green
+    bool concurrentPhases;//also release movements that don't conflict with activeLane
+    const struct SchedulingPolicy *policy;//decides which lane gets the next green
+    GreenTiming timing;
+    GreenStats stats;
+    LaneCounters counters;
+    Uint32 frameMs;//duration of the previous frame, set by the main loop
+    const char *ringName;//read arrivals from this shared-memory ring instead of VEHICLE_FILE
+    bool segmentedLog;//read VEHICLE_FILE.000001, .000002, ... instead of VEHICLE_FILE
+    int checkpointIntervalMs;
+    StartMode startMode;
+    ReadPosition ingested;//updated by the reader under mutex, saved in snapshots
+    bool resumeFromSnapshot;//readers start at ingested instead of startMode
+    Uint32 greenEndTicks;//when the current green runs out at the latest
+    int resumeGreenMs;//remaining green of a restored phase, finished before the next decision
+    struct LiveState *liveState;//last published read-only copy for the query API
+    SDL_mutex *liveStateMutex;//guards swapping liveState, never held while building or serving
+    const char *querySocketPath;
+    int laneCapacity;//most vehicles a lane queue holds, 0 for no limit
+    OverflowPolicy overflowPolicy;
+    OverflowStats overflow;
+    int spoolFd[LANE_COUNT];//OVERFLOW_SPILL spool files, VEHICLE_FILE.overflow.A ...
 } QueueData;
 
+//Every queued lane in lane order: A-D, then the free left-turn lanes a-d
+static inline void laneQueues(QueueData *queueData, Queue *queues[QUEUED_LANE_COUNT])
+{
+    queues[0] = queueData->queueA;
+    queues[1] = queueData->queueB;
+    queues[2] = queueData->queueC;
+    queues[3] = queueData->queueD;
+    for (int road = 0; road < LANE_COUNT; road++) {
+        queues[LANE_COUNT + road] = queueData->freeLeft[road];
+    }
+}
+
+//Offscreen frames streamed to a Y4M file (--capture)
+typedef struct {
+    FILE *out;
+    SDL_Surface *surface;    //software renderer target, ARGB8888
+    Uint32 *previous;        //last frame's pixels, to find the tiles that changed
+    uint8_t *planes;         //Y, then U and V at half resolution, kept between frames
+    int width, height;       //rounded up to even, as 4:2:0 needs
+    int fps;
+    long frames;
+    long tilesConverted;
+    long tilesTotal;
+    Uint32 startedTicks;     //wall clock, for the export speed
+} FrameCapture;
+
+//Background writer of the --history ring file
+typedef struct {
+    QueueData *queueData;
+    LaneHistory *history;
+    int intervalMs;
+} HistorySampler;
+_Static_assert(LANE_HISTORY_LANES == QUEUED_LANE_COUNT, "one history column per queued lane");
+
+//Wait and hold times of one place that locks queueData->mutex. Updated only
+//while holding the mutex, so it needs no lock of its own.
+typedef struct LockSite {
+    const char *function;
+    int line;
+    struct LockSite *nextSite;  //list of sites that have locked at least once
+    bool registered;
+    long acquisitions;
+    long contended;           //had to wait for another thread
+    long longHolds;           //held for the hold threshold or longer
+    uint64_t totalWaitNs;
+    uint64_t maxWaitNs;
+    uint64_t totalHoldNs;
+    uint64_t maxHoldNs;
+    long waitHistogram[LOCK_HISTOGRAM_BUCKETS];
+    long holdHistogram[LOCK_HISTOGRAM_BUCKETS];
+} LockSite;
+
+//Every lock of queueData->mutex goes through these, so each call site gets its
+//own LockSite and its waits show up in the trace
+#define LOCK_QUEUES(queueData) do { \
+        static LockSite lockSite = {.function = __func__, .line = __LINE__}; \
+        lockQueues((queueData), &lockSite); \
+    } while (0)
+#define UNLOCK_QUEUES(queueData) unlockQueues(queueData)
+
+//One finished span. name and category must outlive the trace (literals or __func__).
+typedef struct {
+    const char *name;
+    const char *category;
+    const char *argName;  //NULL for no argument
+    int64_t arg;
+    uint64_t startNs;
+    uint64_t durationNs;
+} TraceEvent;
+
+//Events of one thread, appended only by that thread. count is published with
+//release order, so writeTrace can read every event below it while recording goes on.
+typedef struct {
+    const char *threadName;
+    long tid;
+    atomic_long count;
+    bool fullLogged;
+    TraceEvent events[];
+} TraceBuffer;
+
+//A vehicle as seen by the query API
+typedef struct {
+    uint64_t plate;
+    char road;
+    bool crossed;
+    float x, y;
+    Uint32 waitedMs;
+} LiveVehicle;
+
+//Read-only copy of the intersection state, published by the main loop and
+//shared by query handlers through a reference count
+typedef struct LiveState {
+    atomic_int refs;
+    Uint32 publishedTicks;
+    int waiting[QUEUED_LANE_COUNT];
+    int queued[QUEUED_LANE_COUNT];
+    long dropped[QUEUED_LANE_COUNT];
+    long spooled[QUEUED_LANE_COUNT];  //spilled and not yet re-admitted
+    long rejected[QUEUED_LANE_COUNT]; //arrivals for a lane the layout leaves out
+    int currentLane;
+    int priorityMode;
+    int activeLane;
+    unsigned greenMovements;
+    int greenRemainingMs;
+    int oldestIndex;           //into vehicles, -1 if nobody is waiting
+    long vehicleCount;
+    long laneVehicles[QUEUED_LANE_COUNT + 1];   //lane q is vehicles[laneVehicles[q]] up to laneVehicles[q + 1]
+    long laneBacklogged[QUEUED_LANE_COUNT + 1]; //and backlogged[laneBacklogged[q]] up to laneBacklogged[q + 1]
+    int backlogSlot[QUEUED_LANE_COUNT];         //stop line slot of each lane's first backlogged vehicle
+    BackloggedVehicle *backlogged;              //after vehicles, in the same allocation
+    LiveVehicle vehicles[];    //in laneQueues order, each lane front to rear
+} LiveState;
+
+//Read position saved across restarts; segment 0 means the plain VEHICLE_FILE
+typedef struct {
+    char path[512];
+    long segment;
+    long offset;          //bytes fully enqueued from the segment
+    unsigned long inode;  //plain file only, to notice a replaced file
+    long savedSegment;
+    long savedOffset;
+    Uint32 lastSaveTicks;
+} ReadCheckpoint;
+
+//What a scheduling policy sees each time the controller needs a decision
+typedef struct {
+    int waiting[LANE_COUNT];   //vehicles not yet crossed, per lane (A B C D)
+    int occupied[LANE_COUNT];  //vehicles crossed but still in the queue (in or leaving the junction)
+    bool intersectionBusy;     //true if a vehicle is still inside the junction box
+} LaneObservation;
+
+//Controller state a policy may read and update between decisions
+typedef struct {
+    int currentLane;  //rotation pointer, 0 1 2 3 for A B C D
+    int priorityMode; //0 for normal and 1 for priority
+} PolicyContext;
+
+//Result of one policy decision; greenMs <= 0 means nothing to serve
+typedef struct {
+    int lane;
+    int vehicles;
+    int greenMs;
+} PolicyDecision;
+
+typedef struct SchedulingPolicy {
+    const char *name;
+    const char *description;
+    PolicyDecision (*observe)(const LaneObservation *obs, PolicyContext *ctx);
+} SchedulingPolicy;
+
+static bool traceEnabled = false;
+static uint64_t traceStartNs;
+static TraceBuffer *traceBuffers[TRACE_MAX_THREADS];
+static atomic_int traceThreadCount;
+static _Thread_local TraceBuffer *traceLocal;
+static volatile sig_atomic_t traceDumpRequested = 0;
+
+static bool lockProfileEnabled = false;
+static uint64_t lockHoldThresholdNs;
+static LockSite *lockSites;      //every site that has locked, newest first
+static LockSite *lockHolder;     //site holding queueData->mutex, NULL if free
+static uint64_t lockAcquiredNs;
+static volatile sig_atomic_t lockReportRequested = 0;
+
+//Start of a span; 0 when tracing is off so untraced runs skip the clock read
+static inline uint64_t traceBegin(void)
+{
+    return traceEnabled ? vehicleRingNowNs() : 0;
+}
+
 // Function declarations
 bool initializeSDL(SDL_Window **window, SDL_Renderer **renderer);
+bool openCapture(FrameCapture *capture, const char *path, int fps, SDL_Renderer **renderer);
+bool captureFrame(FrameCapture *capture);
+void closeCapture(FrameCapture *capture);
 void drawRoadsAndLane(SDL_Renderer *renderer, TTF_Font *font);
 void displayText(SDL_Renderer *renderer, TTF_Font *font, char *text, int x, int y);
 void drawTrafficLight(SDL_Renderer *renderer, int lane, bool isGreen);
-void drawAllTrafficLights(SDL_Renderer *renderer, int activeLane);
+void drawAllTrafficLights(SDL_Renderer *renderer, unsigned greenMovements);
 void refreshLight(SDL_Renderer *renderer, SharedData *sharedData, TTF_Font *font);
 void *checkQueue(void *arg);
+const SchedulingPolicy *findSchedulingPolicy(const char *name);
+void listSchedulingPolicies(void);
+void observeLanes(QueueData *queueData, LaneObservation *obs);
+int runGreenPhase(QueueData *queueData, unsigned greenMovements, int greenMs);
+void buildConflictMatrix(void);
+unsigned chooseGreenMovements(QueueData *queueData, const LaneObservation *obs, int lane);
+VehicleNode *findFirstWaitingVehicle(Queue *queue);
+void printGreenStats(QueueData *queueData);
+int benchmarkSchedulingPolicies(const char *name);
 void *readAndParseFile(void *arg);
+void *readFromRing(void *arg);
+void *readSegmentedLog(void *arg);
+bool loadCheckpoint(ReadCheckpoint *checkpoint);
+void saveCheckpoint(ReadCheckpoint *checkpoint, int intervalMs);
+int benchmarkTransport(void);
+bool saveSnapshot(QueueData *queueData, const char *path);
+void publishLiveState(QueueData *queueData);
+void *serveQueries(void *arg);
+bool loadSnapshot(QueueData *queueData, const char *path);
+VehicleNode *allocVehicleNode(void);
+void freeVehicleNode(VehicleNode *node);
+void plateIndexInsert(VehicleNode *node);
+bool findVehicle(QueueData *queueData, const char *plate, VehicleLocation *location);
 void initQueue(Queue *queue);
-void enqueue(Queue *queue, const char *vehicleNumber, char road);
+void enqueue(Queue *queue, const char *vehicleNumber, int numberLength, char road);
+size_t scanVehicleRecords(const char *data, size_t length, VehicleRecord *records, int maxRecords, int *count);
+void enqueueBatch(Queue *queue, const VehicleRecord *records, int count);
+void promoteBacklog(Queue *queue, char road);
+void enqueueRecords(QueueData *queueData, const VehicleRecord *records, int count);
+bool openSpoolFiles(QueueData *queueData);
+void *readmitSpilled(void *arg);
+void *sampleHistory(void *arg);
+int dumpHistory(const char *path);
+void printOverflowStats(QueueData *queueData);
+void lockQueues(QueueData *queueData, LockSite *site);
+void unlockQueues(QueueData *queueData);
+void startLockProfile(int holdThresholdMs);
+void printLockProfile(QueueData *queueData);
+void recordJourney(int lane, const VehicleNode *vehicle);
+void printJourneyLatency(void);
+void startTrace(const char *path);
+void traceThread(const char *name);
+void traceSpan(const char *category, const char *name, uint64_t startNs, const char *argName, int64_t arg);
+bool writeTrace(const char *path);
+int benchmarkParser(const char *path);
+int benchmarkMemory(long vehicles);
+int benchmarkUpdate(int maxDepth);
+int runEventSimulation(const SchedulingPolicy *policy, const GreenTiming *timing, bool concurrentPhases,
+                       double hours, const double rates[LANE_COUNT]);
 VehicleNode *dequeue(Queue *queue);
 int getQueueSize(Queue *queue);
 void freeQueue(Queue *queue);
 void drawVehicles(SDL_Renderer *renderer, TTF_Font *font, QueueData *queueData);
 void drawQueueStatus(SDL_Renderer *renderer, TTF_Font *font, QueueData *queueData);
+bool isVehicleOnScreen(const VehicleNode *vehicle);
+void drawHiddenVehicles(SDL_Renderer *renderer, TTF_Font *font, char road, int hidden, SDL_Color color);
 void updateVehicles(QueueData *queueData, float deltaTime);
 float getStopPositionX(char road, int queuePosition);
 float getStopPositionY(char road, int queuePosition);
 float getSpawnPositionX(char road, Queue *queue);
 float getSpawnPositionY(char road, Queue *queue);
-VehicleNode *findVehicleAhead(Queue *queue, VehicleNode *current);
-bool canMoveForward(VehicleNode *current, VehicleNode *ahead, char road);
 bool isAnyVehicleCrossingIntersection(QueueData *queueData);
 VehicleNode *findLastNonCrossedVehicle(Queue *queue);
 int getWaitingVehicleCount(Queue *queue);
-bool isVehicleInIntersection(VehicleNode *vehicle);
 void setVehicleExitTarget(VehicleNode *vehicle);
 void setVehicleTurnTarget(VehicleNode *vehicle);
 void setVehicleStraightTarget(VehicleNode *vehicle);
-TurnDirection getRandomTurnDirection(void);
+TurnDirection getRandomTurnDirection(char road);
 char getRightTurnDestination(char road);
+bool loadLayout(const char *path);
+void buildRoadGeometry(void);
+bool overlapsJunction(const VehicleNode *vehicle);
+
+
+//Read a junction layout, one "key value..." per line, # starts a comment:
+//  window W H       window size in pixels
+//  lane_width PX    width of every lane
+//  roads A B C      roads that exist; leaving one out makes a T-junction
+//Keys left out keep the built-in four-way values.
+bool loadLayout(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        SDL_Log("Cannot open layout %s: %s", path, strerror(errno));
+        return false;
+    }
 
-//Visual vehicle functions
-void initVisualVehicles(void);
-void updateVisualVehicles(float deltaTime);
-void drawVisualVehicles(SDL_Renderer *renderer);
+    JunctionLayout loaded = layout;
+    char line[256];
+    int lineNumber = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        lineNumber++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char key[32];
+        int used;
+        if (sscanf(line, "%31s%n", key, &used) != 1) continue;
+        const char *value = line + used;
 
+        if (strcmp(key, "window") == 0) {
+            ok = sscanf(value, "%d %d", &loaded.windowWidth, &loaded.windowHeight) == 2;
+        } else if (strcmp(key, "lane_width") == 0) {
+            ok = sscanf(value, "%d", &loaded.laneWidth) == 1;
+        } else if (strcmp(key, "roads") == 0) {
+            memset(loaded.roadPresent, 0, sizeof(loaded.roadPresent));
+            for (const char *c = value; *c; c++) {
+                if (*c >= 'A' && *c < 'A' + LANE_COUNT) {
+                    loaded.roadPresent[*c - 'A'] = true;
+                } else if (*c != ' ' && *c != '\t' && *c != '\n' && *c != '\r') {
+                    ok = false;
+                }
+            }
+        } else {
+            ok = false;
+        }
+        if (!ok) SDL_Log("%s:%d: cannot read '%s'", path, lineNumber, key);
+    }
+    fclose(file);
+    if (!ok) return false;
+
+    int roads = 0;
+    for (int road = 0; road < LANE_COUNT; road++) roads += loaded.roadPresent[road];
+    int roadWidth = LANES_PER_ROAD * loaded.laneWidth;
+    if (loaded.laneWidth < 2 * VEHICLE_WIDTH) {
+        SDL_Log("%s: lane_width must be at least %d", path, 2 * VEHICLE_WIDTH);
+        return false;
+    }
+    if (loaded.windowWidth < roadWidth + 2 * LAYOUT_MIN_MARGIN ||
+        loaded.windowHeight < roadWidth + 2 * LAYOUT_MIN_MARGIN) {
+        SDL_Log("%s: a %d px wide road needs a window of at least %d x %d", path, roadWidth,
+                roadWidth + 2 * LAYOUT_MIN_MARGIN, roadWidth + 2 * LAYOUT_MIN_MARGIN);
+        return false;
+    }
+    if (roads < 3) {
+        SDL_Log("%s: a junction needs at least three roads", path);
+        return false;
+    }
+    loaded.name = path;
+    layout = loaded;
+    SDL_Log("Layout %s: %d x %d window, %d px lanes, %d roads", path, layout.windowWidth,
+            layout.windowHeight, layout.laneWidth, roads);
+    return true;
+}
+
+//Fill roadGeometry from the current layout
+void buildRoadGeometry(void)
+{
+    const int w = HIDDEN_INDICATOR_WIDTH, h = HIDDEN_INDICATOR_HEIGHT;
+    const float overshoot = 50;  //exit targets lie this far past the window edge
+    RoadGeometry roads[LANE_COUNT] = {
+        {   //A: top, drives down; right turns leave to the left along D's outgoing lane
+            .rightTurnTo = 'D', .dirX = 0, .dirY = 1, .length = VEHICLE_HEIGHT,
+            .stopX = LANE_A_X, .stopY = STOP_LINE_A,
+            .spawnProgress = -VEHICLE_HEIGHT - VEHICLE_GAP,
+            .entryProgress = JUNCTION_TOP - VEHICLE_HEIGHT,
+            .exitProgress = WINDOW_HEIGHT + VEHICLE_HEIGHT + overshoot,
+            .turnProgress = LANE_D_OUT_Y, .turnDirX = -1, .turnDirY = 0,
+            .turnExitX = -VEHICLE_WIDTH - overshoot, .turnExitY = LANE_D_OUT_Y,
+            .arm = {JUNCTION_LEFT, 0, ROAD_WIDTH, JUNCTION_TOP},
+            .light = {JUNCTION_RIGHT + 10, JUNCTION_TOP - 40, 40, 30},
+            .hidden = {LANE_A_X + VEHICLE_WIDTH / 2 - w / 2, 0, w, h},
+            .labelX = WINDOW_WIDTH / 2, .labelY = 10,
+        },
+        {   //B: bottom, drives up; right turns leave to the right along C's outgoing lane
+            .rightTurnTo = 'C', .dirX = 0, .dirY = -1, .length = VEHICLE_HEIGHT,
+            .stopX = LANE_B_X, .stopY = STOP_LINE_B,
+            .spawnProgress = -(WINDOW_HEIGHT + VEHICLE_HEIGHT + VEHICLE_GAP),
+            .entryProgress = -JUNCTION_BOTTOM,
+            .exitProgress = VEHICLE_HEIGHT + overshoot,
+            .turnProgress = -LANE_C_OUT_Y, .turnDirX = 1, .turnDirY = 0,
+            .turnExitX = WINDOW_WIDTH + VEHICLE_WIDTH + overshoot, .turnExitY = LANE_C_OUT_Y,
+            .arm = {JUNCTION_LEFT, JUNCTION_BOTTOM, ROAD_WIDTH, WINDOW_HEIGHT - JUNCTION_BOTTOM},
+            .light = {JUNCTION_LEFT - 50, JUNCTION_BOTTOM + 10, 40, 30},
+            .hidden = {LANE_B_X + VEHICLE_WIDTH / 2 - w / 2, WINDOW_HEIGHT - h, w, h},
+            .labelX = WINDOW_WIDTH / 2, .labelY = WINDOW_HEIGHT - 30,
+        },
+        {   //C: right, drives left; right turns leave upwards along A's outgoing lane
+            .rightTurnTo = 'A', .dirX = -1, .dirY = 0, .length = VEHICLE_WIDTH,
+            .stopX = STOP_LINE_C, .stopY = LANE_C_Y,
+            .spawnProgress = -(WINDOW_WIDTH + VEHICLE_WIDTH + VEHICLE_GAP),
+            .entryProgress = -JUNCTION_RIGHT,
+            .exitProgress = VEHICLE_WIDTH + overshoot,
+            .turnProgress = -LANE_A_OUT_X, .turnDirX = 0, .turnDirY = -1,
+            .turnExitX = LANE_A_OUT_X, .turnExitY = -VEHICLE_HEIGHT - overshoot,
+            .arm = {JUNCTION_RIGHT, JUNCTION_TOP, WINDOW_WIDTH - JUNCTION_RIGHT, ROAD_WIDTH},
+            .light = {JUNCTION_RIGHT + 10, JUNCTION_BOTTOM + 10, 40, 30},
+            .hidden = {WINDOW_WIDTH - w, LANE_C_Y + VEHICLE_HEIGHT / 2 - h / 2, w, h},
+            .labelX = WINDOW_WIDTH - 30, .labelY = WINDOW_HEIGHT / 2,
+        },
+        {   //D: left, drives right; right turns leave downwards along B's outgoing lane
+            .rightTurnTo = 'B', .dirX = 1, .dirY = 0, .length = VEHICLE_WIDTH,
+            .stopX = STOP_LINE_D, .stopY = LANE_D_Y,
+            .spawnProgress = -VEHICLE_WIDTH - VEHICLE_GAP,
+            .entryProgress = JUNCTION_LEFT - VEHICLE_WIDTH,
+            .exitProgress = WINDOW_WIDTH + VEHICLE_WIDTH + overshoot,
+            .turnProgress = LANE_B_OUT_X, .turnDirX = 0, .turnDirY = 1,
+            .turnExitX = LANE_B_OUT_X, .turnExitY = WINDOW_HEIGHT + VEHICLE_HEIGHT + overshoot,
+            .arm = {0, JUNCTION_TOP, JUNCTION_LEFT, ROAD_WIDTH},
+            .light = {JUNCTION_LEFT - 50, JUNCTION_TOP - 40, 40, 30},
+            .hidden = {0, LANE_D_Y + VEHICLE_HEIGHT / 2 - h / 2, w, h},
+            .labelX = 10, .labelY = WINDOW_HEIGHT / 2,
+        },
+    };
+    //Free left-turn lanes: the outer lane of each road, turning into the
+    //outgoing L1 lane of the road on its left. The rest matches the road.
+    RoadGeometry freeLanes[LANE_COUNT] = {
+        {   //AL3: rightmost, turns left onto CL1
+            .stopX = LANE_AL3_X, .stopY = STOP_LINE_A,
+            .turnProgress = LANE_CL1_Y, .turnDirX = 1, .turnDirY = 0,
+            .turnExitX = WINDOW_WIDTH + VEHICLE_WIDTH + overshoot, .turnExitY = LANE_CL1_Y,
+            .hidden = {LANE_AL3_X + VEHICLE_WIDTH / 2 - w / 2, h + 2, w, h},
+        },
+        {   //BL3: leftmost, turns left onto DL1
+            .stopX = LANE_BL3_X, .stopY = STOP_LINE_B,
+            .turnProgress = -LANE_DL1_Y, .turnDirX = -1, .turnDirY = 0,
+            .turnExitX = -VEHICLE_WIDTH - overshoot, .turnExitY = LANE_DL1_Y,
+            .hidden = {LANE_BL3_X + VEHICLE_WIDTH / 2 - w / 2, WINDOW_HEIGHT - 2 * h - 2, w, h},
+        },
+        {   //CL3: bottommost, turns left onto BL1
+            .stopX = STOP_LINE_C, .stopY = LANE_CL3_Y,
+            .turnProgress = -LANE_BL1_X, .turnDirX = 0, .turnDirY = 1,
+            .turnExitX = LANE_BL1_X, .turnExitY = WINDOW_HEIGHT + VEHICLE_HEIGHT + overshoot,
+            .hidden = {WINDOW_WIDTH - w, LANE_CL3_Y + VEHICLE_HEIGHT / 2 - h / 2, w, h},
+        },
+        {   //DL3: topmost, turns left onto AL1
+            .stopX = STOP_LINE_D, .stopY = LANE_DL3_Y,
+            .turnProgress = LANE_AL1_X, .turnDirX = 0, .turnDirY = -1,
+            .turnExitX = LANE_AL1_X, .turnExitY = -VEHICLE_HEIGHT - overshoot,
+            .hidden = {0, LANE_DL3_Y + VEHICLE_HEIGHT / 2 - h / 2, w, h},
+        },
+    };
+    static const char opposite[LANE_COUNT] = {'B', 'A', 'D', 'C'};
+    static const char leftTurnTo[LANE_COUNT] = {'C', 'D', 'B', 'A'};
+
+    for (int road = 0; road < LANE_COUNT; road++) {
+        roads[road].present = layout.roadPresent[road];
+        roads[road].straightAllowed = layout.roadPresent[opposite[road] - 'A'];
+        roads[road].rightAllowed = layout.roadPresent[roads[road].rightTurnTo - 'A'];
+        roadGeometry[road] = roads[road];
+
+        RoadGeometry *lane = &freeLanes[road];
+        lane->present = roads[road].present && layout.roadPresent[leftTurnTo[road] - 'A'];
+        lane->dirX = roads[road].dirX;
+        lane->dirY = roads[road].dirY;
+        lane->length = roads[road].length;
+        lane->spawnProgress = roads[road].spawnProgress;
+        lane->entryProgress = roads[road].entryProgress;
+        lane->exitProgress = roads[road].exitProgress;
+        roadGeometry[LANE_COUNT + road] = *lane;
+    }
+
+    //Crossed vehicles are removed once they are a vehicle length and 10 px
+    //past the window edge, which is this far short of their exit target
+    const float removeBefore = overshoot - 10;
+    for (int lane = 0; lane < QUEUED_LANE_COUNT; lane++) {
+        const RoadGeometry *g = &roadGeometry[lane];
+        float turnExit = g->turnExitX * g->turnDirX + g->turnExitY * g->turnDirY;
+        KinematicsPhase approach = {g->dirX, g->dirY, roadProgress(g, g->stopX, g->stopY), g->entryProgress, false};
+        KinematicsPhase straight = {g->dirX, g->dirY, g->exitProgress, g->exitProgress - removeBefore, true};
+        KinematicsPhase turning = {g->dirX, g->dirY, g->turnProgress, g->turnProgress, false};
+        KinematicsPhase turned = {g->turnDirX, g->turnDirY, turnExit, turnExit - removeBefore, true};
+
+        KinematicsPhase *phases = kinematics[lane][TURN_STRAIGHT];
+        phases[PHASE_APPROACH] = approach;
+        phases[PHASE_CROSSING] = straight;
+        phases[PHASE_TURNED] = straight;  //never used: straight vehicles do not turn
+        phases = kinematics[lane][lane < LANE_COUNT ? TURN_RIGHT : TURN_LEFT];
+        phases[PHASE_APPROACH] = approach;
+        phases[PHASE_CROSSING] = turning;
+        phases[PHASE_TURNED] = turned;
+    }
+}
 
-//Get random turn direction
-TurnDirection getRandomTurnDirection(void)
+//Get random turn direction, among the movements the layout allows for road;
+//the free left-turn lanes only turn left
+TurnDirection getRandomTurnDirection(char road)
 {
+    if (roadLane(road) >= LANE_COUNT) return TURN_LEFT;
+    const RoadGeometry *geometry = geometryOf(road);
+    if (!geometry->rightAllowed) return TURN_STRAIGHT;
+    if (!geometry->straightAllowed) return TURN_RIGHT;
     int random = rand() % 100;
     if (random < TURN_RIGHT_PROBABILITY) {
         return TURN_RIGHT;
@@ -218,91 +1192,36 @@ TurnDirection getRandomTurnDirection(void)
 //Get destination road for right turn
 char getRightTurnDestination(char road)
 {
-    switch (road) {
-        case 'A': return 'D';  // A turns right to D (going left)
-        case 'B': return 'C';  // B turns right to C (going right)
-        case 'C': return 'A';  // C turns right to A (going up)
-        case 'D': return 'B';  // D turns right to B (going down)
-        default: return road;
-    }
+    if (road < 'A' || road >= 'A' + LANE_COUNT) return road;
+    return geometryOf(road)->rightTurnTo;
 }
 
 //Set target for vehicle going straight through intersection
 void setVehicleStraightTarget(VehicleNode *vehicle)
 {
-    switch (vehicle->road) {
-        case 'A':
-            vehicle->targetX = vehicle->x;
-            vehicle->targetY = WINDOW_HEIGHT + VEHICLE_HEIGHT + 50;
-            break;
-        case 'B':
-            vehicle->targetX = vehicle->x;
-            vehicle->targetY = -VEHICLE_HEIGHT - 50;
-            break;
-        case 'C':
-            vehicle->targetX = -VEHICLE_WIDTH - 50;
-            vehicle->targetY = vehicle->y;
-            break;
-        case 'D':
-            vehicle->targetX = WINDOW_WIDTH + VEHICLE_WIDTH + 50;
-            vehicle->targetY = vehicle->y;
-            break;
-    }
+    const RoadGeometry *geometry = geometryOf(vehicle->road);
+    float x = fromCoord(vehicle->x), y = fromCoord(vehicle->y);
+    float ahead = geometry->exitProgress - roadProgress(geometry, x, y);
+    vehicle->targetX = toCoord(x + geometry->dirX * ahead);
+    vehicle->targetY = toCoord(y + geometry->dirY * ahead);
 }
 
-//Set intermediate target for turning (intersection center area)
+//Set intermediate target for turning: straight on until aligned with the outgoing lane
 void setVehicleTurnTarget(VehicleNode *vehicle)
 {
-    //Move to the turning point aligned with the outgoing lane
-    switch (vehicle->road) {
-        case 'A':
-            //A turning right: move down to D's outgoing lane Y position, then turn left
-            vehicle->targetX = vehicle->x;
-            vehicle->targetY = LANE_D_OUT_Y;  //turn at D's outgoing lane position
-            break;
-        case 'B':
-            //B turning right: move up to C's outgoing lane Y position, then turn right
-            vehicle->targetX = vehicle->x;
-            vehicle->targetY = LANE_C_OUT_Y;  //turn at C's outgoing lane position
-            break;
-        case 'C':
-            //C turning right: move left to A's outgoing lane X position, then turn up
-            vehicle->targetX = LANE_A_OUT_X;  //turn at A's outgoing lane position
-            vehicle->targetY = vehicle->y;
-            break;
-        case 'D':
-            //D turning right: move right to B's outgoing lane X position, then turn down
-            vehicle->targetX = LANE_B_OUT_X;  //turn at B's outgoing lane position
-            vehicle->targetY = vehicle->y;
-            break;
-    }
+    const RoadGeometry *geometry = geometryOf(vehicle->road);
+    float x = fromCoord(vehicle->x), y = fromCoord(vehicle->y);
+    float ahead = geometry->turnProgress - roadProgress(geometry, x, y);
+    vehicle->targetX = toCoord(x + geometry->dirX * ahead);
+    vehicle->targetY = toCoord(y + geometry->dirY * ahead);
 }
 
 //Set final exit target after completing turn
 void setVehicleTurnExitTarget(VehicleNode *vehicle)
 {
-    switch (vehicle->road) {
-        case 'A':
-            //A turned right, now going left (exit on D's outgoing lane)
-            vehicle->targetX = -VEHICLE_WIDTH - 50;
-            vehicle->targetY = LANE_D_OUT_Y;
-            break;
-        case 'B':
-            //B turned right, now going right (exit on C's outgoing lane)
-            vehicle->targetX = WINDOW_WIDTH + VEHICLE_WIDTH + 50;
-            vehicle->targetY = LANE_C_OUT_Y;
-            break;
-        case 'C':
-            //C turned right, now going up (exit on A's outgoing lane)
-            vehicle->targetX = LANE_A_OUT_X;
-            vehicle->targetY = -VEHICLE_HEIGHT - 50;
-            break;
-        case 'D':
-            //D turned right, now going down (exit on B's outgoing lane)
-            vehicle->targetX = LANE_B_OUT_X;
-            vehicle->targetY = WINDOW_HEIGHT + VEHICLE_HEIGHT + 50;
-            break;
-    }
+    const RoadGeometry *geometry = geometryOf(vehicle->road);
+    vehicle->targetX = toCoord(geometry->turnExitX);
+    vehicle->targetY = toCoord(geometry->turnExitY);
 }
 
 //Find the last vehicle that hasn't crossed yet
@@ -314,12 +1233,12 @@ VehicleNode *findLastNonCrossedVehicle(Queue *queue)
         if (!current->hasCrossed) {
             last = current;
         }
-        current = current->next;
+        current = nextVehicle(current);
     }
     return last;
 }
 
-//Get count of vehicles waiting (not crossed yet)
+//Get count of vehicles waiting (not crossed yet), backlog included
 int getWaitingVehicleCount(Queue *queue)
 {
     int count = 0;
@@ -328,442 +1247,515 @@ int getWaitingVehicleCount(Queue *queue)
         if (!current->hasCrossed) {
             count++;
         }
-        current = current->next;
+        current = nextVehicle(current);
     }
-    return count;
+    return count + (int)queue->backlog.count;
 }
 
-//Initialize visual vehicle arrays
-void initVisualVehicles(void)
+//Spawn position for a new vehicle behind lastNonCrossed - always off-screen.
+//Taking the vehicle instead of the queue lets enqueueBatch chain new vehicles without rescanning.
+static void getSpawnPositionBehind(char road, const VehicleNode *lastNonCrossed, float *x, float *y)
 {
-    for (int i = 0; i < MAX_VISUAL_VEHICLES; i++) {
-        visualVehiclesAL3[i].active = false;
-        visualVehiclesAL3[i].hasCompletedTurn = false;
-        
-        visualVehiclesCL3[i].active = false;
-        visualVehiclesCL3[i].hasCompletedTurn = false;
-        
-        visualVehiclesBL3[i].active = false;
-        visualVehiclesBL3[i].hasCompletedTurn = false;
-        
-        visualVehiclesDL3[i].active = false;
-        visualVehiclesDL3[i].hasCompletedTurn = false;
-    }
-    Uint32 startTime = SDL_GetTicks();
-    lastSpawnTimeAL3 = startTime;
-    lastSpawnTimeCL3 = startTime;
-    lastSpawnTimeBL3 = startTime;
-    lastSpawnTimeDL3 = startTime;
-    nextSpawnIntervalAL3 = VISUAL_SPAWN_INTERVAL_MIN + rand() % (VISUAL_SPAWN_INTERVAL_MAX - VISUAL_SPAWN_INTERVAL_MIN);
-    nextSpawnIntervalCL3 = VISUAL_SPAWN_INTERVAL_MIN + rand() % (VISUAL_SPAWN_INTERVAL_MAX - VISUAL_SPAWN_INTERVAL_MIN);
-    nextSpawnIntervalBL3 = VISUAL_SPAWN_INTERVAL_MIN + rand() % (VISUAL_SPAWN_INTERVAL_MAX - VISUAL_SPAWN_INTERVAL_MIN);
-    nextSpawnIntervalDL3 = VISUAL_SPAWN_INTERVAL_MIN + rand() % (VISUAL_SPAWN_INTERVAL_MAX - VISUAL_SPAWN_INTERVAL_MIN);
-}
-
-//Spawn visual vehicles - static helper functions
-static void spawnVisualVehicleAL3(void)
-{
-    for (int i = 0; i < MAX_VISUAL_VEHICLES; i++) {
-        if (!visualVehiclesAL3[i].active) {
-            visualVehiclesAL3[i].active = true;
-            visualVehiclesAL3[i].x = LANE_AL3_X;
-            visualVehiclesAL3[i].y = -VEHICLE_HEIGHT - VEHICLE_GAP;
-            visualVehiclesAL3[i].hasCompletedTurn = false;
-            break;
-        }
+    const RoadGeometry *geometry = geometryOf(road);
+    float progress = geometry->spawnProgress;
+    if (lastNonCrossed != NULL) {
+        //behind both where the last vehicle is and where it is heading
+        float furthestBack = fminf(
+            roadProgress(geometry, fromCoord(lastNonCrossed->x), fromCoord(lastNonCrossed->y)),
+            roadProgress(geometry, fromCoord(lastNonCrossed->targetX), fromCoord(lastNonCrossed->targetY)));
+        progress = fminf(progress, furthestBack - geometry->length - VEHICLE_GAP);
     }
+    roadPoint(geometry, progress, x, y);
 }
 
-static void spawnVisualVehicleCL3(void)
+//Get spawn position for new vehicle - always off-screen
+float getSpawnPositionX(char road, Queue *queue)
 {
-    for (int i = 0; i < MAX_VISUAL_VEHICLES; i++) {
-        if (!visualVehiclesCL3[i].active) {
-            visualVehiclesCL3[i].active = true;
-            visualVehiclesCL3[i].x = WINDOW_WIDTH + VEHICLE_WIDTH + VEHICLE_GAP;
-            visualVehiclesCL3[i].y = LANE_CL3_Y;
-            visualVehiclesCL3[i].hasCompletedTurn = false;
-            break;
-        }
-    }
+    float x, y;
+    getSpawnPositionBehind(road, findLastNonCrossedVehicle(queue), &x, &y);
+    return x;
 }
 
-static void spawnVisualVehicleBL3(void)
+float getSpawnPositionY(char road, Queue *queue)
 {
-    for (int i = 0; i < MAX_VISUAL_VEHICLES; i++) {
-        if (!visualVehiclesBL3[i].active) {
-            visualVehiclesBL3[i].active = true;
-            visualVehiclesBL3[i].x = LANE_BL3_X;
-            visualVehiclesBL3[i].y = WINDOW_HEIGHT + VEHICLE_HEIGHT + VEHICLE_GAP;
-            visualVehiclesBL3[i].hasCompletedTurn = false;
-            break;
-        }
-    }
+    float x, y;
+    getSpawnPositionBehind(road, findLastNonCrossedVehicle(queue), &x, &y);
+    return y;
 }
 
-static void spawnVisualVehicleDL3(void)
+//Vehicle nodes come from one array reserved up front with mmap (pages are
+//only committed as the pool grows) and are recycled through a free list, so
+//neither a large backlog nor a snapshot restore pays one malloc per vehicle,
+//and a node is named by a 32-bit index instead of a pointer.
+//Callers hold queueData->mutex.
+VehicleNode *allocVehicleNode(void)
 {
-    for (int i = 0; i < MAX_VISUAL_VEHICLES; i++) {
-        if (!visualVehiclesDL3[i].active) {
-            visualVehiclesDL3[i].active = true;
-            visualVehiclesDL3[i].x = -VEHICLE_WIDTH - VEHICLE_GAP;
-            visualVehiclesDL3[i].y = LANE_DL3_Y;
-            visualVehiclesDL3[i].hasCompletedTurn = false;
-            break;
-        }
+    if (vehiclePool == NULL) {
+        void *pool = mmap(NULL, (size_t)VEHICLE_POOL_CAPACITY * sizeof(VehicleNode), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (pool == MAP_FAILED) return NULL;
+        vehiclePool = (VehicleNode *)pool;
+    }
+    if (carFollowing && vehicleSpeed == NULL) {
+        void *speeds = mmap(NULL, (size_t)VEHICLE_POOL_CAPACITY * sizeof(float), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (speeds == MAP_FAILED) return NULL;
+        vehicleSpeed = (float *)speeds;
+    }
+    if (journeyLatency && journeyStamps == NULL) {
+        void *stamps = mmap(NULL, (size_t)VEHICLE_POOL_CAPACITY * sizeof(JourneyStamps), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (stamps == MAP_FAILED) return NULL;
+        journeyStamps = (JourneyStamps *)stamps;
+    }
+    VehicleNode *node;
+    if (vehicleFreeList != VEHICLE_NONE) {
+        node = &vehiclePool[vehicleFreeList];
+        vehicleFreeList = node->next;
+    } else if (vehiclePoolUsed < VEHICLE_POOL_CAPACITY) {
+        node = &vehiclePool[vehiclePoolUsed++];
+    } else {
+        return NULL;
     }
+    if (vehicleSpeed) vehicleSpeed[vehicleIndex(node)] = 0;  //new and restored vehicles start from rest
+    if (journeyStamps) memset(&journeyStamps[vehicleIndex(node)], 0, sizeof(JourneyStamps));
+    return node;
 }
 
-//Update visual vehicles movement
-void updateVisualVehicles(float deltaTime)
+static PlateIndex plateIndex = {NULL, 0, 0};
+
+//Home slot: the top 32 bits of the mixed plate scaled onto [0, capacity), so
+//the table can grow by 1.5x instead of doubling
+static inline size_t plateHash(uint64_t plate, size_t capacity)
 {
-    Uint32 currentTime = SDL_GetTicks();
-    
-    //Spawn new vehicles at random intervals
-    if (currentTime - lastSpawnTimeAL3 >= nextSpawnIntervalAL3) {
-        spawnVisualVehicleAL3();
-        lastSpawnTimeAL3 = currentTime;
-        nextSpawnIntervalAL3 = VISUAL_SPAWN_INTERVAL_MIN + rand() % (VISUAL_SPAWN_INTERVAL_MAX - VISUAL_SPAWN_INTERVAL_MIN);
-    }
-    if (currentTime - lastSpawnTimeCL3 >= nextSpawnIntervalCL3) {
-        spawnVisualVehicleCL3();
-        lastSpawnTimeCL3 = currentTime;
-        nextSpawnIntervalCL3 = VISUAL_SPAWN_INTERVAL_MIN + rand() % (VISUAL_SPAWN_INTERVAL_MAX - VISUAL_SPAWN_INTERVAL_MIN);
-    }
-    if (currentTime - lastSpawnTimeBL3 >= nextSpawnIntervalBL3) {
-        spawnVisualVehicleBL3();
-        lastSpawnTimeBL3 = currentTime;
-        nextSpawnIntervalBL3 = VISUAL_SPAWN_INTERVAL_MIN + rand() % (VISUAL_SPAWN_INTERVAL_MAX - VISUAL_SPAWN_INTERVAL_MIN);
-    }
-    if (currentTime - lastSpawnTimeDL3 >= nextSpawnIntervalDL3) {
-        spawnVisualVehicleDL3();
-        lastSpawnTimeDL3 = currentTime;
-        nextSpawnIntervalDL3 = VISUAL_SPAWN_INTERVAL_MIN + rand() % (VISUAL_SPAWN_INTERVAL_MAX - VISUAL_SPAWN_INTERVAL_MIN);
+    uint64_t mixed = (plate * 0x9E3779B97F4A7C15ull) >> 32;
+    return (size_t)((mixed * capacity) >> 32);
+}
+
+static inline size_t plateIndexNext(size_t slot)
+{
+    return slot + 1 == plateIndex.capacity ? 0 : slot + 1;
+}
+
+static void plateIndexResize(size_t capacity)
+{
+    uint32_t *old = plateIndex.slots;
+    size_t oldCapacity = plateIndex.capacity;
+    uint32_t *slots = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+    if (!slots) {
+        SDL_Log("failed to grow plate index to %zu slots", capacity);
+        return;
     }
-    
-    float moveAmount = VEHICLE_SPEED * deltaTime;
-    
-    //Update AL3 vehicles (going down, then turn left to CL1 - exit right)
-    for (int i = 0; i < MAX_VISUAL_VEHICLES; i++) {
-        if (visualVehiclesAL3[i].active) {
-            if (!visualVehiclesAL3[i].hasCompletedTurn) {
-                //Phase 1: Move down to turning point
-                visualVehiclesAL3[i].y += moveAmount;
-                if (visualVehiclesAL3[i].y >= LANE_CL1_Y) {
-                    visualVehiclesAL3[i].y = LANE_CL1_Y;
-                    visualVehiclesAL3[i].hasCompletedTurn = true;
-                }
-            } else {
-                //Phase 2: Move right to exit
-                visualVehiclesAL3[i].x += moveAmount;
-            }
-            //Deactivate if off-screen
-            if (visualVehiclesAL3[i].x > WINDOW_WIDTH + VEHICLE_WIDTH) {
-                visualVehiclesAL3[i].active = false;
-            }
-        }
+    for (size_t i = 0; i < capacity; i++) slots[i] = VEHICLE_NONE;
+    plateIndex.slots = slots;
+    plateIndex.capacity = capacity;
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (old[i] == VEHICLE_NONE) continue;
+        size_t slot = plateHash(vehiclePool[old[i]].plate, capacity);
+        while (slots[slot] != VEHICLE_NONE) slot = plateIndexNext(slot);
+        slots[slot] = old[i];
     }
-    
-    //Update CL3 vehicles (going left, then turn left to BL1 - exit down)
-    for (int i = 0; i < MAX_VISUAL_VEHICLES; i++) {
-        if (visualVehiclesCL3[i].active) {
-            if (!visualVehiclesCL3[i].hasCompletedTurn) {
-                //Phase 1: Move left to turning point
-                visualVehiclesCL3[i].x -= moveAmount;
-                if (visualVehiclesCL3[i].x <= LANE_BL1_X) {
-                    visualVehiclesCL3[i].x = LANE_BL1_X;
-                    visualVehiclesCL3[i].hasCompletedTurn = true;
-                }
-            } else {
-                //Phase 2: Move down to exit
-                visualVehiclesCL3[i].y += moveAmount;
-            }
-            //Deactivate if off-screen
-            if (visualVehiclesCL3[i].y > WINDOW_HEIGHT + VEHICLE_HEIGHT) {
-                visualVehiclesCL3[i].active = false;
-            }
-        }
+    free(old);
+}
+
+static inline bool plateIndexFits(size_t count)
+{
+    return count * PLATE_INDEX_LOAD_DEN <= plateIndex.capacity * PLATE_INDEX_LOAD_NUM;
+}
+
+//Size the index for count vehicles up front, e.g. before loading a known backlog
+void plateIndexReserve(size_t count)
+{
+    if (plateIndexFits(count)) return;
+    size_t capacity = count * PLATE_INDEX_LOAD_DEN / PLATE_INDEX_LOAD_NUM + 1;
+    plateIndexResize(capacity < PLATE_INDEX_MIN_CAPACITY ? PLATE_INDEX_MIN_CAPACITY : capacity);
+}
+
+//Index a queued vehicle. A plate seen twice points at the newer vehicle.
+void plateIndexInsert(VehicleNode *node)
+{
+    if (!plateIndexFits(plateIndex.count + 1)) {
+        plateIndexResize(plateIndex.capacity ? plateIndex.capacity + plateIndex.capacity / 2 : PLATE_INDEX_MIN_CAPACITY);
+        if (!plateIndexFits(plateIndex.count + 1)) return;
     }
-    
-    //Update BL3 vehicles (going up, then turn left to DL1 - exit left)
-    for (int i = 0; i < MAX_VISUAL_VEHICLES; i++) {
-        if (visualVehiclesBL3[i].active) {
-            if (!visualVehiclesBL3[i].hasCompletedTurn) {
-                //Phase 1: Move up to turning point
-                visualVehiclesBL3[i].y -= moveAmount;
-                if (visualVehiclesBL3[i].y <= LANE_DL1_Y) {
-                    visualVehiclesBL3[i].y = LANE_DL1_Y;
-                    visualVehiclesBL3[i].hasCompletedTurn = true;
-                }
-            } else {
-                //Phase 2: Move left to exit
-                visualVehiclesBL3[i].x -= moveAmount;
-            }
-            //Deactivate if off-screen
-            if (visualVehiclesBL3[i].x < -VEHICLE_WIDTH) {
-                visualVehiclesBL3[i].active = false;
-            }
+    size_t slot = plateHash(node->plate, plateIndex.capacity);
+    while (plateIndex.slots[slot] != VEHICLE_NONE) {
+        if (vehiclePool[plateIndex.slots[slot]].plate == node->plate) {
+            plateIndex.slots[slot] = vehicleIndex(node);
+            return;
         }
+        slot = plateIndexNext(slot);
     }
-    
-    //Update DL3 vehicles (going right, then turn left to AL1 - exit up)
-    for (int i = 0; i < MAX_VISUAL_VEHICLES; i++) {
-        if (visualVehiclesDL3[i].active) {
-            if (!visualVehiclesDL3[i].hasCompletedTurn) {
-                //Phase 1: Move right to turning point
-                visualVehiclesDL3[i].x += moveAmount;
-                if (visualVehiclesDL3[i].x >= LANE_AL1_X) {
-                    visualVehiclesDL3[i].x = LANE_AL1_X;
-                    visualVehiclesDL3[i].hasCompletedTurn = true;
-                }
-            } else {
-                //Phase 2: Move up to exit
-                visualVehiclesDL3[i].y -= moveAmount;
-            }
-            //Deactivate if off-screen
-            if (visualVehiclesDL3[i].y < -VEHICLE_HEIGHT) {
-                visualVehiclesDL3[i].active = false;
-            }
-        }
+    plateIndex.slots[slot] = vehicleIndex(node);
+    plateIndex.count++;
+}
+
+static VehicleNode *plateIndexFind(uint64_t plate)
+{
+    if (plateIndex.count == 0) return NULL;
+    for (size_t slot = plateHash(plate, plateIndex.capacity); plateIndex.slots[slot] != VEHICLE_NONE; slot = plateIndexNext(slot)) {
+        if (vehiclePool[plateIndex.slots[slot]].plate == plate) return &vehiclePool[plateIndex.slots[slot]];
     }
+    return NULL;
 }
 
-//Draw visual-only vehicles
-void drawVisualVehicles(SDL_Renderer *renderer)
+//Drop node from the index; backward-shift deletion keeps probe chains intact without tombstones
+static void plateIndexRemove(VehicleNode *node)
 {
-    //Draw AL3 vehicles - BLUE (same as Road A: 0, 100, 255)
-    SDL_SetRenderDrawColor(renderer, 0, 100, 255, 255);
-    for (int i = 0; i < MAX_VISUAL_VEHICLES; i++) {
-        if (visualVehiclesAL3[i].active) {
-            SDL_Rect vehicleRect = {
-                (int)visualVehiclesAL3[i].x,
-                (int)visualVehiclesAL3[i].y,
-                VEHICLE_WIDTH,
-                VEHICLE_HEIGHT
-            };
-            SDL_RenderFillRect(renderer, &vehicleRect);
-            SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-            SDL_RenderDrawRect(renderer, &vehicleRect);
-            SDL_SetRenderDrawColor(renderer, 0, 100, 255, 255);
-        }
+    if (plateIndex.count == 0) return;
+    uint32_t index = vehicleIndex(node);
+    size_t capacity = plateIndex.capacity;
+    size_t slot = plateHash(node->plate, capacity);
+    while (plateIndex.slots[slot] != index) {
+        if (plateIndex.slots[slot] == VEHICLE_NONE) return;  //a newer vehicle with the same plate owns the entry
+        slot = plateIndexNext(slot);
     }
-    
-    //Draw CL3 vehicles - GREEN (same as Road C: 50, 255, 50)
-    SDL_SetRenderDrawColor(renderer, 50, 255, 50, 255);
-    for (int i = 0; i < MAX_VISUAL_VEHICLES; i++) {
-        if (visualVehiclesCL3[i].active) {
-            SDL_Rect vehicleRect = {
-                (int)visualVehiclesCL3[i].x,
-                (int)visualVehiclesCL3[i].y,
-                VEHICLE_WIDTH,
-                VEHICLE_HEIGHT
-            };
-            SDL_RenderFillRect(renderer, &vehicleRect);
-            SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-            SDL_RenderDrawRect(renderer, &vehicleRect);
-            SDL_SetRenderDrawColor(renderer, 50, 255, 50, 255);
+
+    size_t hole = slot;
+    for (size_t next = plateIndexNext(hole); plateIndex.slots[next] != VEHICLE_NONE; next = plateIndexNext(next)) {
+        size_t home = plateHash(vehiclePool[plateIndex.slots[next]].plate, capacity);
+        //move next into the hole unless its home lies cyclically in (hole, next]
+        size_t fromHome = (next + capacity - home) % capacity;
+        size_t fromHole = (next + capacity - hole) % capacity;
+        if (fromHome >= fromHole) {
+            plateIndex.slots[hole] = plateIndex.slots[next];
+            hole = next;
         }
     }
-    
-    //Draw BL3 vehicles - RED (same as Road B: 255, 50, 50)
-    SDL_SetRenderDrawColor(renderer, 255, 50, 50, 255);
-    for (int i = 0; i < MAX_VISUAL_VEHICLES; i++) {
-        if (visualVehiclesBL3[i].active) {
-            SDL_Rect vehicleRect = {
-                (int)visualVehiclesBL3[i].x,
-                (int)visualVehiclesBL3[i].y,
-                VEHICLE_WIDTH,
-                VEHICLE_HEIGHT
-            };
-            SDL_RenderFillRect(renderer, &vehicleRect);
-            SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-            SDL_RenderDrawRect(renderer, &vehicleRect);
-            SDL_SetRenderDrawColor(renderer, 255, 50, 50, 255);
-        }
+    plateIndex.slots[hole] = VEHICLE_NONE;
+    plateIndex.count--;
+}
+
+void freeVehicleNode(VehicleNode *node)
+{
+    plateIndexRemove(node);
+    node->next = vehicleFreeList;
+    vehicleFreeList = vehicleIndex(node);
+}
+
+static BacklogIndex backlogIndex = {NULL, 0, 0};
+static VehicleBacklog *backlogOfLane[QUEUED_LANE_COUNT];  //set by backlogPush, for reading plates back
+
+static inline uint32_t backlogIndexEntry(int lane, uint64_t sequence)
+{
+    return BACKLOG_INDEX_USED | (uint32_t)(sequence & BACKLOG_SEQUENCE_MASK) << 3 | (uint32_t)lane;
+}
+
+//The backlogged vehicle an index entry names
+static inline BackloggedVehicle *backlogIndexVehicle(uint32_t entry, size_t *offset)
+{
+    VehicleBacklog *backlog = backlogOfLane[entry & 7];
+    *offset = (size_t)(((entry >> 3) - backlog->popped) & BACKLOG_SEQUENCE_MASK);
+    return backlogAt(backlog, *offset);
+}
+
+static inline uint64_t backlogIndexPlate(uint32_t entry)
+{
+    size_t offset;
+    return backlogIndexVehicle(entry, &offset)->plate;
+}
+
+static inline size_t backlogIndexNext(size_t slot)
+{
+    return slot + 1 == backlogIndex.capacity ? 0 : slot + 1;
+}
+
+static bool backlogIndexResize(size_t capacity)
+{
+    uint32_t *old = backlogIndex.slots;
+    size_t oldCapacity = backlogIndex.capacity;
+    uint32_t *slots = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+    if (!slots) {
+        SDL_Log("failed to grow backlog index to %zu slots", capacity);
+        return false;
     }
-    
-    //Draw DL3 vehicles - YELLOW (same as Road D: 255, 255, 50)
-    SDL_SetRenderDrawColor(renderer, 255, 255, 50, 255);
-    for (int i = 0; i < MAX_VISUAL_VEHICLES; i++) {
-        if (visualVehiclesDL3[i].active) {
-            SDL_Rect vehicleRect = {
-                (int)visualVehiclesDL3[i].x,
-                (int)visualVehiclesDL3[i].y,
-                VEHICLE_WIDTH,
-                VEHICLE_HEIGHT
-            };
-            SDL_RenderFillRect(renderer, &vehicleRect);
-            SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-            SDL_RenderDrawRect(renderer, &vehicleRect);
-            SDL_SetRenderDrawColor(renderer, 255, 255, 50, 255);
+    backlogIndex.slots = slots;
+    backlogIndex.capacity = capacity;
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (old[i] == BACKLOG_INDEX_EMPTY) continue;
+        size_t slot = plateHash(backlogIndexPlate(old[i]), capacity);
+        while (slots[slot] != BACKLOG_INDEX_EMPTY) slot = backlogIndexNext(slot);
+        slots[slot] = old[i];
+    }
+    free(old);
+    return true;
+}
+
+//Index the vehicle just pushed as entry. A plate seen twice points at the
+//newer vehicle, as in the plate index.
+static void backlogIndexInsert(uint64_t plate, uint32_t entry)
+{
+    if ((backlogIndex.count + 1) * PLATE_INDEX_LOAD_DEN > backlogIndex.capacity * PLATE_INDEX_LOAD_NUM) {
+        size_t capacity = backlogIndex.capacity ? backlogIndex.capacity + backlogIndex.capacity / 2 : PLATE_INDEX_MIN_CAPACITY;
+        if (!backlogIndexResize(capacity)) return;
+    }
+    size_t slot = plateHash(plate, backlogIndex.capacity);
+    while (backlogIndex.slots[slot] != BACKLOG_INDEX_EMPTY) {
+        if (backlogIndexPlate(backlogIndex.slots[slot]) == plate) {
+            backlogIndex.slots[slot] = entry;
+            return;
         }
+        slot = backlogIndexNext(slot);
     }
+    backlogIndex.slots[slot] = entry;
+    backlogIndex.count++;
 }
 
-//Get spawn position for new vehicle - always off-screen
-float getSpawnPositionX(char road, Queue *queue)
+static bool backlogIndexFind(uint64_t plate, uint32_t *entry)
 {
-    VehicleNode *lastNonCrossed = findLastNonCrossedVehicle(queue);
-    
-    switch (road) {
-        case 'A': return LANE_A_X;
-        case 'B': return LANE_B_X;
-        case 'C': {
-            //spawn off-screen to the right, behind last non-crossed vehicle
-            float baseSpawn = WINDOW_WIDTH + VEHICLE_WIDTH + VEHICLE_GAP;
-            if (lastNonCrossed != NULL) {
-                float lastX = lastNonCrossed->x;
-                if (lastNonCrossed->targetX > lastX) lastX = lastNonCrossed->targetX;
-                float spawnX = lastX + VEHICLE_WIDTH + VEHICLE_GAP;
-                if (spawnX < baseSpawn) {
-                    spawnX = baseSpawn;
-                }
-                return spawnX;
-            }
-            return baseSpawn;
-        }
-        case 'D': {
-            //spawn off-screen to the left, behind last non-crossed vehicle
-            float baseSpawn = -VEHICLE_WIDTH - VEHICLE_GAP;
-            if (lastNonCrossed != NULL) {
-                float lastX = lastNonCrossed->x;
-                if (lastNonCrossed->targetX < lastX) lastX = lastNonCrossed->targetX;
-                float spawnX = lastX - VEHICLE_WIDTH - VEHICLE_GAP;
-                if (spawnX > baseSpawn) {
-                    spawnX = baseSpawn;
-                }
-                return spawnX;
-            }
-            return baseSpawn;
+    if (backlogIndex.count == 0) return false;
+    for (size_t slot = plateHash(plate, backlogIndex.capacity); backlogIndex.slots[slot] != BACKLOG_INDEX_EMPTY;
+         slot = backlogIndexNext(slot)) {
+        if (backlogIndexPlate(backlogIndex.slots[slot]) == plate) {
+            *entry = backlogIndex.slots[slot];
+            return true;
         }
-        default: return 0;
     }
+    return false;
 }
 
-float getSpawnPositionY(char road, Queue *queue)
+//Drop entry, called while its vehicle is still in the backlog; backward-shift
+//deletion as in the plate index
+static void backlogIndexRemove(uint64_t plate, uint32_t entry)
 {
-    VehicleNode *lastNonCrossed = findLastNonCrossedVehicle(queue);
-    
-    switch (road) {
-        case 'A': {
-            //spawn off-screen at top, behind last non-crossed vehicle
-            float baseSpawn = -VEHICLE_HEIGHT - VEHICLE_GAP;
-            if (lastNonCrossed != NULL) {
-                //use the smaller Y (further from intersection)
-                float lastY = lastNonCrossed->y;
-                float targetY = lastNonCrossed->targetY;
-                //for A, smaller Y means further back (up)
-                float furthestBack = (lastY < targetY) ? lastY : targetY;
-                float spawnY = furthestBack - VEHICLE_HEIGHT - VEHICLE_GAP;
-                //only use baseSpawn if it's further back
-                if (spawnY > baseSpawn) {
-                    return baseSpawn;
-                }
-                return spawnY;
-            }
-            return baseSpawn;
-        }
-        case 'B': {
-            //spawn off-screen at bottom, behind last non-crossed vehicle
-            float baseSpawn = WINDOW_HEIGHT + VEHICLE_HEIGHT + VEHICLE_GAP;
-            if (lastNonCrossed != NULL) {
-                //use the larger Y (further from intersection)
-                float lastY = lastNonCrossed->y;
-                float targetY = lastNonCrossed->targetY;
-                //for B, larger Y means further back (down)
-                float furthestBack = (lastY > targetY) ? lastY : targetY;
-                float spawnY = furthestBack + VEHICLE_HEIGHT + VEHICLE_GAP;
-                //only use baseSpawn if it's further back
-                if (spawnY < baseSpawn) {
-                    return baseSpawn;
-                }
-                return spawnY;
-            }
-            return baseSpawn;
+    if (backlogIndex.count == 0) return;
+    size_t capacity = backlogIndex.capacity;
+    size_t slot = plateHash(plate, capacity);
+    while (backlogIndex.slots[slot] != entry) {
+        if (backlogIndex.slots[slot] == BACKLOG_INDEX_EMPTY) return;  //a newer vehicle with the same plate owns the entry
+        slot = backlogIndexNext(slot);
+    }
+
+    size_t hole = slot;
+    for (size_t next = backlogIndexNext(hole); backlogIndex.slots[next] != BACKLOG_INDEX_EMPTY; next = backlogIndexNext(next)) {
+        size_t home = plateHash(backlogIndexPlate(backlogIndex.slots[next]), capacity);
+        size_t fromHome = (next + capacity - home) % capacity;
+        size_t fromHole = (next + capacity - hole) % capacity;
+        if (fromHome >= fromHole) {
+            backlogIndex.slots[hole] = backlogIndex.slots[next];
+            hole = next;
         }
-        case 'C': return LANE_C_Y;
-        case 'D': return LANE_D_Y;
-        default: return 0;
     }
+    backlogIndex.slots[hole] = BACKLOG_INDEX_EMPTY;
+    backlogIndex.count--;
+}
+
+//Where is a vehicle and how long has it waited: one hash probe, no queue scan
+bool findVehicle(QueueData *queueData, const char *plate, VehicleLocation *location)
+{
+    Queue *queues[QUEUED_LANE_COUNT];
+    laneQueues(queueData, queues);
+    uint64_t packed = packPlate(plate, (int)strnlen(plate, PLATE_LENGTH));
+    LOCK_QUEUES(queueData);
+    Uint32 now = simTicks();
+    VehicleNode *node = plateIndexFind(packed);
+    bool found = node != NULL;
+    if (node) {
+        location->road = node->road;
+        location->crossed = node->hasCrossed;
+        location->x = fromCoord(node->x);
+        location->y = fromCoord(node->y);
+        location->waitedMs = vehicleWaitedMs(node, now);
+    }
+    //Backlogged vehicles have their own index
+    uint32_t entry;
+    if (!found && backlogIndexFind(packed, &entry)) {
+        int q = entry & 7;
+        VehicleBacklog *backlog = &queues[q]->backlog;
+        size_t i;
+        BackloggedVehicle *vehicle = backlogIndexVehicle(entry, &i);
+        int queuePos = getWaitingVehicleCount(queues[q]) - (int)(backlog->count - i);
+        location->road = laneRoad(q);
+        location->crossed = false;
+        location->x = getStopPositionX(laneRoad(q), queuePos);
+        location->y = getStopPositionY(laneRoad(q), queuePos);
+        location->waitedMs = now - vehicle->arrivalTicks;
+        found = true;
+    }
+    UNLOCK_QUEUES(queueData);
+    return found;
 }
 
 void initQueue(Queue *queue){
     queue->front = NULL;
     queue->rear = NULL;
     queue->size = 0;
+    memset(&queue->backlog, 0, sizeof(queue->backlog));
 }
 
-float getStopPositionX(char road, int queuePosition)
+static bool backlogPush(VehicleBacklog *backlog, int lane, uint64_t plate, Uint32 arrivalTicks)
 {
-    switch (road) {
-        case 'A': return LANE_A_X;
-        case 'B': return LANE_B_X;
-        case 'C': return STOP_LINE_C + queuePosition * (VEHICLE_WIDTH + VEHICLE_GAP);
-        case 'D': return STOP_LINE_D - queuePosition * (VEHICLE_WIDTH + VEHICLE_GAP);
-        default: return 0;
+    if (backlog->count == backlog->capacity) {
+        size_t capacity = backlog->capacity ? backlog->capacity * 2 : BACKLOG_MIN_CAPACITY;
+        BackloggedVehicle *items = (BackloggedVehicle *)malloc(capacity * sizeof(BackloggedVehicle));
+        if (!items) return false;
+        for (size_t i = 0; i < backlog->count; i++) {
+            items[i] = *backlogAt(backlog, i);
+        }
+        free(backlog->items);
+        backlog->items = items;
+        backlog->head = 0;
+        backlog->capacity = capacity;
     }
+    BackloggedVehicle *slot = &backlog->items[(backlog->head + backlog->count) & (backlog->capacity - 1)];
+    slot->plate = plate;
+    slot->arrivalTicks = arrivalTicks;
+    backlog->lane = lane;
+    backlogOfLane[lane] = backlog;
+    backlog->count++;
+    backlogIndexInsert(plate, backlogIndexEntry(lane, backlog->popped + backlog->count - 1));
+    return true;
+}
+
+static BackloggedVehicle backlogPop(VehicleBacklog *backlog)
+{
+    BackloggedVehicle vehicle = backlog->items[backlog->head];
+    backlogIndexRemove(vehicle.plate, backlogIndexEntry(backlog->lane, backlog->popped));
+    backlog->head = (backlog->head + 1) & (backlog->capacity - 1);
+    backlog->count--;
+    backlog->popped++;
+    return vehicle;
+}
+
+float getStopPositionX(char road, int queuePosition)
+{
+    const RoadGeometry *geometry = geometryOf(road);
+    return geometry->stopX - geometry->dirX * queuePosition * (geometry->length + VEHICLE_GAP);
 }
 
 float getStopPositionY(char road, int queuePosition)
 {
-    switch (road) {
-        case 'A': return STOP_LINE_A - queuePosition * (VEHICLE_HEIGHT + VEHICLE_GAP);
-        case 'B': return STOP_LINE_B + queuePosition * (VEHICLE_HEIGHT + VEHICLE_GAP);
-        case 'C': return LANE_C_Y;
-        case 'D': return LANE_D_Y;
-        default: return 0;
-    }
+    const RoadGeometry *geometry = geometryOf(road);
+    return geometry->stopY - geometry->dirY * queuePosition * (geometry->length + VEHICLE_GAP);
 }
 
-void enqueue(Queue *queue,const char *vehicleNumber,char road)
+void enqueue(Queue *queue, const char *vehicleNumber, int numberLength, char road)
 {
-    VehicleNode *newNode = (VehicleNode *)malloc(sizeof(VehicleNode));
-    if(!newNode){
-        SDL_Log("failed to allocate memory for new vehicle node");
-        return;
-    }
+    VehicleRecord record = {vehicleNumber, numberLength, road};
+    enqueueBatch(queue, &record, 1);
+}
+
+//Link a new waiting vehicle node at the rear of queue. queuePos is its stop
+//line slot and lastNonCrossed the vehicle it spawns behind (NULL if none).
+static VehicleNode *appendVehicleNode(Queue *queue, uint64_t plate, char road, Uint32 arrivalTicks,
+                                      int queuePos, const VehicleNode *lastNonCrossed)
+{
+    VehicleNode *newNode = allocVehicleNode();
+    if (!newNode) return NULL;
 
-    strncpy(newNode->vehicleNumber, vehicleNumber, sizeof(newNode->vehicleNumber)-1);
-    newNode->vehicleNumber[sizeof(newNode->vehicleNumber)-1] = '\0';
+    newNode->plate = plate;
     newNode->road = road;
-    newNode->next = NULL;
+    newNode->next = VEHICLE_NONE;
     newNode->isMoving = true;
     newNode->hasCrossed = false;
     newNode->isTurning = false;
     newNode->hasCompletedTurn = false;
-    
+    newNode->arrivalTicks = arrivalTicks & ARRIVAL_TICKS_MASK;
+
     //Randomly decide turn direction when vehicle is created
-    newNode->turnDirection = getRandomTurnDirection();
+    newNode->turnDirection = getRandomTurnDirection(road);
 
-    //count non-crossed vehicles for queue position
-    int queuePos = 0;
-    VehicleNode *temp = queue->front;
-    while (temp != NULL) {
-        if (!temp->hasCrossed) {
-            queuePos++;
-        }
-        temp = temp->next;
-    }
-    
     //set target position (stop line based on queue position)
-    newNode->targetX = getStopPositionX(road, queuePos);
-    newNode->targetY = getStopPositionY(road, queuePos);
+    newNode->targetX = toCoord(getStopPositionX(road, queuePos));
+    newNode->targetY = toCoord(getStopPositionY(road, queuePos));
 
     //set spawn position - always off-screen, behind last vehicle
-    newNode->x = getSpawnPositionX(road, queue);
-    newNode->y = getSpawnPositionY(road, queue);
+    float spawnX, spawnY;
+    getSpawnPositionBehind(road, lastNonCrossed, &spawnX, &spawnY);
+    newNode->x = toCoord(spawnX);
+    newNode->y = toCoord(spawnY);
+    plateIndexInsert(newNode);
 
     if (queue->rear == NULL){
         queue->front = newNode;
         queue->rear = newNode;
     }else{
-        queue->rear->next = newNode;
+        setNextVehicle(queue->rear, newNode);
         queue->rear = newNode;
     }
     queue->size++;
-    
-    const char *turnStr = (newNode->turnDirection == TURN_RIGHT) ? "RIGHT" : "STRAIGHT";
-    SDL_Log("enqueue vehicle %s to road %c [%s] at (%.0f,%.0f) -> (%.0f,%.0f) queuePos=%d", 
-            vehicleNumber, road, turnStr, newNode->x, newNode->y, newNode->targetX, newNode->targetY, queuePos);
+    return newNode;
+}
+
+//Append count vehicles, all for this queue's road, in one pass.
+//Vehicles cross in queue order, so the crossed ones are a short prefix and
+//everything after it is waiting: only that prefix is walked, and each stop
+//line target and spawn point follows from the previous vehicle. A backlog of
+//n lines costs O(n) instead of the O(n^2) of walking the queue per line.
+//Beyond microQueueDepth waiting vehicles the rest go to queue->backlog.
+void enqueueBatch(Queue *queue, const VehicleRecord *records, int count)
+{
+    if (count <= 0) return;
+
+    //count non-crossed vehicles for queue position
+    int crossed = 0;
+    for (VehicleNode *temp = queue->front; temp != NULL && temp->hasCrossed; temp = nextVehicle(temp)) {
+        crossed++;
+    }
+    int queuePos = queue->size - crossed;
+    VehicleNode *lastNonCrossed = queuePos > 0 ? queue->rear : NULL;
+
+    Uint32 now = simTicks();
+    bool logEach = count <= ENQUEUE_LOG_EACH_MAX;
+    int added = 0, backlogged = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t plate = packPlate(records[i].plate, records[i].plateLength);
+        char road = records[i].road;
+
+        //past the microscopic depth only plate and arrival time are kept
+        if (microQueueDepth > 0 && (queue->backlog.count > 0 || queuePos >= microQueueDepth)) {
+            if (!backlogPush(&queue->backlog, roadLane(road), plate, now)) {
+                SDL_Log("failed to allocate memory for the lane %c backlog", road);
+                break;
+            }
+            backlogged++;
+            continue;
+        }
+
+        VehicleNode *newNode = appendVehicleNode(queue, plate, road, now, queuePos, lastNonCrossed);
+        if (!newNode) {
+            SDL_Log("failed to allocate memory for new vehicle node");
+            break;
+        }
+        lastNonCrossed = newNode;
+        added++;
+
+        if (logEach) {
+            static const char *turnNames[TURN_COUNT] = {"STRAIGHT", "RIGHT", "LEFT"};
+            const char *turnStr = turnNames[newNode->turnDirection];
+            SDL_Log("enqueue vehicle %s to road %c [%s] at (%.0f,%.0f) -> (%.0f,%.0f) queuePos=%d",
+                    plateText(newNode->plate).text, road, turnStr, fromCoord(newNode->x), fromCoord(newNode->y), fromCoord(newNode->targetX), fromCoord(newNode->targetY), queuePos);
+        }
+        queuePos++;
+    }
+    if (!logEach) {
+        SDL_Log("enqueued %d vehicles to road %c (queue size %d, %d backlogged)", added + backlogged, records[0].road,
+                getQueueSize(queue), (int)queue->backlog.count);
+    }
+}
+
+//Turn backlogged vehicles into nodes until the lane has microQueueDepth
+//waiting again. Called each frame before the lane is updated, so a promoted
+//vehicle spawns behind the last waiting one and closes up like any other.
+void promoteBacklog(Queue *queue, char road)
+{
+    if (queue->backlog.count == 0) return;
+
+    int crossed = 0;
+    for (VehicleNode *temp = queue->front; temp != NULL && temp->hasCrossed; temp = nextVehicle(temp)) {
+        crossed++;
+    }
+    int queuePos = queue->size - crossed;
+    VehicleNode *lastNonCrossed = queuePos > 0 ? queue->rear : NULL;
+
+    while (queue->backlog.count > 0 && (microQueueDepth <= 0 || queuePos < microQueueDepth)) {
+        BackloggedVehicle *vehicle = backlogAt(&queue->backlog, 0);
+        VehicleNode *node = appendVehicleNode(queue, vehicle->plate, road, vehicle->arrivalTicks, queuePos, lastNonCrossed);
+        if (!node) break;
+        backlogPop(&queue->backlog);
+        lastNonCrossed = node;
+        queuePos++;
+    }
 }
 
 VehicleNode *dequeue(Queue *queue){
@@ -771,282 +1763,238 @@ VehicleNode *dequeue(Queue *queue){
         return NULL;
     }
     VehicleNode *temp = queue->front;
-    queue->front = queue->front->next;
+    queue->front = nextVehicle(queue->front);
 
     if(queue->front == NULL){
         queue->rear = NULL;
     }
 
     queue->size--;
-    SDL_Log("dequeue vehicle %s from road %c (Queue size: %d)", temp->vehicleNumber, temp->road, queue->size);
+    SDL_Log("dequeue vehicle %s from road %c (Queue size: %d)", plateText(temp->plate).text, temp->road, queue->size);
     return temp;
 }
 
+//Every vehicle in the lane: nodes plus the backlog behind them
 int getQueueSize(Queue *queue){
-    return queue->size;
+    return queue->size + (int)queue->backlog.count;
 }
 
 void freeQueue(Queue *queue){
     VehicleNode *current = queue->front;
     while(current != NULL){
         VehicleNode *temp = current;
-        current = current->next;
-        free(temp);
+        current = nextVehicle(current);
+        freeVehicleNode(temp);
     }
     queue->front = NULL;
     queue->rear = NULL;
     queue->size = 0;
+    while (queue->backlog.count > 0) backlogPop(&queue->backlog);
+    free(queue->backlog.items);
+    memset(&queue->backlog, 0, sizeof(queue->backlog));
 }
 
-float moveTowards(float current, float target, float maxDelta)
-{
-    if (fabsf(target - current) <= maxDelta) {
-        return target;
-    }
-    return current + (target > current ? maxDelta : -maxDelta);
-}
-
-void updateQueueTargets(Queue *queue)
-{
-    VehicleNode *current = queue->front;
-    int position = 0;
-    while (current != NULL) {
-        if (!current->hasCrossed) {
-            current->targetX = getStopPositionX(current->road, position);
-            current->targetY = getStopPositionY(current->road, position);
-            current->isMoving = true;
-            position++;
-        }
-        current = current->next;
-    }
-}
-
-//Find vehicle ahead in queue (not crossed yet)
-VehicleNode *findVehicleAhead(Queue *queue, VehicleNode *current)
+//Any part of the vehicle inside the junction box
+bool overlapsJunction(const VehicleNode *vehicle)
 {
-    VehicleNode *temp = queue->front;
-    VehicleNode *ahead = NULL;
-    
-    while (temp != NULL && temp != current) {
-        if (!temp->hasCrossed) {
-            ahead = temp;
-        }
-        temp = temp->next;
-    }
-    return ahead;
+    float x = fromCoord(vehicle->x);
+    float y = fromCoord(vehicle->y);
+    return x + VEHICLE_WIDTH >= JUNCTION_LEFT && x <= JUNCTION_RIGHT &&
+           y + VEHICLE_HEIGHT >= JUNCTION_TOP && y <= JUNCTION_BOTTOM;
 }
 
-//Check if vehicle can move (no collision with vehicle ahead)
-bool canMoveForward(VehicleNode *current, VehicleNode *ahead, char road)
+//Intelligent Driver Model: acceleration at speed with the obstacle ahead gap px
+//away (INFINITY for a free road) and being closed at closing px/s
+static inline float idmAcceleration(float speed, float gap, float closing)
 {
-    if (ahead == NULL) return true;
-    
-    float distance = 0;
-    switch (road) {
-        case 'A':
-            distance = ahead->y - current->y - VEHICLE_HEIGHT;
-            break;
-        case 'B':
-            distance = current->y - ahead->y - VEHICLE_HEIGHT;
-            break;
-        case 'C':
-            distance = current->x - ahead->x - VEHICLE_WIDTH;
-            break;
-        case 'D':
-            distance = ahead->x - current->x - VEHICLE_WIDTH;
-            break;
-    }
-    
-    return distance >= VEHICLE_GAP;
+    float desiredGap = VEHICLE_GAP + fmaxf(0.0f, speed * IDM_TIME_HEADWAY +
+                       speed * closing / (2.0f * sqrtf(IDM_ACCELERATION * IDM_DECELERATION)));
+    float ratio = speed / VEHICLE_SPEED;
+    float interaction = desiredGap / fmaxf(gap, 0.01f);
+    return IDM_ACCELERATION * (1.0f - ratio * ratio * ratio * ratio - interaction * interaction);
 }
 
-//Check if vehicle has entered the intersection area
-bool isVehicleInIntersection(VehicleNode *vehicle)
+//Apply accel to *speed for deltaTime (never backwards) and return the distance covered
+static inline float idmStep(float *speed, float accel, float deltaTime)
 {
-    switch (vehicle->road) {
-        case 'A':
-            return (vehicle->y >= WINDOW_HEIGHT / 2 - ROAD_WIDTH / 2 - VEHICLE_HEIGHT);
-        case 'B':
-            return (vehicle->y <= WINDOW_HEIGHT / 2 + ROAD_WIDTH / 2);
-        case 'C':
-            return (vehicle->x <= WINDOW_WIDTH / 2 + ROAD_WIDTH / 2);
-        case 'D':
-            return (vehicle->x >= WINDOW_WIDTH / 2 - ROAD_WIDTH / 2 - VEHICLE_WIDTH);
-    }
-    return false;
-}
-
-//Check if vehicle has reached turning point (aligned with outgoing lane)
-bool hasReachedTurningPoint(VehicleNode *vehicle)
-{
-    float tolerance = 5.0f;
-    switch (vehicle->road) {
-        case 'A':
-            //A turns at D's outgoing lane Y position
-            return (vehicle->y >= LANE_D_OUT_Y - tolerance);
-        case 'B':
-            //B turns at C's outgoing lane Y position
-            return (vehicle->y <= LANE_C_OUT_Y + tolerance);
-        case 'C':
-            //C turns at A's outgoing lane X position
-            return (vehicle->x <= LANE_A_OUT_X + tolerance);
-        case 'D':
-            //D turns at B's outgoing lane X position
-            return (vehicle->x >= LANE_B_OUT_X - tolerance);
-    }
-    return false;
+    float newSpeed = fmaxf(0.0f, *speed + accel * deltaTime);
+    float step = 0.5f * (*speed + newSpeed) * deltaTime;
+    *speed = newSpeed;
+    return step;
 }
 
+//Move every vehicle one frame. Each vehicle follows the kinematics leg for its
+//road, turn and phase; only leaving a leg (crossing, finishing a turn, leaving
+//the screen) takes a branch. Waiting vehicles are in front-to-back order, so
+//the progress of the one ahead and the stop slot are carried down the lane.
 void updateVehicles(QueueData *queueData, float deltaTime){
     float movement = VEHICLE_SPEED * deltaTime;
-    Queue *queues[] = {queueData->queueA, queueData->queueB, queueData->queueC, queueData->queueD};
-    int laneIndex[] = {0, 1, 2, 3};
+    Queue *queues[QUEUED_LANE_COUNT];
+    laneQueues(queueData, queues);
+    unsigned greenMovements = queueData->greenMovements;
 
-    for (int q = 0; q < 4; q++) {
+    for (int q = 0; q < QUEUED_LANE_COUNT; q++) {
         Queue *queue = queues[q];
+        promoteBacklog(queue, laneRoad(q));
+        bool freeLeft = q >= LANE_COUNT;
+        //TurnDirection bits this lane may go on: its green movements, or always for a free left turn
+        unsigned released = freeLeft ? 1u << TURN_LEFT : (greenMovements >> (q * 2)) & LANE_MOVEMENTS(0);
+        const RoadGeometry *geometry = &roadGeometry[q];
+        const KinematicsPhase *approach = &kinematics[q][TURN_STRAIGHT][PHASE_APPROACH];
+        float goAt = kinematics[q][TURN_STRAIGHT][PHASE_CROSSING].stopAt;  //green: head for the far side
+        float spacing = geometry->length + VEHICLE_GAP;
+        float slot = approach->stopAt;  //red: where the next waiting vehicle stops
+        float aheadProgress = INFINITY; //waiting vehicle in front, none yet
+        float aheadSpeed = 0;           //its speed, --idm only
         VehicleNode *current = queue->front;
         VehicleNode *prev = NULL;
-        
-        bool isGreenLight = (queueData->activeLane == laneIndex[q]);
 
         while (current != NULL) {
-            VehicleNode *next = current->next;
+            VehicleNode *next = nextVehicle(current);
+            float x = fromCoord(current->x);
+            float y = fromCoord(current->y);
 
             if (current->hasCrossed) {
                 //Vehicle is crossing/turning through intersection
-                
-                //Check if turning and reached turning point
-                if (current->turnDirection == TURN_RIGHT && current->isTurning && !current->hasCompletedTurn) {
-                    if (hasReachedTurningPoint(current)) {
+                const KinematicsPhase *phase = &kinematics[q][current->turnDirection][PHASE_CROSSING + current->hasCompletedTurn];
+                float progress = x * phase->dirX + y * phase->dirY;
+                float step;
+                if (carFollowing) {
+                    //Nothing to follow inside the junction; until it turns off
+                    //the lane this vehicle leads the first one still waiting
+                    float *speed = &vehicleSpeed[vehicleIndex(current)];
+                    step = fminf(idmStep(speed, idmAcceleration(*speed, INFINITY, 0), deltaTime),
+                                 phase->stopAt - progress);
+                    aheadProgress = current->hasCompletedTurn ? INFINITY : progress + step;
+                    aheadSpeed = *speed;
+                } else {
+                    step = fminf(movement, phase->stopAt - progress);
+                }
+                current->x = toCoord(x + phase->dirX * step);
+                current->y = toCoord(y + phase->dirY * step);
+
+                if (progress + step >= phase->doneAt) {
+                    if (!phase->exits) {
                         //Reached turning point, set final exit target
                         current->hasCompletedTurn = true;
                         current->isTurning = false;
                         setVehicleTurnExitTarget(current);
-                        SDL_Log("Vehicle %s completed turn, heading to exit", current->vehicleNumber);
-                    }
-                }
-                
-                //Move towards target
-                current->x = moveTowards(current->x, current->targetX, movement);
-                current->y = moveTowards(current->y, current->targetY, movement);
-
-                //Check if vehicle is off screen
-                bool offScreen = false;
-                if (current->turnDirection == TURN_RIGHT && current->hasCompletedTurn) {
-                    //Check exit based on turn destination
-                    switch (current->road) {
-                        case 'A': offScreen = (current->x < -VEHICLE_WIDTH - 10); break;  //exits left
-                        case 'B': offScreen = (current->x > WINDOW_WIDTH + VEHICLE_WIDTH + 10); break;  //exits right
-                        case 'C': offScreen = (current->y < -VEHICLE_HEIGHT - 10); break;  //exits top
-                        case 'D': offScreen = (current->y > WINDOW_HEIGHT + VEHICLE_HEIGHT + 10); break;  //exits bottom
-                    }
-                } else {
-                    //Going straight
-                    switch (current->road) {
-                        case 'A': offScreen = (current->y > WINDOW_HEIGHT + VEHICLE_HEIGHT + 10); break;
-                        case 'B': offScreen = (current->y < -VEHICLE_HEIGHT - 10); break;
-                        case 'C': offScreen = (current->x < -VEHICLE_WIDTH - 10); break;
-                        case 'D': offScreen = (current->x > WINDOW_WIDTH + VEHICLE_WIDTH + 10); break;
-                    }
-                }
-
-                if (offScreen) {
-                    if (prev == NULL) {
+                        SDL_Log("Vehicle %s completed turn, heading to exit", plateText(current->plate).text);
+                    } else if (prev == NULL) {
                         VehicleNode *removed = dequeue(queue);
                         if (removed) {
-                            SDL_Log("Vehicle %s exited screen from road %c", removed->vehicleNumber, removed->road);
-                            free(removed);
+                            SDL_Log("Vehicle %s exited screen from road %c", plateText(removed->plate).text, removed->road);
+                            if (journeyStamps) recordJourney(q, removed);
+                            freeVehicleNode(removed);
                         }
+                        current = next;
+                        continue;
                     } else {
-                        prev->next = next;
+                        setNextVehicle(prev, next);
                         if (queue->rear == current) {
                             queue->rear = prev;
                         }
                         queue->size--;
-                        SDL_Log("Vehicle %s exited screen from road %c", current->vehicleNumber, current->road);
-                        free(current);
-                    }
-                    current = next;
-                    continue;
-                }
-            } else if (isGreenLight) {
-                //Green light - move vehicle towards intersection
-                VehicleNode *ahead = findVehicleAhead(queue, current);
-                
-                if (isVehicleInIntersection(current)) {
-                    //Vehicle entered intersection
-                    current->hasCrossed = true;
-                    current->isMoving = true;
-                    
-                    if (current->turnDirection == TURN_RIGHT) {
-                        //Start turning
-                        current->isTurning = true;
-                        setVehicleTurnTarget(current);
-                        SDL_Log("Vehicle %s entered intersection from road %c - TURNING RIGHT", 
-                                current->vehicleNumber, current->road);
-                    } else {
-                        //Go straight
-                        setVehicleStraightTarget(current);
-                        SDL_Log("Vehicle %s entered intersection from road %c - GOING STRAIGHT", 
-                                current->vehicleNumber, current->road);
-                    }
-                    
-                    updateQueueTargets(queue);
-                } else {
-                    //Vehicle not yet in intersection - move towards it
-                    if (canMoveForward(current, ahead, current->road)) {
-                        //Temporarily set target to move through
-                        switch (current->road) {
-                            case 'A':
-                                current->targetX = current->x;
-                                current->targetY = WINDOW_HEIGHT + VEHICLE_HEIGHT + 50;
-                                break;
-                            case 'B':
-                                current->targetX = current->x;
-                                current->targetY = -VEHICLE_HEIGHT - 50;
-                                break;
-                            case 'C':
-                                current->targetX = -VEHICLE_WIDTH - 50;
-                                current->targetY = current->y;
-                                break;
-                            case 'D':
-                                current->targetX = WINDOW_WIDTH + VEHICLE_WIDTH + 50;
-                                current->targetY = current->y;
-                                break;
-                        }
-                        current->isMoving = true;
-                        current->x = moveTowards(current->x, current->targetX, movement);
-                        current->y = moveTowards(current->y, current->targetY, movement);
+                        SDL_Log("Vehicle %s exited screen from road %c", plateText(current->plate).text, current->road);
+                        if (journeyStamps) recordJourney(q, current);
+                        freeVehicleNode(current);
+                        current = next;
+                        continue;
                     }
                 }
-            } else if (!current->hasCrossed) {
-                //Red light and vehicle hasn't crossed yet
-                int position = 0;
-                VehicleNode *temp = queue->front;
-                while (temp != NULL && temp != current) {
-                    if (!temp->hasCrossed) {
-                        position++;
-                    }
-                    temp = temp->next;
+                prev = current;
+                current = next;
+                continue;
+            }
+
+            //Green only applies to vehicles whose own movement was released
+            bool isGreenLight = (released >> current->turnDirection) & 1;
+            float progress = x * approach->dirX + y * approach->dirY;
+
+            if (isGreenLight && progress >= approach->doneAt) {
+                //Vehicle entered intersection
+                current->hasCrossed = true;
+                current->isMoving = true;
+
+                Uint32 now = simTicks();
+                if (journeyStamps) {
+                    JourneyStamps *stamps = &journeyStamps[vehicleIndex(current)];
+                    if (!stamps->atStopLine) stamps->stopLineTicks = now;
+                    stamps->atStopLine = true;
+                    stamps->enteredTicks = now;
+                    stamps->entered = true;
+                    stamps->priority = queueData->priorityMode == 1;
                 }
-                current->targetX = getStopPositionX(current->road, position);
-                current->targetY = getStopPositionY(current->road, position);
-                
-                VehicleNode *ahead = findVehicleAhead(queue, current);
-                
-                if (canMoveForward(current, ahead, current->road)) {
-                    current->x = moveTowards(current->x, current->targetX, movement);
-                    current->y = moveTowards(current->y, current->targetY, movement);
+                queueData->counters.departures[q]++;
+                if (freeLeft) {
+                    queueData->stats.freeLeftServed++;
+                    queueData->stats.freeLeftWaitMs += vehicleWaitedMs(current, now);
+                } else {
+                    queueData->stats.lastCrossingTicks[q] = now;
+                    queueData->stats.servedVehicles++;
+                    queueData->stats.totalWaitMs += vehicleWaitedMs(current, now);
                 }
 
-                if (fabsf(current->x - current->targetX) < 0.5f && 
-                    fabsf(current->y - current->targetY) < 0.5f) {
-                    current->isMoving = false;
+                if (current->turnDirection != TURN_STRAIGHT) {
+                    //Start turning
+                    current->isTurning = true;
+                    setVehicleTurnTarget(current);
+                    SDL_Log("Vehicle %s entered intersection from road %c - TURNING %s",
+                            plateText(current->plate).text, current->road, freeLeft ? "LEFT" : "RIGHT");
                 } else {
-                    current->isMoving = true;
+                    //Go straight
+                    setVehicleStraightTarget(current);
+                    SDL_Log("Vehicle %s entered intersection from road %c - GOING STRAIGHT",
+                            plateText(current->plate).text, current->road);
                 }
+                prev = current;
+                current = next;
+                continue;
             }
 
+            //Green drives on towards the junction, red closes up to its stop slot;
+            //either way only while the gap to the vehicle ahead allows
+            float target = isGreenLight ? goAt : slot;
+            float gap = aheadProgress - progress - geometry->length;
+            float step;
+            if (carFollowing) {
+                //Follow the vehicle ahead; on red also a standing vehicle at the
+                //stop line, or at the box edge once past it
+                float *speed = &vehicleSpeed[vehicleIndex(current)];
+                float accel = idmAcceleration(*speed, gap, *speed - aheadSpeed);
+                float room = gap;
+                if (!isGreenLight) {
+                    float stopLine = progress <= approach->stopAt + 1.0f ? approach->stopAt : approach->doneAt;
+                    accel = fminf(accel, idmAcceleration(*speed, stopLine - progress + VEHICLE_GAP, *speed));
+                    room = fminf(room, stopLine - progress);
+                }
+                step = idmStep(speed, accel, deltaTime);
+                if (step > room) {
+                    //Braking was not enough this frame: stop at the obstacle
+                    step = fmaxf(0.0f, room);
+                    *speed = 0;
+                }
+                current->isMoving = *speed > 0;
+                aheadSpeed = *speed;
+            } else {
+                bool clear = gap >= VEHICLE_GAP;
+                step = clear * fmaxf(-movement, fminf(movement, target - progress));
+                current->isMoving = fabsf(target - progress - step) >= 0.5f;
+            }
+            current->x = toCoord(x + approach->dirX * step);
+            current->y = toCoord(y + approach->dirY * step);
+            current->targetX = toCoord(x + approach->dirX * (target - progress));
+            current->targetY = toCoord(y + approach->dirY * (target - progress));
+            if (journeyStamps && progress + step >= approach->stopAt - 0.5f) {
+                JourneyStamps *stamps = &journeyStamps[vehicleIndex(current)];
+                if (!stamps->atStopLine) {
+                    stamps->stopLineTicks = simTicks();
+                    stamps->atStopLine = true;
+                }
+            }
+
+            aheadProgress = progress + step;
+            slot -= spacing;
             prev = current;
             current = next;
         }
@@ -1055,33 +2003,47 @@ void updateVehicles(QueueData *queueData, float deltaTime){
 
 void drawVehicles(SDL_Renderer *renderer, TTF_Font *font, QueueData *queueData)
 {
-    Queue *queues[] = {queueData->queueA, queueData->queueB, queueData->queueC, queueData->queueD};
-    SDL_Color colors[] = {
+    Queue *queues[QUEUED_LANE_COUNT];
+    laneQueues(queueData, queues);
+    SDL_Color roadColors[] = {
         {0, 100, 255, 255},    // Blue for A
         {255, 50, 50, 255},    // Red for B
         {50, 255, 50, 255},    // Green for C
         {255, 255, 50, 255}    // Yellow for D
     };
 
-    for (int q = 0; q < 4; q++) {
+    for (int q = 0; q < QUEUED_LANE_COUNT; q++) {
+        SDL_Color color = roadColors[q % LANE_COUNT];  //a free left-turn lane shares its road's colour
         VehicleNode *current = queues[q]->front;
+        int index = 0;
+        int hidden = 0;
         
-        while (current != NULL) {
+        for (; current != NULL; current = nextVehicle(current), index++) {
+            if (!isVehicleOnScreen(current)) {
+                //Waiting vehicles are ordered by distance from the stop line, so
+                //once one is past the window edge the rest of the queue is too
+                if (!current->hasCrossed) {
+                    hidden = queues[q]->size - index;
+                    break;
+                }
+                continue;
+            }
+
             //Set color based on road (darker if turning)
-            if (current->turnDirection == TURN_RIGHT) {
+            if (current->turnDirection != TURN_STRAIGHT) {
                 //Darker color for turning vehicles
                 SDL_SetRenderDrawColor(renderer, 
-                    colors[q].r * 0.7, 
-                    colors[q].g * 0.7, 
-                    colors[q].b * 0.7, 
-                    colors[q].a);
+                    color.r * 0.7, 
+                    color.g * 0.7, 
+                    color.b * 0.7, 
+                    color.a);
             } else {
-                SDL_SetRenderDrawColor(renderer, colors[q].r, colors[q].g, colors[q].b, colors[q].a);
+                SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
             }
             
             SDL_Rect vehicleRect = {
-                (int)current->x,
-                (int)current->y,
+                (int)fromCoord(current->x),
+                (int)fromCoord(current->y),
                 VEHICLE_WIDTH,
                 VEHICLE_HEIGHT
             };
@@ -1089,18 +2051,43 @@ void drawVehicles(SDL_Renderer *renderer, TTF_Font *font, QueueData *queueData)
             SDL_RenderFillRect(renderer, &vehicleRect);
             
             //Draw border (orange for turning, white for straight)
-            if (current->turnDirection == TURN_RIGHT) {
+            if (current->turnDirection != TURN_STRAIGHT) {
                 SDL_SetRenderDrawColor(renderer, 255, 165, 0, 255);  //Orange border for turning
             } else {
                 SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);  //White border for straight
             }
             SDL_RenderDrawRect(renderer, &vehicleRect);
-            
-            current = current->next;
+        }
+
+        hidden += (int)queues[q]->backlog.count;
+        if (hidden > 0) {
+            drawHiddenVehicles(renderer, font, laneRoad(q), hidden, color);
         }
     }
 }
 
+bool isVehicleOnScreen(const VehicleNode *vehicle)
+{
+    float x = fromCoord(vehicle->x);
+    float y = fromCoord(vehicle->y);
+    return x + VEHICLE_WIDTH > 0 && x < WINDOW_WIDTH && y + VEHICLE_HEIGHT > 0 && y < WINDOW_HEIGHT;
+}
+
+//One box at the edge a lane enters from, counting the vehicles queued beyond it
+void drawHiddenVehicles(SDL_Renderer *renderer, TTF_Font *font, char road, int hidden, SDL_Color color)
+{
+    SDL_Rect box = geometryOf(road)->hidden;
+
+    SDL_SetRenderDrawColor(renderer, color.r / 2, color.g / 2, color.b / 2, 255);
+    SDL_RenderFillRect(renderer, &box);
+    SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, 255);
+    SDL_RenderDrawRect(renderer, &box);
+
+    char text[16];
+    snprintf(text, sizeof(text), "+%d", hidden);
+    displayText(renderer, font, text, box.x + 4, box.y);
+}
+
 void drawQueueStatus(SDL_Renderer *renderer, TTF_Font *font, QueueData *queueData)
 {
     char statusText[100];
@@ -1112,16 +2099,20 @@ void drawQueueStatus(SDL_Renderer *renderer, TTF_Font *font, QueueData *queueDat
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     SDL_RenderDrawRect(renderer, &statusBox);
 
-    snprintf(statusText, sizeof(statusText), "AL2: %d vehicles", getQueueSize(queueData->queueA));
+    snprintf(statusText, sizeof(statusText), "AL2: %d  AL3: %d", getQueueSize(queueData->queueA),
+             getQueueSize(queueData->freeLeft[0]));
     displayText(renderer, font, statusText, 20, 20);
     
-    snprintf(statusText, sizeof(statusText), "BL2: %d vehicles", getQueueSize(queueData->queueB));
+    snprintf(statusText, sizeof(statusText), "BL2: %d  BL3: %d", getQueueSize(queueData->queueB),
+             getQueueSize(queueData->freeLeft[1]));
     displayText(renderer, font, statusText, 20, 45);
     
-    snprintf(statusText, sizeof(statusText), "CL2: %d vehicles", getQueueSize(queueData->queueC));
+    snprintf(statusText, sizeof(statusText), "CL2: %d  CL3: %d", getQueueSize(queueData->queueC),
+             getQueueSize(queueData->freeLeft[2]));
     displayText(renderer, font, statusText, 20, 70);
     
-    snprintf(statusText, sizeof(statusText), "DL2: %d vehicles", getQueueSize(queueData->queueD));
+    snprintf(statusText, sizeof(statusText), "DL2: %d  DL3: %d", getQueueSize(queueData->queueD),
+             getQueueSize(queueData->freeLeft[3]));
     displayText(renderer, font, statusText, 20, 95);
 
     if (queueData->priorityMode) {
@@ -1137,20 +2128,363 @@ void drawQueueStatus(SDL_Renderer *renderer, TTF_Font *font, QueueData *queueDat
     }
 }
 
-int main()
+//Command line options
+typedef struct {
+    const char *policyName;
+    const char *benchPolicy;   //policy to benchmark, NULL for all
+    bool runBenchPolicy;
+    const char *benchParserFile;
+    long benchMemoryVehicles;
+    int benchUpdateDepth;
+    bool runBenchTransport;
+    const char *ringName;
+    bool segmentedLog;
+    int checkpointIntervalMs;
+    StartMode startMode;
+    const char *snapshotPath;
+    int snapshotIntervalMs;
+    const char *querySocketPath;
+    int laneCapacity;
+    OverflowPolicy overflowPolicy;
+    int microDepth;
+    const char *layoutPath;
+    const char *tracePath;
+    int lockHoldThresholdMs;   //--lock-profile, 0 when off
+    int latencyReportMs;       //--latency, 0 when off
+    const char *historyPath;
+    int historyIntervalMs;
+    int historyRecords;
+    const char *historyDumpPath;
+    const char *capturePath;
+    int captureFps;
+    double captureSeconds;     //0 to capture until quit
+    GreenTiming timing;
+    bool concurrentPhases;
+    bool carFollowing;         //--idm
+    double eventSimHours;      //--event-sim, 0 when off
+    double eventRates[LANE_COUNT];
+} SimulatorOptions;
+
+void printUsage(const char *program)
+{
+    printf("Usage: %s [options]\n", program);
+    printf("  --policy NAME          scheduling policy for the controller (default: default)\n");
+    printf("  --list-policies        list available scheduling policies\n");
+    printf("  --bench-policy [NAME]  benchmark one or all policies without opening a window\n");
+    printf("  --bench-parser FILE    measure vehicle file parsing speed on FILE\n");
+    printf("  --bench-transport      compare shared-memory ring and file ingest\n");
+    printf("  --bench-memory [N]     memory per queued vehicle with N vehicles (default %d)\n", BENCH_MEMORY_DEFAULT);
+    printf("  --bench-update [N]     time updateVehicles with up to N vehicles per lane (default %d)\n", BENCH_UPDATE_DEFAULT);
+    printf("  --event-sim [HOURS]    run the discrete-event engine for HOURS without a window (default %.0f)\n",
+           EVENT_SIM_DEFAULT_HOURS);
+    printf("  --event-rates A,B,C,D  arrivals per hour on each road for --event-sim (default 1080,540,540,540)\n");
+    printf("  --shm NAME             read arrivals from a shared-memory ring (e.g. %s)\n", VEHICLE_RING_DEFAULT_NAME);
+    printf("  --segmented            read the segmented log written by traffic_gen --segment-size\n");
+    printf("  --checkpoint-interval MS  how often the read offset is saved (default %d)\n", DEFAULT_CHECKPOINT_INTERVAL_MS);
+    printf("  --start MODE           tail, checkpoint or replay an existing backlog\n");
+    printf("                         (default: replay, checkpoint with --segmented)\n");
+    printf("  --snapshot FILE        restore from FILE at startup; save it on 's', at exit and on a timer\n");
+    printf("  --snapshot-interval MS  also save the snapshot this often (default: off)\n");
+    printf("  --query-socket [PATH]  answer state queries on a Unix socket (default %s)\n", DEFAULT_QUERY_SOCKET);
+    printf("  --lane-capacity N      hold at most N vehicles per lane (default: no limit)\n");
+    printf("  --overflow POLICY      when a lane is full: block, drop or spill (default block)\n");
+    printf("  --micro-depth K        simulate the first K waiting vehicles per lane individually,\n");
+    printf("                         keep the rest as a counted backlog (default %d, 0 = all)\n", DEFAULT_MICRO_DEPTH);
+    printf("  --layout FILE          junction geometry: window size, lane width, which roads exist\n");
+    printf("  --trace FILE           record thread activity and write it to FILE as Chrome trace JSON\n");
+    printf("                         at exit and on SIGUSR1 (open in Perfetto or chrome://tracing)\n");
+    printf("  --lock-profile [MS]    histogram queue mutex waits and holds per call site, log holds\n");
+    printf("                         of MS or more (default %d); summary at exit and on SIGUSR2\n", DEFAULT_LOCK_HOLD_THRESHOLD_MS);
+    printf("  --latency [MS]         wait, held and crossing time percentiles per lane and mode,\n");
+    printf("                         every MS (default %d) and at exit\n", DEFAULT_LATENCY_REPORT_MS);
+    printf("  --history FILE         append lane metrics to a memory-mapped ring file\n");
+    printf("  --history-interval MS  how often a history record is written (default %d)\n", DEFAULT_HISTORY_INTERVAL_MS);
+    printf("  --history-records N    records kept before the oldest is overwritten (default %d)\n", DEFAULT_HISTORY_RECORDS);
+    printf("  --history-dump FILE    print a history file as CSV and exit\n");
+    printf("  --capture FILE         render offscreen at a fixed timestep as fast as possible and\n");
+    printf("                         write the frames to FILE as Y4M video ('-' for stdout)\n");
+    printf("  --capture-fps N        frames per simulated second for --capture (default %d)\n", DEFAULT_CAPTURE_FPS);
+    printf("  --capture-seconds S    stop capturing after S simulated seconds (default: until quit)\n");
+    printf("  --actuated             end greens early on gap-out instead of fixed length\n");
+    printf("  --min-green MS         actuated minimum green (default %d)\n", DEFAULT_MIN_GREEN_MS);
+    printf("  --max-green MS         actuated maximum green (default %d)\n", DEFAULT_MAX_GREEN_MS);
+    printf("  --gap MS               actuated gap-out interval (default %d)\n", DEFAULT_GAP_MS);
+    printf("  --exclusive-phases     green one lane at a time instead of all compatible movements\n");
+    printf("  --idm                  vehicles accelerate, brake and keep a time gap (Intelligent Driver\n");
+    printf("                         Model) instead of moving at constant speed\n");
+    printf("  --help                 show this message\n");
+}
+
+//Returns false if the program should exit (bad option or --help)
+bool parseOptions(int argc, char *argv[], SimulatorOptions *options)
+{
+    options->policyName = "default";
+    options->benchPolicy = NULL;
+    options->runBenchPolicy = false;
+    options->benchParserFile = NULL;
+    options->benchMemoryVehicles = 0;
+    options->benchUpdateDepth = 0;
+    options->runBenchTransport = false;
+    options->ringName = NULL;
+    options->segmentedLog = false;
+    options->checkpointIntervalMs = DEFAULT_CHECKPOINT_INTERVAL_MS;
+    options->startMode = START_AUTO;
+    options->snapshotPath = NULL;
+    options->snapshotIntervalMs = 0;
+    options->querySocketPath = NULL;
+    options->laneCapacity = 0;
+    options->overflowPolicy = OVERFLOW_BLOCK;
+    options->microDepth = DEFAULT_MICRO_DEPTH;
+    options->layoutPath = NULL;
+    options->tracePath = NULL;
+    options->lockHoldThresholdMs = 0;
+    options->latencyReportMs = 0;
+    options->historyPath = NULL;
+    options->historyIntervalMs = DEFAULT_HISTORY_INTERVAL_MS;
+    options->historyRecords = DEFAULT_HISTORY_RECORDS;
+    options->historyDumpPath = NULL;
+    options->capturePath = NULL;
+    options->captureFps = DEFAULT_CAPTURE_FPS;
+    options->captureSeconds = 0;
+    options->timing.actuated = false;
+    options->timing.minGreenMs = DEFAULT_MIN_GREEN_MS;
+    options->timing.maxGreenMs = DEFAULT_MAX_GREEN_MS;
+    options->timing.gapMs = DEFAULT_GAP_MS;
+    options->concurrentPhases = true;
+    options->carFollowing = false;
+    options->eventSimHours = 0;
+    const double defaultRates[LANE_COUNT] = EVENT_SIM_DEFAULT_RATES;
+    memcpy(options->eventRates, defaultRates, sizeof(defaultRates));
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--policy") == 0 && i + 1 < argc) {
+            options->policyName = argv[++i];
+        } else if (strcmp(argv[i], "--bench-parser") == 0 && i + 1 < argc) {
+            options->benchParserFile = argv[++i];
+        } else if (strcmp(argv[i], "--bench-transport") == 0) {
+            options->runBenchTransport = true;
+        } else if (strcmp(argv[i], "--bench-memory") == 0) {
+            options->benchMemoryVehicles = BENCH_MEMORY_DEFAULT;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                options->benchMemoryVehicles = atol(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--bench-update") == 0) {
+            options->benchUpdateDepth = BENCH_UPDATE_DEFAULT;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                options->benchUpdateDepth = atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+            options->ringName = argv[++i];
+        } else if (strcmp(argv[i], "--segmented") == 0) {
+            options->segmentedLog = true;
+        } else if (strcmp(argv[i], "--checkpoint-interval") == 0 && i + 1 < argc) {
+            options->checkpointIntervalMs = atoi(argv[++i]);
+            if (options->checkpointIntervalMs <= 0) {
+                fprintf(stderr, "--checkpoint-interval must be positive\n");
+                return false;
+            }
+        } else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "tail") == 0) {
+                options->startMode = START_TAIL;
+            } else if (strcmp(mode, "checkpoint") == 0) {
+                options->startMode = START_CHECKPOINT;
+            } else if (strcmp(mode, "replay") == 0) {
+                options->startMode = START_REPLAY;
+            } else {
+                fprintf(stderr, "unknown start mode '%s'\n", mode);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            options->snapshotPath = argv[++i];
+        } else if (strcmp(argv[i], "--snapshot-interval") == 0 && i + 1 < argc) {
+            options->snapshotIntervalMs = atoi(argv[++i]);
+            if (options->snapshotIntervalMs <= 0) {
+                fprintf(stderr, "--snapshot-interval must be positive\n");
+                return false;
+            }
+        } else if (strcmp(argv[i], "--query-socket") == 0) {
+            options->querySocketPath = DEFAULT_QUERY_SOCKET;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                options->querySocketPath = argv[++i];
+            }
+        } else if (strcmp(argv[i], "--lane-capacity") == 0 && i + 1 < argc) {
+            options->laneCapacity = atoi(argv[++i]);
+            if (options->laneCapacity <= 0) {
+                fprintf(stderr, "--lane-capacity must be positive\n");
+                return false;
+            }
+        } else if (strcmp(argv[i], "--overflow") == 0 && i + 1 < argc) {
+            const char *policy = argv[++i];
+            if (strcmp(policy, "block") == 0) {
+                options->overflowPolicy = OVERFLOW_BLOCK;
+            } else if (strcmp(policy, "drop") == 0) {
+                options->overflowPolicy = OVERFLOW_DROP;
+            } else if (strcmp(policy, "spill") == 0) {
+                options->overflowPolicy = OVERFLOW_SPILL;
+            } else {
+                fprintf(stderr, "unknown overflow policy '%s'\n", policy);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--micro-depth") == 0 && i + 1 < argc) {
+            options->microDepth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc) {
+            options->layoutPath = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            options->tracePath = argv[++i];
+        } else if (strcmp(argv[i], "--lock-profile") == 0) {
+            options->lockHoldThresholdMs = DEFAULT_LOCK_HOLD_THRESHOLD_MS;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                options->lockHoldThresholdMs = atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--latency") == 0) {
+            options->latencyReportMs = DEFAULT_LATENCY_REPORT_MS;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                options->latencyReportMs = atoi(argv[++i]);
+                if (options->latencyReportMs <= 0) {
+                    fprintf(stderr, "--latency must be positive\n");
+                    return false;
+                }
+            }
+        } else if (strcmp(argv[i], "--history") == 0 && i + 1 < argc) {
+            options->historyPath = argv[++i];
+        } else if (strcmp(argv[i], "--history-interval") == 0 && i + 1 < argc) {
+            options->historyIntervalMs = atoi(argv[++i]);
+            if (options->historyIntervalMs <= 0) {
+                fprintf(stderr, "--history-interval must be positive\n");
+                return false;
+            }
+        } else if (strcmp(argv[i], "--history-records") == 0 && i + 1 < argc) {
+            options->historyRecords = atoi(argv[++i]);
+            if (options->historyRecords <= 0) {
+                fprintf(stderr, "--history-records must be positive\n");
+                return false;
+            }
+        } else if (strcmp(argv[i], "--history-dump") == 0 && i + 1 < argc) {
+            options->historyDumpPath = argv[++i];
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            options->capturePath = argv[++i];
+        } else if (strcmp(argv[i], "--capture-fps") == 0 && i + 1 < argc) {
+            options->captureFps = atoi(argv[++i]);
+            if (options->captureFps <= 0 || options->captureFps > 1000) {
+                fprintf(stderr, "--capture-fps must be between 1 and 1000\n");
+                return false;
+            }
+        } else if (strcmp(argv[i], "--capture-seconds") == 0 && i + 1 < argc) {
+            options->captureSeconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--actuated") == 0) {
+            options->timing.actuated = true;
+        } else if (strcmp(argv[i], "--min-green") == 0 && i + 1 < argc) {
+            options->timing.minGreenMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-green") == 0 && i + 1 < argc) {
+            options->timing.maxGreenMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--gap") == 0 && i + 1 < argc) {
+            options->timing.gapMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--exclusive-phases") == 0) {
+            options->concurrentPhases = false;
+        } else if (strcmp(argv[i], "--idm") == 0) {
+            options->carFollowing = true;
+        } else if (strcmp(argv[i], "--event-sim") == 0) {
+            options->eventSimHours = EVENT_SIM_DEFAULT_HOURS;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                options->eventSimHours = atof(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--event-rates") == 0 && i + 1 < argc) {
+            double *r = options->eventRates;
+            if (sscanf(argv[++i], "%lf,%lf,%lf,%lf", &r[0], &r[1], &r[2], &r[3]) != LANE_COUNT ||
+                r[0] < 0 || r[1] < 0 || r[2] < 0 || r[3] < 0) {
+                fprintf(stderr, "--event-rates needs four non-negative rates, e.g. 1080,540,540,540\n");
+                return false;
+            }
+        } else if (strcmp(argv[i], "--list-policies") == 0) {
+            listSchedulingPolicies();
+            return false;
+        } else if (strcmp(argv[i], "--bench-policy") == 0) {
+            options->runBenchPolicy = true;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                options->benchPolicy = argv[++i];
+            }
+        } else {
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    if (options->capturePath && options->ringName) {
+        fprintf(stderr, "--capture replays the vehicle file; it cannot follow a live --shm ring\n");
+        return false;
+    }
+    GreenTiming *timing = &options->timing;
+    if (timing->minGreenMs < 0 || timing->maxGreenMs < 0 || timing->gapMs < 0) {
+        fprintf(stderr, "--min-green, --max-green and --gap must not be negative\n");
+        return false;
+    }
+    if (timing->minGreenMs > timing->maxGreenMs) {
+        fprintf(stderr, "--min-green %d is longer than --max-green %d\n", timing->minGreenMs, timing->maxGreenMs);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
 {
+    SimulatorOptions options;
+    if (!parseOptions(argc, argv, &options)) {
+        return 0;
+    }
+    if (options.layoutPath && !loadLayout(options.layoutPath)) {
+        return 1;
+    }
+    buildRoadGeometry();
+    carFollowing = options.carFollowing;
+    journeyLatency = options.latencyReportMs > 0;
+    if (options.historyDumpPath) {
+        return dumpHistory(options.historyDumpPath);
+    }
+    if (options.runBenchPolicy) {
+        return benchmarkSchedulingPolicies(options.benchPolicy);
+    }
+    if (options.benchParserFile) {
+        return benchmarkParser(options.benchParserFile);
+    }
+    if (options.runBenchTransport) {
+        return benchmarkTransport();
+    }
+    if (options.benchMemoryVehicles > 0) {
+        return benchmarkMemory(options.benchMemoryVehicles);
+    }
+    if (options.benchUpdateDepth > 0) {
+        return benchmarkUpdate(options.benchUpdateDepth);
+    }
+
+    const SchedulingPolicy *policy = findSchedulingPolicy(options.policyName);
+    if (!policy) {
+        fprintf(stderr, "Unknown policy '%s'. Available policies:\n", options.policyName);
+        listSchedulingPolicies();
+        return 1;
+    }
+    if (options.eventSimHours > 0) {
+        return runEventSimulation(policy, &options.timing, options.concurrentPhases,
+                                  options.eventSimHours, options.eventRates);
+    }
+
     //Initialize random seed
-    srand(time(NULL));
+    srand(options.capturePath ? CAPTURE_RANDOM_SEED : time(NULL));
     
     pthread_t tQueue, tReadFile;
     SDL_Window *window = NULL;
     SDL_Renderer *renderer = NULL;
     SDL_Event event;
+    FrameCapture capture = {0};
 
-    if (!initializeSDL(&window, &renderer))
+    bool initialized = options.capturePath ? openCapture(&capture, options.capturePath, options.captureFps, &renderer)
+                                           : initializeSDL(&window, &renderer);
+    if (!initialized)
     {
         return -1;
     }
+    if (options.capturePath) {
+        simClockStart();
+    }
     SDL_mutex *mutex = SDL_CreateMutex();
 
     QueueData queueData;
@@ -1163,14 +2497,53 @@ int main()
     initQueue(queueData.queueB);
     initQueue(queueData.queueC);
     initQueue(queueData.queueD);
-    
-    //Initialize visual-only vehicles (L1 and L3 lanes)
-    initVisualVehicles();
+    for (int road = 0; road < LANE_COUNT; road++) {
+        queueData.freeLeft[road] = (Queue *)malloc(sizeof(Queue));
+        initQueue(queueData.freeLeft[road]);
+    }
 
     queueData.currentLane = 0;
     queueData.priorityMode = 0;
     queueData.activeLane = -1;
+    queueData.greenMovements = 0;
+    queueData.concurrentPhases = options.concurrentPhases;
+    buildConflictMatrix();
     queueData.mutex = mutex;
+    queueData.policy = policy;
+    queueData.timing = options.timing;
+    memset(&queueData.stats, 0, sizeof(queueData.stats));
+    memset(&queueData.counters, 0, sizeof(queueData.counters));
+    queueData.frameMs = 0;
+    queueData.ringName = options.ringName;
+    queueData.segmentedLog = options.segmentedLog;
+    queueData.checkpointIntervalMs = options.checkpointIntervalMs;
+    queueData.startMode = options.startMode;
+    memset(&queueData.ingested, 0, sizeof(queueData.ingested));
+    queueData.resumeFromSnapshot = false;
+    queueData.greenEndTicks = 0;
+    queueData.resumeGreenMs = 0;
+    queueData.liveState = NULL;
+    queueData.liveStateMutex = SDL_CreateMutex();
+    queueData.querySocketPath = options.querySocketPath;
+    queueData.laneCapacity = options.laneCapacity;
+    microQueueDepth = options.microDepth;
+    queueData.overflowPolicy = options.overflowPolicy;
+    memset(&queueData.overflow, 0, sizeof(queueData.overflow));
+    for (int lane = 0; lane < LANE_COUNT; lane++) queueData.spoolFd[lane] = -1;
+    if (options.snapshotPath) {
+        loadSnapshot(&queueData, options.snapshotPath);
+    }
+    bool spill = options.laneCapacity > 0 && options.overflowPolicy == OVERFLOW_SPILL;
+    if (spill && !openSpoolFiles(&queueData)) {
+        return 1;
+    }
+    SDL_Log("Using scheduling policy '%s'", policy->name);
+    if (options.tracePath) {
+        startTrace(options.tracePath);
+    }
+    if (options.lockHoldThresholdMs > 0) {
+        startLockProfile(options.lockHoldThresholdMs);
+    }
 
     SharedData sharedData = {0, 0, &queueData, mutex};
 
@@ -1179,49 +2552,154 @@ int main()
         SDL_Log("Failed to load font: %s", TTF_GetError());
     }
     
+    simClockRegister();
     pthread_create(&tQueue, NULL, checkQueue, &sharedData);
-    pthread_create(&tReadFile, NULL, readAndParseFile, &queueData);
+    void *(*reader)(void *) = readAndParseFile;
+    if (options.ringName) {
+        reader = readFromRing;
+    } else if (options.segmentedLog) {
+        reader = readSegmentedLog;
+    }
+    if (reader != readFromRing) {
+        simClockRegister();  //the file readers poll with simDelay; the ring reader waits on the producer
+    }
+    pthread_create(&tReadFile, NULL, reader, &queueData);
+    if (options.querySocketPath) {
+        pthread_t tQueries;
+        pthread_create(&tQueries, NULL, serveQueries, &queueData);
+        pthread_detach(tQueries);
+    }
+    if (spill) {
+        pthread_t tSpool;
+        simClockRegister();
+        pthread_create(&tSpool, NULL, readmitSpilled, &queueData);
+        pthread_detach(tSpool);
+    }
+    if (options.historyPath) {
+        static HistorySampler sampler;
+        sampler.queueData = &queueData;
+        sampler.intervalMs = options.historyIntervalMs;
+        sampler.history = laneHistoryOpen(options.historyPath, options.historyRecords, options.historyIntervalMs);
+        if (!sampler.history) {
+            SDL_Log("failed to open history file %s: %s", options.historyPath, strerror(errno));
+            return 1;
+        }
+        SDL_Log("Writing lane history to %s every %d ms (%llu records so far)", options.historyPath,
+                options.historyIntervalMs, (unsigned long long)atomic_load(&sampler.history->head));
+        pthread_t tHistory;
+        simClockRegister();
+        pthread_create(&tHistory, NULL, sampleHistory, &sampler);
+        pthread_detach(tHistory);
+    }
 
     const int TARGET_FPS = 60;
     const int FRAME_DELAY = 1000 / TARGET_FPS;  // ~16ms per frame
     Uint32 frameStart;
-    Uint32 frameTime;
-    Uint32 lastTime = SDL_GetTicks();
+    Uint32 frameTime = 0;
+    Uint32 lastTime = simTicks();
     float deltaTime;
 
+    Uint32 lastSnapshot = simTicks();
+    Uint32 lastPublish = 0;
+    Uint32 lastLatencyReport = simTicks();
+    Uint32 captureStart = simTicks();
+    long captureFrames = (long)(options.captureSeconds * options.captureFps);
+
     bool running = true;
     while (running)
     {
+        uint64_t frameSpan = traceBegin();
+        if (options.capturePath) {
+            //fixed timestep: frame n shows simulated time n / fps
+            simClockAdvance(captureStart + (Uint32)((uint64_t)capture.frames * 1000 / options.captureFps));
+        }
         frameStart = SDL_GetTicks();
-        deltaTime = (frameStart - lastTime) / 1000.0f;
+        Uint32 now = simTicks();
+        deltaTime = (now - lastTime) / 1000.0f;
         
         // Cap deltaTime to prevent huge jumps
         if (deltaTime > 0.1f) deltaTime = 0.1f;
-        lastTime = frameStart;
+        lastTime = now;
         
         while (SDL_PollEvent(&event)){
             if (event.type == SDL_QUIT)
                 running = false;
+            else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_s && options.snapshotPath)
+                saveSnapshot(&queueData, options.snapshotPath);
+        }
+        if (options.snapshotPath && options.snapshotIntervalMs > 0 &&
+            now - lastSnapshot >= (Uint32)options.snapshotIntervalMs) {
+            saveSnapshot(&queueData, options.snapshotPath);
+            lastSnapshot = now;
+        }
+        if (traceDumpRequested) {
+            traceDumpRequested = 0;
+            writeTrace(options.tracePath);
+        }
+        if (lockReportRequested) {
+            lockReportRequested = 0;
+            printLockProfile(&queueData);
+        }
+        if (journeyLatency && now - lastLatencyReport >= (Uint32)options.latencyReportMs) {
+            printJourneyLatency();
+            lastLatencyReport = now;
         }
         
-        SDL_LockMutex(mutex);
+        LOCK_QUEUES(&queueData);
+        queueData.frameMs = frameTime;
+        uint64_t span = traceBegin();
         updateVehicles(&queueData, deltaTime);
-        updateVisualVehicles(deltaTime);
+        traceSpan("frame", "update", span, NULL, 0);
+        if (options.querySocketPath && now - lastPublish >= QUERY_PUBLISH_INTERVAL_MS) {
+            span = traceBegin();
+            publishLiveState(&queueData);
+            traceSpan("frame", "publish", span, NULL, 0);
+            lastPublish = now;
+        }
+        span = traceBegin();
         refreshLight(renderer, &sharedData, font);
         drawVehicles(renderer, font, &queueData);
-        drawVisualVehicles(renderer);
         drawQueueStatus(renderer, font, &queueData);
-        SDL_UnlockMutex(mutex);
+        traceSpan("frame", "render", span, NULL, 0);
+        UNLOCK_QUEUES(&queueData);
 
+        span = traceBegin();
         SDL_RenderPresent(renderer);
+        traceSpan("frame", "present", span, NULL, 0);
+        if (options.capturePath) {
+            span = traceBegin();
+            if (!captureFrame(&capture) || (captureFrames > 0 && capture.frames >= captureFrames)) {
+                running = false;
+            }
+            traceSpan("frame", "capture", span, NULL, 0);
+        }
+        traceSpan("frame", "frame", frameSpan, NULL, 0);
         
-        // Frame rate limiting - only delay if we finished early
+        // Frame rate limiting - only delay if we finished early; a capture runs flat out
         frameTime = SDL_GetTicks() - frameStart;
-        if (frameTime < FRAME_DELAY) {
+        if (frameTime < FRAME_DELAY && !options.capturePath) {
             SDL_Delay(FRAME_DELAY - frameTime);
         }
     }
 
+    if (options.capturePath) {
+        closeCapture(&capture);
+    }
+    if (options.snapshotPath) {
+        saveSnapshot(&queueData, options.snapshotPath);
+    }
+    if (options.querySocketPath) {
+        unlink(options.querySocketPath);
+    }
+    if (options.tracePath) {
+        writeTrace(options.tracePath);
+    }
+    printGreenStats(&queueData);
+    printJourneyLatency();
+    if (options.laneCapacity > 0) {
+        printOverflowStats(&queueData);
+    }
+    printLockProfile(&queueData);
     SDL_DestroyMutex(mutex);
     freeQueue(queueData.queueA);
     freeQueue(queueData.queueB);
@@ -1231,12 +2709,18 @@ int main()
     free(queueData.queueB);
     free(queueData.queueC);
     free(queueData.queueD);
+    for (int road = 0; road < LANE_COUNT; road++) {
+        freeQueue(queueData.freeLeft[road]);
+        free(queueData.freeLeft[road]);
+    }
     TTF_CloseFont(font);
     TTF_Quit();
     if (renderer)
         SDL_DestroyRenderer(renderer);
     if (window)
         SDL_DestroyWindow(window);
+    if (capture.surface)
+        SDL_FreeSurface(capture.surface);
     SDL_Quit();
     return 0;
 }
@@ -1280,62 +2764,168 @@ bool initializeSDL(SDL_Window **window, SDL_Renderer **renderer)
     return true;
 }
 
+//--capture: no window, the software renderer draws into a surface that is
+//streamed to path (a file, a FIFO or '-' for stdout) as 4:2:0 Y4M
+bool openCapture(FrameCapture *capture, const char *path, int fps, SDL_Renderer **renderer)
+{
+    if (SDL_Init(SDL_INIT_TIMER | SDL_INIT_EVENTS) < 0)
+    {
+        SDL_Log("Failed to initialize SDL: %s", SDL_GetError());
+        return false;
+    }
+    if (TTF_Init() < 0)
+    {
+        SDL_Log("SDL_ttf could not initialize! TTF_Error: %s\n", TTF_GetError());
+        return false;
+    }
+
+    capture->width = (WINDOW_WIDTH * SCALE + 1) & ~1;
+    capture->height = (WINDOW_HEIGHT * SCALE + 1) & ~1;
+    capture->fps = fps;
+    capture->surface = SDL_CreateRGBSurfaceWithFormat(0, capture->width, capture->height, 32, SDL_PIXELFORMAT_ARGB8888);
+    *renderer = capture->surface ? SDL_CreateSoftwareRenderer(capture->surface) : NULL;
+    if (!*renderer)
+    {
+        SDL_Log("Failed to create offscreen renderer: %s", SDL_GetError());
+        return false;
+    }
+    SDL_RenderSetScale(*renderer, SCALE, SCALE);
+
+    size_t pixels = (size_t)capture->width * capture->height;
+    capture->previous = (Uint32 *)malloc(pixels * sizeof(Uint32));
+    capture->planes = (uint8_t *)malloc(pixels * 3 / 2);
+    capture->out = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+    if (!capture->previous || !capture->planes || !capture->out)
+    {
+        SDL_Log("Failed to open capture %s: %s", path, strerror(errno));
+        return false;
+    }
+    fprintf(capture->out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", capture->width, capture->height, fps);
+    capture->startedTicks = SDL_GetTicks();
+    SDL_Log("Capturing %d x %d at %d fps to %s", capture->width, capture->height, fps, path);
+    return true;
+}
+
+//BT.601 studio-range Y, U and V of one tile, U and V from 2x2 averages
+static void convertCaptureTile(FrameCapture *capture, const Uint8 *pixels, int pitch, int x0, int y0, int x1, int y1)
+{
+    uint8_t *lumaPlane = capture->planes;
+    uint8_t *uPlane = lumaPlane + (size_t)capture->width * capture->height;
+    uint8_t *vPlane = uPlane + (size_t)capture->width * capture->height / 4;
+    int chromaWidth = capture->width / 2;
+
+    for (int y = y0; y < y1; y += 2) {
+        const Uint32 *rows[2] = {(const Uint32 *)(pixels + y * pitch), (const Uint32 *)(pixels + (y + 1) * pitch)};
+        for (int x = x0; x < x1; x += 2) {
+            int sumR = 0, sumG = 0, sumB = 0;
+            for (int dy = 0; dy < 2; dy++) {
+                for (int dx = 0; dx < 2; dx++) {
+                    Uint32 p = rows[dy][x + dx];
+                    int r = (p >> 16) & 0xFF, g = (p >> 8) & 0xFF, b = p & 0xFF;
+                    lumaPlane[(size_t)(y + dy) * capture->width + x + dx] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+                    sumR += r;
+                    sumG += g;
+                    sumB += b;
+                }
+            }
+            int r = sumR / 4, g = sumG / 4, b = sumB / 4;
+            size_t chroma = (size_t)(y / 2) * chromaWidth + x / 2;
+            uPlane[chroma] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            vPlane[chroma] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+}
+
+//Append the rendered frame. Most of the picture is the same road every frame,
+//so only tiles whose pixels differ from the previous frame are converted
+//again; the planes keep the rest. False if the output failed.
+bool captureFrame(FrameCapture *capture)
+{
+    SDL_Surface *surface = capture->surface;
+    if (SDL_LockSurface(surface) != 0) return false;
+    const Uint8 *pixels = (const Uint8 *)surface->pixels;
+
+    for (int y0 = 0; y0 < capture->height; y0 += CAPTURE_TILE) {
+        int y1 = y0 + CAPTURE_TILE < capture->height ? y0 + CAPTURE_TILE : capture->height;
+        for (int x0 = 0; x0 < capture->width; x0 += CAPTURE_TILE) {
+            int x1 = x0 + CAPTURE_TILE < capture->width ? x0 + CAPTURE_TILE : capture->width;
+            size_t tileBytes = (size_t)(x1 - x0) * sizeof(Uint32);
+            bool changed = capture->frames == 0;
+            for (int y = y0; y < y1 && !changed; y++) {
+                changed = memcmp(pixels + y * surface->pitch + x0 * sizeof(Uint32),
+                                 capture->previous + (size_t)y * capture->width + x0, tileBytes) != 0;
+            }
+            capture->tilesTotal++;
+            if (!changed) continue;
+
+            convertCaptureTile(capture, pixels, surface->pitch, x0, y0, x1, y1);
+            for (int y = y0; y < y1; y++) {
+                memcpy(capture->previous + (size_t)y * capture->width + x0,
+                       pixels + y * surface->pitch + x0 * sizeof(Uint32), tileBytes);
+            }
+            capture->tilesConverted++;
+        }
+    }
+    SDL_UnlockSurface(surface);
+
+    size_t planeBytes = (size_t)capture->width * capture->height * 3 / 2;
+    if (fputs("FRAME\n", capture->out) == EOF || fwrite(capture->planes, 1, planeBytes, capture->out) != planeBytes) {
+        SDL_Log("capture write failed: %s", strerror(errno));
+        return false;
+    }
+    capture->frames++;
+    return true;
+}
+
+void closeCapture(FrameCapture *capture)
+{
+    if (capture->out) {
+        fflush(capture->out);
+        if (capture->out != stdout) fclose(capture->out);
+    }
+    Uint32 elapsedMs = SDL_GetTicks() - capture->startedTicks;
+    double simulatedS = (double)capture->frames / capture->fps;
+    SDL_Log("Captured %ld frames (%.0f s simulated) in %.1f s, %.0fx real time, %.1f%% of tiles converted",
+            capture->frames, simulatedS, elapsedMs / 1000.0, elapsedMs ? simulatedS * 1000.0 / elapsedMs : 0.0,
+            capture->tilesTotal ? 100.0 * capture->tilesConverted / capture->tilesTotal : 0.0);
+    free(capture->previous);
+    free(capture->planes);
+}
+
 void drawRoadsAndLane(SDL_Renderer *renderer, TTF_Font *font)
 {
     SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
     
-    SDL_Rect verticalRoad = {WINDOW_WIDTH / 2 - ROAD_WIDTH / 2, 0, ROAD_WIDTH, WINDOW_HEIGHT};
-    SDL_RenderFillRect(renderer, &verticalRoad);
-
-    SDL_Rect horizontalRoad = {0, WINDOW_HEIGHT / 2 - ROAD_WIDTH / 2, WINDOW_WIDTH, ROAD_WIDTH};
-    SDL_RenderFillRect(renderer, &horizontalRoad);
+    SDL_Rect junction = {JUNCTION_LEFT, JUNCTION_TOP, ROAD_WIDTH, ROAD_WIDTH};
+    SDL_RenderFillRect(renderer, &junction);
+    for (int road = 0; road < LANE_COUNT; road++) {
+        if (roadGeometry[road].present) SDL_RenderFillRect(renderer, &roadGeometry[road].arm);
+    }
     
     SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255);
-    for (int i = 0; i <= 3; i++)
-    {
-        SDL_RenderDrawLine(renderer,
-                           0, WINDOW_HEIGHT / 2 - ROAD_WIDTH / 2 + LANE_WIDTH * i,
-                           WINDOW_WIDTH / 2 - ROAD_WIDTH / 2, WINDOW_HEIGHT / 2 - ROAD_WIDTH / 2 + LANE_WIDTH * i
-        );
-        SDL_RenderDrawLine(renderer,
-                           800, WINDOW_HEIGHT / 2 - ROAD_WIDTH / 2 + LANE_WIDTH * i,
-                           WINDOW_WIDTH / 2 + ROAD_WIDTH / 2, WINDOW_HEIGHT / 2 - ROAD_WIDTH / 2 + LANE_WIDTH * i);
-        SDL_RenderDrawLine(renderer,
-                           WINDOW_WIDTH / 2 - ROAD_WIDTH / 2 + LANE_WIDTH * i, 0,
-                           WINDOW_WIDTH / 2 - ROAD_WIDTH / 2 + LANE_WIDTH * i, WINDOW_HEIGHT / 2 - ROAD_WIDTH / 2);
-        SDL_RenderDrawLine(renderer,
-                           WINDOW_WIDTH / 2 - ROAD_WIDTH / 2 + LANE_WIDTH * i, 800,
-                           WINDOW_WIDTH / 2 - ROAD_WIDTH / 2 + LANE_WIDTH * i, WINDOW_HEIGHT / 2 + ROAD_WIDTH / 2);
-    }
-    displayText(renderer, font, "A", 400, 10);
-    displayText(renderer, font, "B", 400, 770);
-    displayText(renderer, font, "D", 10, 400);
-    displayText(renderer, font, "C", 770, 400);
+    for (int road = 0; road < LANE_COUNT; road++) {
+        const RoadGeometry *geometry = &roadGeometry[road];
+        if (!geometry->present) continue;
+        const SDL_Rect *arm = &geometry->arm;
+        for (int i = 0; i <= LANES_PER_ROAD; i++) {
+            if (geometry->dirX == 0) {
+                int x = arm->x + LANE_WIDTH * i;
+                SDL_RenderDrawLine(renderer, x, arm->y, x, arm->y + arm->h);
+            } else {
+                int y = arm->y + LANE_WIDTH * i;
+                SDL_RenderDrawLine(renderer, arm->x, y, arm->x + arm->w, y);
+            }
+        }
+        char label[2] = {'A' + road, '\0'};
+        displayText(renderer, font, label, geometry->labelX, geometry->labelY);
+    }
 }
 
 void drawTrafficLight(SDL_Renderer *renderer, int lane, bool isGreen)
 {
-    int x, y;
-    switch (lane) {
-        case 0:
-            x = WINDOW_WIDTH / 2 + ROAD_WIDTH / 2 + 10;
-            y = WINDOW_HEIGHT / 2 - ROAD_WIDTH / 2 - 40;
-            break;
-        case 1:
-            x = WINDOW_WIDTH / 2 - ROAD_WIDTH / 2 - 50;
-            y = WINDOW_HEIGHT / 2 + ROAD_WIDTH / 2 + 10;
-            break;
-        case 2:
-            x = WINDOW_WIDTH / 2 + ROAD_WIDTH / 2 + 10;
-            y = WINDOW_HEIGHT / 2 + ROAD_WIDTH / 2 + 10;
-            break;
-        case 3:
-            x = WINDOW_WIDTH / 2 - ROAD_WIDTH / 2 - 50;
-            y = WINDOW_HEIGHT / 2 - ROAD_WIDTH / 2 - 40;
-            break;
-        default:
-            return;
-    }
+    if (lane < 0 || lane >= LANE_COUNT || !roadGeometry[lane].present) return;
+    int x = roadGeometry[lane].light.x;
+    int y = roadGeometry[lane].light.y;
 
     SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
     SDL_Rect lightBox = {x, y, 40, 30};
@@ -1356,10 +2946,10 @@ void drawTrafficLight(SDL_Renderer *renderer, int lane, bool isGreen)
     SDL_RenderFillRect(renderer, &greenLight);
 }
 
-void drawAllTrafficLights(SDL_Renderer *renderer, int activeLane)
+void drawAllTrafficLights(SDL_Renderer *renderer, unsigned greenMovements)
 {
     for (int i = 0; i < 4; i++) {
-        drawTrafficLight(renderer, i, (i == activeLane));
+        drawTrafficLight(renderer, i, (greenMovements & LANE_MOVEMENTS(i)) != 0);
     }
 }
 
@@ -1384,8 +2974,7 @@ void refreshLight(SDL_Renderer *renderer, SharedData *sharedData, TTF_Font *font
 
     drawRoadsAndLane(renderer, font);
 
-    int activeLane = sharedData->nextLight - 1;
-    drawAllTrafficLights(renderer, activeLane);
+    drawAllTrafficLights(renderer, sharedData->queueData->greenMovements);
 }
 
 //Check if any vehicle is still crossing the intersection (any lane)
@@ -1399,219 +2988,3262 @@ bool isAnyVehicleCrossingIntersection(QueueData *queueData)
             if (current->hasCrossed) {
                 bool inIntersection = false;
                 
-                //Check based on turn direction
                 if (current->turnDirection == TURN_RIGHT && !current->hasCompletedTurn) {
                     //Still turning - definitely in intersection
                     inIntersection = true;
-                } else if (current->turnDirection == TURN_RIGHT && current->hasCompletedTurn) {
-                    //Completed turn - check based on exit direction
-                    switch (current->road) {
-                        case 'A':  //exiting left
-                            inIntersection = (current->x >= WINDOW_WIDTH / 2 - ROAD_WIDTH / 2 - VEHICLE_WIDTH);
-                            break;
-                        case 'B':  //exiting right
-                            inIntersection = (current->x <= WINDOW_WIDTH / 2 + ROAD_WIDTH / 2);
-                            break;
-                        case 'C':  //exiting up
-                            inIntersection = (current->y >= WINDOW_HEIGHT / 2 - ROAD_WIDTH / 2 - VEHICLE_HEIGHT);
-                            break;
-                        case 'D':  //exiting down
-                            inIntersection = (current->y <= WINDOW_HEIGHT / 2 + ROAD_WIDTH / 2);
-                            break;
-                    }
                 } else {
-                    //Going straight
-                    switch (current->road) {
-                        case 'A':
-                            inIntersection = (current->y >= WINDOW_HEIGHT / 2 - ROAD_WIDTH / 2 - VEHICLE_HEIGHT &&
-                                             current->y <= WINDOW_HEIGHT / 2 + ROAD_WIDTH / 2);
-                            break;
-                        case 'B':
-                            inIntersection = (current->y >= WINDOW_HEIGHT / 2 - ROAD_WIDTH / 2 &&
-                                             current->y <= WINDOW_HEIGHT / 2 + ROAD_WIDTH / 2 + VEHICLE_HEIGHT);
-                            break;
-                        case 'C':
-                            inIntersection = (current->x >= WINDOW_WIDTH / 2 - ROAD_WIDTH / 2 &&
-                                             current->x <= WINDOW_WIDTH / 2 + ROAD_WIDTH / 2 + VEHICLE_WIDTH);
-                            break;
-                        case 'D':
-                            inIntersection = (current->x >= WINDOW_WIDTH / 2 - ROAD_WIDTH / 2 - VEHICLE_WIDTH &&
-                                             current->x <= WINDOW_WIDTH / 2 + ROAD_WIDTH / 2);
-                            break;
-                    }
+                    inIntersection = overlapsJunction(current);
                 }
                 
                 if (inIntersection) {
                     return true;
                 }
             }
-            current = current->next;
+            current = nextVehicle(current);
         }
     }
     return false;
 }
 
-void *checkQueue(void *arg)
+typedef struct {
+    int x0, y0, x1, y1;
+} PathBox;
+
+//conflict bitmask per movement, filled by buildConflictMatrix
+unsigned movementConflicts[MOVEMENT_COUNT];
+
+//Vehicle box at (x, y) stretched along (dirX, dirY) to the junction box edge
+//behind it and/or ahead of it
+static PathBox stretchToJunction(float x, float y, float dirX, float dirY, bool back, bool ahead)
 {
-    SharedData *sharedData = (SharedData *)arg;
-    QueueData *queueData = sharedData->queueData;
-    while (1)
-    {
-        while (1) {
-            SDL_LockMutex(queueData->mutex);
-            bool intersectionBusy = isAnyVehicleCrossingIntersection(queueData);
-            SDL_UnlockMutex(queueData->mutex);
-            
-            if (!intersectionBusy) {
-                break;
+    PathBox box = {(int)x, (int)y, (int)x + VEHICLE_WIDTH, (int)y + VEHICLE_HEIGHT};
+    for (int side = 0; side < 2; side++) {
+        if (side == 0 ? !back : !ahead) continue;
+        float sign = side == 0 ? -1.0f : 1.0f;
+        if (dirX * sign < 0) box.x0 = JUNCTION_LEFT;
+        if (dirX * sign > 0) box.x1 = JUNCTION_RIGHT;
+        if (dirY * sign < 0) box.y0 = JUNCTION_TOP;
+        if (dirY * sign > 0) box.y1 = JUNCTION_BOTTOM;
+    }
+    return box;
+}
+
+//Area swept by a vehicle through the junction box for one movement, as one
+//or two axis aligned boxes (approach leg, then exit leg for right turns)
+static int getMovementPath(int lane, TurnDirection turn, PathBox boxes[2])
+{
+    const RoadGeometry *geometry = &roadGeometry[lane];
+    if (turn == TURN_STRAIGHT) {
+        boxes[0] = stretchToJunction(geometry->stopX, geometry->stopY, geometry->dirX, geometry->dirY, true, true);
+        return 1;
+    }
+    float turnX, turnY;
+    roadPoint(geometry, geometry->turnProgress, &turnX, &turnY);
+    boxes[0] = stretchToJunction(turnX, turnY, geometry->dirX, geometry->dirY, true, false);
+    boxes[1] = stretchToJunction(turnX, turnY, geometry->turnDirX, geometry->turnDirY, false, true);
+    return 2;
+}
+
+static const char *movementName(int movement)
+{
+    static const char *names[MOVEMENT_COUNT] = {"AS", "AR", "BS", "BR", "CS", "CR", "DS", "DR"};
+    return names[movement];
+}
+
+//Whether the layout has the roads a movement starts and ends on
+static bool movementInLayout(int movement)
+{
+    const RoadGeometry *geometry = &roadGeometry[movement / 2];
+    return geometry->present &&
+           (movement % 2 == TURN_STRAIGHT ? geometry->straightAllowed : geometry->rightAllowed);
+}
+
+//Two movements conflict if their swept paths overlap inside the junction box.
+//Movements from the same road share a queue, so they never conflict.
+void buildConflictMatrix(void)
+{
+    for (int m = 0; m < MOVEMENT_COUNT; m++) {
+        PathBox a[2];
+        int countA = getMovementPath(m / 2, (TurnDirection)(m % 2), a);
+        movementConflicts[m] = 0;
+
+        for (int n = 0; n < MOVEMENT_COUNT; n++) {
+            if (m / 2 == n / 2) continue;
+            PathBox b[2];
+            int countB = getMovementPath(n / 2, (TurnDirection)(n % 2), b);
+
+            for (int i = 0; i < countA; i++) {
+                for (int j = 0; j < countB; j++) {
+                    if (a[i].x0 < b[j].x1 && b[j].x0 < a[i].x1 &&
+                        a[i].y0 < b[j].y1 && b[j].y0 < a[i].y1) {
+                        movementConflicts[m] |= 1u << n;
+                    }
+                }
             }
-            SDL_Delay(50);
         }
-        
-        SDL_LockMutex(queueData->mutex);
+    }
 
-        int sizeA = getWaitingVehicleCount(queueData->queueA);
-        int sizeB = getWaitingVehicleCount(queueData->queueB);
-        int sizeC = getWaitingVehicleCount(queueData->queueC);
-        int sizeD = getWaitingVehicleCount(queueData->queueD);
-
-        //Priority mode activation: > 10 vehicles triggers priority mode
-        //Priority mode deactivation: < 5 vehicles exits priority mode
-        if (sizeA > PRIORITY_THRESHOLD_HIGH){
-            queueData->priorityMode = 1;
-            SDL_Log("Priority mode activated!! lane A has %d vehicles", sizeA);
-        }else if(sizeA < PRIORITY_THRESHOLD_LOW && queueData->priorityMode == 1){
-            queueData->priorityMode = 0;
-            SDL_Log("Normal Mode continued!! lane A has %d vehicle", sizeA);
-        }
-
-        int laneToServe;
-        int vehiclesToServe = 0;
-
-        if(queueData->priorityMode == 1){
-            //Full priority mode: serve only lane A until < 5 vehicles
-            laneToServe = 0;
-            vehiclesToServe = sizeA;
-            SDL_Log("Priority mode: serving lane A with %d vehicles", vehiclesToServe);
-        } else if (sizeA > PRIORITY_THRESHOLD_LOW && queueData->currentLane != 0) {
-            //Immediate service: lane A has > 5 vehicles, serve it next (but not full priority)
-            laneToServe = 0;
-            
-            //Calculate average from all 4 lanes for fair serving
-            int totalVehicles = sizeA + sizeB + sizeC + sizeD;
-            int avgVehicles = (totalVehicles + 3) / 4;  //round up division by 4
-            if (avgVehicles < 1) avgVehicles = 1;
-            
-            vehiclesToServe = (sizeA < avgVehicles) ? sizeA : avgVehicles;
-            if (vehiclesToServe < 1 && sizeA > 0) vehiclesToServe = 1;
-            
-            SDL_Log("Immediate service for lane A (>5 vehicles): size=%d, avg=%d, serving %d vehicles", 
-                    sizeA, avgVehicles, vehiclesToServe);
-            //Don't change currentLane - will continue normal rotation after this
-        } else {
-            //Normal mode: serve lanes equally in rotation
-            //Calculate average from all 4 lanes
-            int totalVehicles = sizeA + sizeB + sizeC + sizeD;
-            int avgVehicles = (totalVehicles + 3) / 4;  //round up division by 4
-            
-            if (avgVehicles < 1) avgVehicles = 1;
-            
-            laneToServe = queueData->currentLane;
-            
-            int currentLaneSize = 0;
-            switch (laneToServe) {
-                case 0: currentLaneSize = sizeA; break;
-                case 1: currentLaneSize = sizeB; break;
-                case 2: currentLaneSize = sizeC; break;
-                case 3: currentLaneSize = sizeD; break;
+    char line[64];
+    for (int m = 0; m < MOVEMENT_COUNT; m++) {
+        if (!movementInLayout(m)) continue;
+        int len = 0;
+        for (int n = 0; n < MOVEMENT_COUNT; n++) {
+            if (m / 2 != n / 2 && movementInLayout(n) && !(movementConflicts[m] & (1u << n))) {
+                len += snprintf(line + len, sizeof(line) - len, " %s", movementName(n));
             }
-            
-            vehiclesToServe = (currentLaneSize < avgVehicles) ? currentLaneSize : avgVehicles;
-            if (vehiclesToServe < 1 && currentLaneSize > 0) vehiclesToServe = 1;
-            
-            SDL_Log("Normal mode: lane %d, size=%d, avg=%d, serving %d vehicles", 
-                    laneToServe, currentLaneSize, avgVehicles, vehiclesToServe);
-            
-            queueData->currentLane = (queueData->currentLane + 1) % 4;
         }
+        SDL_Log("Movement %s compatible with:%s", movementName(m), len ? line : " none");
+    }
+}
 
-        SDL_UnlockMutex(queueData->mutex);
-
-        if (vehiclesToServe > 0) {
-            sharedData->nextLight = laneToServe + 1;
-            queueData->activeLane = laneToServe;
-            
-            int greenLightTime = vehiclesToServe * TIME_PER_VEHICLE * 1000;
-            SDL_Log("Green light for lane %d for %d ms (%d vehicles * %d sec)", 
-                    laneToServe, greenLightTime, vehiclesToServe, TIME_PER_VEHICLE);
-            
-            SDL_Delay(greenLightTime);
-            
-            sharedData->nextLight = 0;
-            queueData->activeLane = -1;
-            SDL_Log("Red light for lane %d - waiting for crossing vehicles to clear", laneToServe);
-            
-        } else {
-            SDL_Log("No vehicles in lane %d, skipping", laneToServe);
-            SDL_Delay(200);
+static bool movementsCompatible(unsigned granted, unsigned candidate)
+{
+    for (int m = 0; m < MOVEMENT_COUNT; m++) {
+        if ((candidate & (1u << m)) && (movementConflicts[m] & granted)) {
+            return false;
         }
     }
-    return NULL;
+    return true;
 }
 
-void *readAndParseFile(void *arg)
+//First vehicle still waiting to cross, i.e. the one whose movement decides if the lane can flow
+VehicleNode *findFirstWaitingVehicle(Queue *queue)
 {
-    QueueData *queueData = (QueueData *)arg;
-    long lastFilePos = 0;
-    while (1)
-    {
-        FILE *file = fopen(VEHICLE_FILE, "r");
-        if (!file)
-        {
-            SDL_Log("waiting for vehicle file '%s'...", VEHICLE_FILE);
-            sleep(2);
+    VehicleNode *current = queue->front;
+    while (current != NULL && current->hasCrossed) {
+        current = nextVehicle(current);
+    }
+    return current;
+}
+
+//Start from both movements of the policy's lane, then add the busiest other
+//lanes whole if they fit, or at least the movement of their head vehicle.
+//headTurn is the TurnDirection of each lane's first waiting vehicle, -1 if none.
+static unsigned grantGreenMovements(const LaneObservation *obs, int lane, const int headTurn[LANE_COUNT],
+                                    bool concurrentPhases)
+{
+    unsigned granted = LANE_MOVEMENTS(lane);
+    if (!concurrentPhases) {
+        return granted;
+    }
+
+    int order[LANE_COUNT], count = 0;
+    for (int q = 0; q < LANE_COUNT; q++) {
+        if (q == lane || obs->waiting[q] == 0) continue;
+        int i = count++;
+        while (i > 0 && obs->waiting[order[i - 1]] < obs->waiting[q]) {
+            order[i] = order[i - 1];
+            i--;
+        }
+        order[i] = q;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int q = order[i];
+        if (movementsCompatible(granted, LANE_MOVEMENTS(q))) {
+            granted |= LANE_MOVEMENTS(q);
             continue;
         }
+        if (headTurn[q] >= 0 && movementsCompatible(granted, MOVEMENT_BIT(q, headTurn[q]))) {
+            granted |= MOVEMENT_BIT(q, headTurn[q]);
+        }
+    }
+    return granted;
+}
+
+//grantGreenMovements for the live queues (caller holds the mutex)
+unsigned chooseGreenMovements(QueueData *queueData, const LaneObservation *obs, int lane)
+{
+    Queue *queues[] = {queueData->queueA, queueData->queueB, queueData->queueC, queueData->queueD};
+    int headTurn[LANE_COUNT];
+    for (int q = 0; q < LANE_COUNT; q++) {
+        VehicleNode *head = q == lane || !queueData->concurrentPhases ? NULL : findFirstWaitingVehicle(queues[q]);
+        headTurn[q] = head ? (int)head->turnDirection : -1;
+    }
+    return grantGreenMovements(obs, lane, headTurn, queueData->concurrentPhases);
+}
+
+static void formatMovements(unsigned movements, char *buffer, size_t size)
+{
+    size_t len = 0;
+    buffer[0] = '\0';
+    for (int m = 0; m < MOVEMENT_COUNT && len + 4 < size; m++) {
+        if (movements & (1u << m)) {
+            len += snprintf(buffer + len, size - len, "%s%s", len ? " " : "", movementName(m));
+        }
+    }
+}
 
-        fseek(file, lastFilePos, SEEK_SET);
+//Fill in what the policy needs to know about the lanes (caller holds the mutex)
+void observeLanes(QueueData *queueData, LaneObservation *obs)
+{
+    Queue *queues[] = {queueData->queueA, queueData->queueB, queueData->queueC, queueData->queueD};
 
-        char line[MAX_LINE_LENGTH];
-        while (fgets(line, sizeof(line), file))
-        {
-            line[strcspn(line, "\n")] = 0;
-            
-            if (strlen(line) == 0) continue;
+    for (int q = 0; q < LANE_COUNT; q++) {
+        obs->waiting[q] = getWaitingVehicleCount(queues[q]);
+        obs->occupied[q] = getQueueSize(queues[q]) - obs->waiting[q];
+    }
+    obs->intersectionBusy = isAnyVehicleCrossingIntersection(queueData);
+}
 
-            char *vehicleNumber = strtok(line, ":");
-            char *roadStr = strtok(NULL, ":");
+//Serve min(laneSize, average of all lanes), at least one vehicle if the lane has any
+static int fairShare(const LaneObservation *obs, int lane)
+{
+    int totalVehicles = 0;
+    for (int q = 0; q < LANE_COUNT; q++) {
+        totalVehicles += obs->waiting[q];
+    }
+    int avgVehicles = (totalVehicles + 3) / 4;  //round up division by 4
+    if (avgVehicles < 1) avgVehicles = 1;
 
-            if (vehicleNumber && roadStr){
-                char road = roadStr[0];
-                SDL_LockMutex(queueData->mutex);
+    int laneSize = obs->waiting[lane];
+    int vehicles = (laneSize < avgVehicles) ? laneSize : avgVehicles;
+    if (vehicles < 1 && laneSize > 0) vehicles = 1;
+    return vehicles;
+}
 
-                switch (road){
-                    case 'A':
-                        enqueue(queueData->queueA, vehicleNumber, road);
-                        break;
-                    case 'B':
-                        enqueue(queueData->queueB, vehicleNumber, road);
-                        break;
-                    case 'C':
-                        enqueue(queueData->queueC, vehicleNumber, road);
-                        break;
-                    case 'D':
-                        enqueue(queueData->queueD, vehicleNumber, road);
-                        break;
-                    default:
-                        SDL_Log("Unknown road: %c", road);
-                }
-                
-                SDL_UnlockMutex(queueData->mutex);
-            }
-        }
-        lastFilePos = ftell(file);
-        fclose(file);
-        sleep(1);
+//Default policy: priority mode for lane A, otherwise average-based rotation
+static PolicyDecision defaultPolicyObserve(const LaneObservation *obs, PolicyContext *ctx)
+{
+    PolicyDecision decision = {0, 0, 0};
+    int sizeA = obs->waiting[0];
+
+    //Priority mode activation: > 10 vehicles triggers priority mode
+    //Priority mode deactivation: < 5 vehicles exits priority mode
+    if (sizeA > PRIORITY_THRESHOLD_HIGH) {
+        ctx->priorityMode = 1;
+    } else if (sizeA < PRIORITY_THRESHOLD_LOW && ctx->priorityMode == 1) {
+        ctx->priorityMode = 0;
     }
-    return NULL;
-}
\ No newline at end of file
+
+    if (ctx->priorityMode == 1) {
+        //Full priority mode: serve only lane A until < 5 vehicles
+        decision.lane = 0;
+        decision.vehicles = sizeA;
+    } else if (sizeA > PRIORITY_THRESHOLD_LOW && ctx->currentLane != 0) {
+        //Immediate service: lane A has > 5 vehicles, serve it next (but not full priority)
+        //Don't change currentLane - will continue normal rotation after this
+        decision.lane = 0;
+        decision.vehicles = fairShare(obs, 0);
+    } else {
+        //Normal mode: serve lanes equally in rotation
+        decision.lane = ctx->currentLane;
+        decision.vehicles = fairShare(obs, decision.lane);
+        ctx->currentLane = (ctx->currentLane + 1) % LANE_COUNT;
+    }
+
+    decision.greenMs = decision.vehicles * TIME_PER_VEHICLE * 1000;
+    return decision;
+}
+
+//Round robin: skip empty lanes, serve up to ROUND_ROBIN_MAX_VEHICLES from the next busy one
+static PolicyDecision roundRobinPolicyObserve(const LaneObservation *obs, PolicyContext *ctx)
+{
+    PolicyDecision decision = {ctx->currentLane, 0, 0};
+
+    for (int i = 0; i < LANE_COUNT; i++) {
+        int lane = (ctx->currentLane + i) % LANE_COUNT;
+        if (obs->waiting[lane] > 0) {
+            decision.lane = lane;
+            decision.vehicles = obs->waiting[lane];
+            if (decision.vehicles > ROUND_ROBIN_MAX_VEHICLES) decision.vehicles = ROUND_ROBIN_MAX_VEHICLES;
+            ctx->currentLane = (lane + 1) % LANE_COUNT;
+            break;
+        }
+    }
+    ctx->priorityMode = 0;
+    decision.greenMs = decision.vehicles * TIME_PER_VEHICLE * 1000;
+    return decision;
+}
+
+//Longest queue first: always serve the lane with the most waiting vehicles
+static PolicyDecision longestQueuePolicyObserve(const LaneObservation *obs, PolicyContext *ctx)
+{
+    PolicyDecision decision = {0, 0, 0};
+
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        if (obs->waiting[lane] > decision.vehicles) {
+            decision.lane = lane;
+            decision.vehicles = obs->waiting[lane];
+        }
+    }
+    if (decision.vehicles > LONGEST_QUEUE_MAX_VEHICLES) decision.vehicles = LONGEST_QUEUE_MAX_VEHICLES;
+    ctx->currentLane = decision.lane;
+    ctx->priorityMode = 0;
+    decision.greenMs = decision.vehicles * TIME_PER_VEHICLE * 1000;
+    return decision;
+}
+
+static const SchedulingPolicy schedulingPolicies[] = {
+    {"default", "priority mode for lane A, average-based rotation otherwise", defaultPolicyObserve},
+    {"round-robin", "fixed rotation skipping empty lanes, capped green", roundRobinPolicyObserve},
+    {"longest-queue", "serve the lane with the most waiting vehicles", longestQueuePolicyObserve},
+};
+#define POLICY_COUNT ((int)(sizeof(schedulingPolicies) / sizeof(schedulingPolicies[0])))
+
+const SchedulingPolicy *findSchedulingPolicy(const char *name)
+{
+    for (int i = 0; i < POLICY_COUNT; i++) {
+        if (strcmp(schedulingPolicies[i].name, name) == 0) {
+            return &schedulingPolicies[i];
+        }
+    }
+    return NULL;
+}
+
+void listSchedulingPolicies(void)
+{
+    for (int i = 0; i < POLICY_COUNT; i++) {
+        printf("  %-14s %s\n", schedulingPolicies[i].name, schedulingPolicies[i].description);
+    }
+}
+
+//Small deterministic generator so benchmark runs are repeatable
+static uint32_t benchRandom(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static double benchSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//Run one policy in isolation: time its decisions on random lane states, then
+//drive it through an hour of a saturation-flow model of the junction
+static void benchmarkPolicy(const SchedulingPolicy *policy)
+{
+    static LaneObservation samples[BENCH_SAMPLE_COUNT];
+    uint32_t seed = 12345;
+
+    for (int i = 0; i < BENCH_SAMPLE_COUNT; i++) {
+        for (int q = 0; q < LANE_COUNT; q++) {
+            samples[i].waiting[q] = benchRandom(&seed) % 25;
+            samples[i].occupied[q] = benchRandom(&seed) % 3;
+        }
+        samples[i].intersectionBusy = false;
+    }
+
+    PolicyContext ctx = {0, 0};
+    long checksum = 0;
+    double start = benchSeconds();
+    for (int i = 0; i < BENCH_DECISIONS; i++) {
+        PolicyDecision decision = policy->observe(&samples[i % BENCH_SAMPLE_COUNT], &ctx);
+        checksum += decision.lane + decision.greenMs;
+    }
+    double nsPerDecision = (benchSeconds() - start) * 1e9 / BENCH_DECISIONS;
+
+    //Fluid model: Bernoulli arrivals per step, one departure per headway while green,
+    //a fixed clearance time between greens (what isAnyVehicleCrossingIntersection waits for)
+    const double arrivalRate[LANE_COUNT] = {0.30, 0.15, 0.15, 0.15};  //vehicles per second
+    const double step = 0.1;
+    const double headway = (VEHICLE_HEIGHT + VEHICLE_GAP) / VEHICLE_SPEED;
+    const double clearance = ROAD_WIDTH / VEHICLE_SPEED;
+    static double arrivals[LANE_COUNT][BENCH_LANE_CAPACITY];
+    int head[LANE_COUNT] = {0}, tail[LANE_COUNT] = {0};
+    long departed = 0, dropped = 0;
+    double totalWait = 0, now = 0;
+
+    ctx.currentLane = 0;
+    ctx.priorityMode = 0;
+    seed = 777;
+    while (now < BENCH_HORIZON_S) {
+        LaneObservation obs = {{0}, {0}, false};
+        for (int q = 0; q < LANE_COUNT; q++) obs.waiting[q] = tail[q] - head[q];
+        PolicyDecision decision = policy->observe(&obs, &ctx);
+
+        double greenEnd = now + (decision.greenMs > 0 ? decision.greenMs / 1000.0 : 0);
+        double phaseEnd = (decision.greenMs > 0) ? greenEnd + clearance : now + 0.2;
+        double nextDeparture = now;
+        while (now < phaseEnd) {
+            for (int q = 0; q < LANE_COUNT; q++) {
+                if ((benchRandom(&seed) % 10000) < arrivalRate[q] * step * 10000) {
+                    if (tail[q] - head[q] < BENCH_LANE_CAPACITY) {
+                        arrivals[q][tail[q]++ % BENCH_LANE_CAPACITY] = now;
+                    } else {
+                        dropped++;
+                    }
+                }
+            }
+            int lane = decision.lane;
+            if (now < greenEnd && now >= nextDeparture && head[lane] < tail[lane]) {
+                totalWait += now - arrivals[lane][head[lane]++ % BENCH_LANE_CAPACITY];
+                departed++;
+                nextDeparture = now + headway;
+            }
+            now += step;
+        }
+    }
+
+    int backlog = 0;
+    for (int q = 0; q < LANE_COUNT; q++) backlog += tail[q] - head[q];
+    printf("%-14s %8.1f ns/decision  %6.0f veh/h  avg wait %6.1f s  backlog %d  dropped %ld  (checksum %ld)\n",
+           policy->name, nsPerDecision, departed * 3600.0 / BENCH_HORIZON_S,
+           departed ? totalWait / departed : 0.0, backlog, dropped, checksum);
+}
+
+//Benchmark one policy by name, or every registered policy if name is NULL
+int benchmarkSchedulingPolicies(const char *name)
+{
+    if (name != NULL) {
+        const SchedulingPolicy *policy = findSchedulingPolicy(name);
+        if (!policy) {
+            fprintf(stderr, "Unknown policy '%s'. Available policies:\n", name);
+            listSchedulingPolicies();
+            return 1;
+        }
+        benchmarkPolicy(policy);
+        return 0;
+    }
+    for (int i = 0; i < POLICY_COUNT; i++) {
+        benchmarkPolicy(&schedulingPolicies[i]);
+    }
+    return 0;
+}
+
+//Discrete-event engine (--event-sim): the same junction geometry, policies and
+//green timing as the live simulation, but time jumps from one event to the
+//next instead of stepping every vehicle every frame. Vehicles move at
+//VEHICLE_SPEED, so where one is follows from when it arrived or entered.
+typedef enum {
+    EVENT_ARRIVAL,       //vehicle appears at its lane's spawn point
+    EVENT_STOP_LINE,     //reaches the stop line, or would if nothing were queued there
+    EVENT_ENTER,         //head of the lane enters the junction box if still released
+    EVENT_CLEAR,         //vehicle has left the junction box
+    EVENT_EXIT,          //vehicle has left the screen
+    EVENT_PHASE,         //the green may end, or the controller decides again
+    EVENT_KIND_COUNT
+} EventKind;
+
+typedef struct {
+    double time;         //seconds since the start
+    uint64_t seq;        //events at the same time run in the order they were scheduled
+    uint32_t ref;        //vehicle index, or the controller generation for EVENT_PHASE
+    uint8_t kind;        //EventKind
+    uint8_t lane;
+} SimEvent;
+
+//Binary min-heap on (time, seq)
+typedef struct {
+    SimEvent *items;
+    size_t count;
+    size_t capacity;
+    uint64_t nextSeq;
+} EventQueue;
+
+typedef struct {
+    double arrivedAt;
+    double enteredAt;    //-1 until it enters the junction box
+    uint32_t next;       //free list link
+    uint8_t lane;
+    uint8_t turn;        //TurnDirection
+    bool atStopLine;
+} EventVehicle;
+
+typedef struct {
+    uint32_t *waiting;   //ring of vehicle indices in arrival order, not yet entered
+    size_t head;
+    size_t count;
+    size_t capacity;     //power of two
+    double nextEnterAt;  //one saturation headway after the previous entry
+    bool enterPending;   //an EVENT_ENTER for the head is scheduled
+    int occupied;        //entered but not yet off screen
+    long served;
+    double totalWait;
+} EventLane;
+
+//Distances along a vehicle's path, from the point where it enters the junction box
+typedef struct {
+    float turnAt;        //leaves the approach axis (exitAt when going straight)
+    float clearAt;       //no longer counts as crossing the junction
+    float exitAt;        //removed off screen
+} EventPath;
+
+typedef struct {
+    EventQueue events;
+    EventVehicle *vehicles;
+    uint32_t vehicleCount;
+    uint32_t vehicleCapacity;
+    uint32_t freeVehicles;
+    EventLane lanes[LANE_COUNT];
+    EventPath paths[LANE_COUNT][TURN_COUNT];
+    double arrivalRate[LANE_COUNT];   //vehicles per second
+    uint32_t seed;
+
+    const SchedulingPolicy *policy;
+    PolicyContext ctx;
+    GreenTiming timing;
+    bool concurrentPhases;
+    unsigned greenMovements;
+    double greenStart;
+    double greenEnd;                  //fixed end, or the actuated limit
+    bool greenCapped;                 //greenEnd is maxGreenMs, shorter than the policy asked for
+    double lastCrossing;              //latest entry during this green
+    uint32_t generation;              //bumped per decision, stale EVENT_PHASE are dropped
+    int crossing;                     //vehicles inside the junction box
+    bool awaitingClear;               //controller waits for crossing to reach 0
+    GreenStats stats;
+    long eventCounts[EVENT_KIND_COUNT];  //events processed, cancelled enters included
+    long cancelledEnters;                //EVENT_ENTER that found its movement red
+} EventSim;
+
+static const char *eventKindNames[EVENT_KIND_COUNT] = {"arrival", "stop line", "enter", "clear", "exit", "phase"};
+
+static inline bool eventBefore(const SimEvent *a, const SimEvent *b)
+{
+    return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+static void scheduleEvent(EventSim *sim, double time, EventKind kind, int lane, uint32_t ref)
+{
+    EventQueue *queue = &sim->events;
+    if (queue->count == queue->capacity) {
+        queue->capacity = queue->capacity ? queue->capacity * 2 : 1024;
+        queue->items = (SimEvent *)realloc(queue->items, queue->capacity * sizeof(SimEvent));
+        if (!queue->items) {
+            fprintf(stderr, "out of memory for %zu events\n", queue->capacity);
+            exit(1);
+        }
+    }
+    SimEvent event = {time, queue->nextSeq++, ref, (uint8_t)kind, (uint8_t)lane};
+    size_t i = queue->count++;
+    while (i > 0 && eventBefore(&event, &queue->items[(i - 1) / 2])) {
+        queue->items[i] = queue->items[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    queue->items[i] = event;
+}
+
+static SimEvent popEvent(EventQueue *queue)
+{
+    SimEvent first = queue->items[0];
+    SimEvent last = queue->items[--queue->count];
+    size_t i = 0;
+    while (1) {
+        size_t child = 2 * i + 1;
+        if (child >= queue->count) break;
+        if (child + 1 < queue->count && eventBefore(&queue->items[child + 1], &queue->items[child])) child++;
+        if (!eventBefore(&queue->items[child], &last)) break;
+        queue->items[i] = queue->items[child];
+        i = child;
+    }
+    queue->items[i] = last;
+    return first;
+}
+
+static uint32_t allocEventVehicle(EventSim *sim)
+{
+    if (sim->freeVehicles != VEHICLE_NONE) {
+        uint32_t index = sim->freeVehicles;
+        sim->freeVehicles = sim->vehicles[index].next;
+        return index;
+    }
+    if (sim->vehicleCount == sim->vehicleCapacity) {
+        sim->vehicleCapacity = sim->vehicleCapacity ? sim->vehicleCapacity * 2 : 1024;
+        sim->vehicles = (EventVehicle *)realloc(sim->vehicles, sim->vehicleCapacity * sizeof(EventVehicle));
+        if (!sim->vehicles) {
+            fprintf(stderr, "out of memory for %u vehicles\n", sim->vehicleCapacity);
+            exit(1);
+        }
+    }
+    return sim->vehicleCount++;
+}
+
+static void eventLanePush(EventLane *lane, uint32_t vehicle)
+{
+    if (lane->count == lane->capacity) {
+        size_t capacity = lane->capacity ? lane->capacity * 2 : 64;
+        uint32_t *waiting = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+        if (!waiting) {
+            fprintf(stderr, "out of memory for %zu waiting vehicles\n", capacity);
+            exit(1);
+        }
+        for (size_t i = 0; i < lane->count; i++) {
+            waiting[i] = lane->waiting[(lane->head + i) & (lane->capacity - 1)];
+        }
+        free(lane->waiting);
+        lane->waiting = waiting;
+        lane->head = 0;
+        lane->capacity = capacity;
+    }
+    lane->waiting[(lane->head + lane->count++) & (lane->capacity - 1)] = vehicle;
+}
+
+static inline uint32_t eventLaneFront(const EventLane *lane)
+{
+    return lane->waiting[lane->head];
+}
+
+//Top-left corner of a vehicle distance px past the junction entry
+static void eventPathPoint(const EventSim *sim, int lane, int turn, float distance, float *x, float *y)
+{
+    const RoadGeometry *geometry = &roadGeometry[lane];
+    const KinematicsPhase *phases = kinematics[lane][turn];
+    float turnAt = sim->paths[lane][turn].turnAt;
+    roadPoint(geometry, phases[PHASE_APPROACH].doneAt + fminf(distance, turnAt), x, y);
+    if (distance > turnAt) {
+        *x += phases[PHASE_TURNED].dirX * (distance - turnAt);
+        *y += phases[PHASE_TURNED].dirY * (distance - turnAt);
+    }
+}
+
+//Where a vehicle's path ends and where it stops counting as crossing, from
+//the kinematics legs and the same junction box test the live controller uses
+static void buildEventPaths(EventSim *sim)
+{
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        const RoadGeometry *geometry = &roadGeometry[lane];
+        for (int turn = TURN_STRAIGHT; turn <= TURN_RIGHT; turn++) {
+            const KinematicsPhase *phases = kinematics[lane][turn];
+            float entry = phases[PHASE_APPROACH].doneAt;
+            EventPath *path = &sim->paths[lane][turn];
+            path->turnAt = phases[PHASE_CROSSING].doneAt - entry;
+            path->exitAt = path->turnAt;
+            if (!phases[PHASE_CROSSING].exits) {
+                float x, y;
+                roadPoint(geometry, phases[PHASE_CROSSING].doneAt, &x, &y);
+                const KinematicsPhase *turned = &phases[PHASE_TURNED];
+                path->exitAt += turned->doneAt - (x * turned->dirX + y * turned->dirY);
+            }
+
+            //Turning vehicles count as crossing until the turn is done
+            path->clearAt = turn == TURN_RIGHT ? path->turnAt : 0;
+            VehicleNode probe = {0};
+            while (path->clearAt < path->exitAt) {
+                float x, y;
+                eventPathPoint(sim, lane, turn, path->clearAt, &x, &y);
+                probe.x = toCoord(x);
+                probe.y = toCoord(y);
+                if (!overlapsJunction(&probe)) break;
+                path->clearAt += 1.0f;
+            }
+        }
+    }
+}
+
+//Where a vehicle is at now; place is its position in the lane's waiting line
+//(0 for the head), which decides the stop slot it drives up to
+static void eventVehiclePosition(const EventSim *sim, const EventVehicle *vehicle, int place, double now,
+                                 float *x, float *y)
+{
+    const RoadGeometry *geometry = &roadGeometry[vehicle->lane];
+    if (vehicle->enteredAt >= 0) {
+        eventPathPoint(sim, vehicle->lane, vehicle->turn, VEHICLE_SPEED * (now - vehicle->enteredAt), x, y);
+        return;
+    }
+    const KinematicsPhase *approach = &kinematics[vehicle->lane][vehicle->turn][PHASE_APPROACH];
+    float driven = geometry->spawnProgress + VEHICLE_SPEED * (now - vehicle->arrivedAt);
+    float slot = approach->stopAt - place * (geometry->length + VEHICLE_GAP);
+    roadPoint(geometry, fminf(driven, slot), x, y);
+}
+
+static TurnDirection eventRandomTurn(EventSim *sim, int lane)
+{
+    const RoadGeometry *geometry = &roadGeometry[lane];
+    if (!geometry->rightAllowed) return TURN_STRAIGHT;
+    if (!geometry->straightAllowed) return TURN_RIGHT;
+    return benchRandom(&sim->seed) % 100 < TURN_RIGHT_PROBABILITY ? TURN_RIGHT : TURN_STRAIGHT;
+}
+
+//Exponential gap to the next arrival on lane
+static double eventArrivalGap(EventSim *sim, int lane)
+{
+    double uniform = (benchRandom(&sim->seed) + 1.0) / 4294967297.0;
+    return -log(uniform) / sim->arrivalRate[lane];
+}
+
+//Let the head of lane go as soon as it is at the stop line, its movement is
+//green and a saturation headway has passed since the vehicle before it
+static void eventTryEnter(EventSim *sim, int q, double now)
+{
+    EventLane *lane = &sim->lanes[q];
+    if (lane->enterPending || lane->count == 0) return;
+    uint32_t index = eventLaneFront(lane);
+    EventVehicle *vehicle = &sim->vehicles[index];
+    if (!vehicle->atStopLine || !(sim->greenMovements & MOVEMENT_BIT(q, vehicle->turn))) return;
+
+    const RoadGeometry *geometry = &roadGeometry[q];
+    double reachesEntry = vehicle->arrivedAt + (kinematics[q][vehicle->turn][PHASE_APPROACH].doneAt -
+                                                geometry->spawnProgress) / VEHICLE_SPEED;
+    double at = fmax(now, fmax(lane->nextEnterAt, reachesEntry));
+    lane->enterPending = true;
+    scheduleEvent(sim, at, EVENT_ENTER, q, index);
+}
+
+static int eventGreenWaiting(const EventSim *sim)
+{
+    int waiting = 0;
+    for (int q = 0; q < LANE_COUNT; q++) {
+        if (sim->greenMovements & LANE_MOVEMENTS(q)) waiting += (int)sim->lanes[q].count;
+    }
+    return waiting;
+}
+
+//The controller loop of checkQueue: wait for the box to clear, ask the
+//policy, and start a green for the chosen lane and whatever fits with it
+static void eventDecide(EventSim *sim, double now)
+{
+    if (sim->crossing > 0) {
+        sim->awaitingClear = true;
+        return;
+    }
+
+    LaneObservation obs;
+    int headTurn[LANE_COUNT];
+    for (int q = 0; q < LANE_COUNT; q++) {
+        const EventLane *lane = &sim->lanes[q];
+        obs.waiting[q] = (int)lane->count;
+        obs.occupied[q] = lane->occupied;
+        headTurn[q] = lane->count ? sim->vehicles[eventLaneFront(lane)].turn : -1;
+    }
+    obs.intersectionBusy = false;
+
+    PolicyDecision decision = sim->policy->observe(&obs, &sim->ctx);
+    sim->generation++;
+    if (decision.greenMs <= 0) {
+        scheduleEvent(sim, now + EVENT_SIM_IDLE_S, EVENT_PHASE, 0, sim->generation);
+        return;
+    }
+
+    int limitMs = decision.greenMs;
+    sim->greenCapped = false;
+    if (sim->timing.actuated) {
+        sim->greenCapped = limitMs > sim->timing.maxGreenMs;
+        if (sim->greenCapped) limitMs = sim->timing.maxGreenMs;
+        if (limitMs < sim->timing.minGreenMs) limitMs = sim->timing.minGreenMs;
+    }
+    sim->greenMovements = grantGreenMovements(&obs, decision.lane, headTurn, sim->concurrentPhases);
+    sim->greenStart = now;
+    sim->greenEnd = now + limitMs / 1000.0;
+    sim->lastCrossing = now;
+    double check = sim->timing.actuated ? fmin(sim->greenEnd, now + sim->timing.minGreenMs / 1000.0) : sim->greenEnd;
+    scheduleEvent(sim, check, EVENT_PHASE, 0, sim->generation);
+    for (int q = 0; q < LANE_COUNT; q++) {
+        eventTryEnter(sim, q, now);
+    }
+}
+
+//End the green if runGreenPhase would have ended it by now, otherwise check again later
+static void eventPhase(EventSim *sim, double now)
+{
+    if (sim->greenMovements != 0) {
+        const double slack = 1e-9;
+        double elapsed = now - sim->greenStart;
+        bool over = now >= sim->greenEnd - slack;
+        if (over) {
+            sim->stats.maxOuts += sim->greenCapped;
+        } else if (sim->timing.actuated) {
+            over = eventGreenWaiting(sim) == 0 ||
+                   (elapsed >= sim->timing.minGreenMs / 1000.0 - slack &&
+                    now - sim->lastCrossing >= sim->timing.gapMs / 1000.0 - slack);
+            sim->stats.gapOuts += over;
+        }
+        if (!over) {
+            double gapOut = fmax(sim->greenStart + sim->timing.minGreenMs / 1000.0,
+                                 sim->lastCrossing + sim->timing.gapMs / 1000.0);
+            scheduleEvent(sim, fmin(sim->greenEnd, gapOut), EVENT_PHASE, 0, sim->generation);
+            return;
+        }
+        sim->stats.greenPhases++;
+        sim->stats.totalGreenMs += lround(elapsed * 1000);
+        sim->stats.deadGreenMs += lround((now - sim->lastCrossing) * 1000);
+        sim->greenMovements = 0;
+    }
+    eventDecide(sim, now);
+}
+
+static void eventEnter(EventSim *sim, const SimEvent *event)
+{
+    EventLane *lane = &sim->lanes[event->lane];
+    EventVehicle *vehicle = &sim->vehicles[event->ref];
+    lane->enterPending = false;
+    if (!(sim->greenMovements & MOVEMENT_BIT(event->lane, vehicle->turn))) {  //went red first
+        sim->cancelledEnters++;
+        return;
+    }
+
+    lane->head = (lane->head + 1) & (lane->capacity - 1);
+    lane->count--;
+    lane->occupied++;
+    lane->served++;
+    lane->totalWait += event->time - vehicle->arrivedAt;
+    lane->nextEnterAt = event->time + (roadGeometry[event->lane].length + VEHICLE_GAP) / VEHICLE_SPEED;
+    vehicle->enteredAt = event->time;
+    sim->stats.servedVehicles++;
+    sim->stats.totalWaitMs += (event->time - vehicle->arrivedAt) * 1000;
+    sim->lastCrossing = event->time;
+    sim->crossing++;
+
+    const EventPath *path = &sim->paths[event->lane][vehicle->turn];
+    scheduleEvent(sim, event->time + path->clearAt / VEHICLE_SPEED, EVENT_CLEAR, event->lane, event->ref);
+    scheduleEvent(sim, event->time + path->exitAt / VEHICLE_SPEED, EVENT_EXIT, event->lane, event->ref);
+    eventTryEnter(sim, event->lane, event->time);
+    if (sim->timing.actuated && eventGreenWaiting(sim) == 0) {
+        scheduleEvent(sim, event->time, EVENT_PHASE, 0, sim->generation);
+    }
+}
+
+static void eventDispatch(EventSim *sim, const SimEvent *event)
+{
+    EventLane *lane = &sim->lanes[event->lane];
+    switch ((EventKind)event->kind) {
+        case EVENT_ARRIVAL: {
+            uint32_t index = allocEventVehicle(sim);
+            EventVehicle *vehicle = &sim->vehicles[index];
+            vehicle->arrivedAt = event->time;
+            vehicle->enteredAt = -1;
+            vehicle->lane = event->lane;
+            vehicle->turn = eventRandomTurn(sim, event->lane);
+            vehicle->atStopLine = false;
+            eventLanePush(lane, index);
+
+            const RoadGeometry *geometry = &roadGeometry[event->lane];
+            float toStopLine = kinematics[event->lane][vehicle->turn][PHASE_APPROACH].stopAt - geometry->spawnProgress;
+            scheduleEvent(sim, event->time + toStopLine / VEHICLE_SPEED, EVENT_STOP_LINE, event->lane, index);
+            scheduleEvent(sim, event->time + eventArrivalGap(sim, event->lane), EVENT_ARRIVAL, event->lane, 0);
+            break;
+        }
+        case EVENT_STOP_LINE:
+            sim->vehicles[event->ref].atStopLine = true;
+            eventTryEnter(sim, event->lane, event->time);
+            break;
+        case EVENT_ENTER:
+            eventEnter(sim, event);
+            break;
+        case EVENT_CLEAR:
+            sim->crossing--;
+            if (sim->crossing == 0 && sim->awaitingClear) {
+                sim->awaitingClear = false;
+                eventDecide(sim, event->time);
+            }
+            break;
+        case EVENT_EXIT:
+            lane->occupied--;
+            sim->vehicles[event->ref].next = sim->freeVehicles;
+            sim->freeVehicles = event->ref;
+            break;
+        case EVENT_PHASE:
+            if (event->ref == sim->generation) eventPhase(sim, event->time);
+            break;
+        default:
+            break;
+    }
+}
+
+//Simulate hours of arrivals at rates (vehicles per hour on A B C D) without a window
+int runEventSimulation(const SchedulingPolicy *policy, const GreenTiming *timing, bool concurrentPhases,
+                       double hours, const double rates[LANE_COUNT])
+{
+    static EventSim sim;
+    memset(&sim, 0, sizeof(sim));
+    sim.freeVehicles = VEHICLE_NONE;
+    sim.policy = policy;
+    sim.timing = *timing;
+    sim.concurrentPhases = concurrentPhases;
+    sim.seed = 2024;
+    buildEventPaths(&sim);
+
+    double offered = 0;
+    for (int q = 0; q < LANE_COUNT; q++) {
+        sim.arrivalRate[q] = roadGeometry[q].present ? rates[q] / 3600.0 : 0;
+        offered += sim.arrivalRate[q] * 3600.0;
+        if (sim.arrivalRate[q] > 0) {
+            scheduleEvent(&sim, eventArrivalGap(&sim, q), EVENT_ARRIVAL, q, 0);
+        }
+    }
+    scheduleEvent(&sim, 0, EVENT_PHASE, 0, sim.generation);
+
+    double horizon = hours * 3600.0;
+    long events = 0;
+    double start = benchSeconds();
+    while (sim.events.count > 0 && sim.events.items[0].time <= horizon) {
+        SimEvent event = popEvent(&sim.events);
+        sim.eventCounts[event.kind]++;
+        events++;
+        eventDispatch(&sim, &event);
+    }
+    double elapsed = benchSeconds() - start;
+
+    printf("event-sim: %.1f h, policy %s, %s greens, %.0f veh/h offered\n", hours, policy->name,
+           timing->actuated ? "actuated" : "fixed", offered);
+    printf("  %ld events in %.3f s (%.1f M events/s), %u vehicle slots, %zu events pending\n", events, elapsed,
+           elapsed > 0 ? events / elapsed / 1e6 : 0.0, sim.vehicleCount, sim.events.count);
+    for (int kind = 0; kind < EVENT_KIND_COUNT; kind++) {
+        long count = sim.eventCounts[kind] - (kind == EVENT_ENTER ? sim.cancelledEnters : 0);
+        printf("  %-10s %10ld\n", eventKindNames[kind], count);
+        if (kind == EVENT_ENTER) printf("  %-10s %10ld  (enter cancelled, the light went red)\n", "cancelled", sim.cancelledEnters);
+    }
+    printf("  served %ld vehicles (%.0f veh/h), average wait %.1f s\n", sim.stats.servedVehicles,
+           sim.stats.servedVehicles / hours, sim.stats.servedVehicles ? sim.stats.totalWaitMs / sim.stats.servedVehicles / 1000 : 0.0);
+    for (int q = 0; q < LANE_COUNT; q++) {
+        const EventLane *lane = &sim.lanes[q];
+        if (!roadGeometry[q].present) continue;
+        printf("  lane %c: served %ld, average wait %.1f s, %zu still waiting\n", 'A' + q, lane->served,
+               lane->served ? lane->totalWait / lane->served : 0.0, lane->count);
+    }
+    double deadShare = sim.stats.totalGreenMs ? 100.0 * sim.stats.deadGreenMs / sim.stats.totalGreenMs : 0.0;
+    printf("  %ld greens (%ld gap-out, %ld max-out, %ld full length), %.0f s green, %.1f%% dead\n",
+           sim.stats.greenPhases, sim.stats.gapOuts, sim.stats.maxOuts,
+           sim.stats.greenPhases - sim.stats.gapOuts - sim.stats.maxOuts, sim.stats.totalGreenMs / 1000.0, deadShare);
+
+    //Oldest waiting vehicle at the horizon, placed on demand
+    int oldestLane = -1;
+    for (int q = 0; q < LANE_COUNT; q++) {
+        const EventLane *lane = &sim.lanes[q];
+        if (lane->count && (oldestLane < 0 || sim.vehicles[eventLaneFront(lane)].arrivedAt <
+                                                  sim.vehicles[eventLaneFront(&sim.lanes[oldestLane])].arrivedAt)) {
+            oldestLane = q;
+        }
+    }
+    if (oldestLane >= 0) {
+        const EventVehicle *oldest = &sim.vehicles[eventLaneFront(&sim.lanes[oldestLane])];
+        float x, y;
+        eventVehiclePosition(&sim, oldest, 0, horizon, &x, &y);
+        printf("  oldest waiting: lane %c, %.1f s, at (%.0f, %.0f)\n", 'A' + oldestLane, horizon - oldest->arrivedAt, x, y);
+    }
+
+    for (int q = 0; q < LANE_COUNT; q++) free(sim.lanes[q].waiting);
+    free(sim.vehicles);
+    free(sim.events.items);
+    return 0;
+}
+
+//Latest stop line crossing since start on any road with a green movement
+static Uint32 lastGreenCrossing(QueueData *queueData, unsigned greenMovements, Uint32 start)
+{
+    Uint32 latest = start;
+    for (int q = 0; q < LANE_COUNT; q++) {
+        Uint32 crossing = queueData->stats.lastCrossingTicks[q];
+        if ((greenMovements & LANE_MOVEMENTS(q)) && (Sint32)(crossing - latest) > 0) {
+            latest = crossing;
+        }
+    }
+    return latest;
+}
+
+//Hold the green for a set of movements and return how long it actually lasted.
+//Fixed timing sleeps through greenMs; actuated timing ends the green as soon
+//as the lane empties, or once past minGreenMs when no vehicle has crossed the
+//stop line for gapMs. The green never outlasts greenMs or maxGreenMs; only
+//running into maxGreenMs counts as a max-out.
+int runGreenPhase(QueueData *queueData, unsigned greenMovements, int greenMs)
+{
+    Queue *queues[] = {queueData->queueA, queueData->queueB, queueData->queueC, queueData->queueD};
+    GreenTiming *timing = &queueData->timing;
+    Uint32 start = simTicks();
+    Uint32 elapsed = 0;
+
+    if (!timing->actuated) {
+        simDelay(greenMs);
+        elapsed = simTicks() - start;
+    } else {
+        bool capped = timing->maxGreenMs < greenMs;
+        int limit = capped ? timing->maxGreenMs : greenMs;
+        if (limit < timing->minGreenMs) limit = timing->minGreenMs;
+
+        while (1) {
+            simDelay(ACTUATED_POLL_MS);
+            Uint32 now = simTicks();
+            elapsed = now - start;
+
+            LOCK_QUEUES(queueData);
+            int waiting = 0;
+            for (int q = 0; q < LANE_COUNT; q++) {
+                if (greenMovements & LANE_MOVEMENTS(q)) {
+                    waiting += getWaitingVehicleCount(queues[q]);
+                }
+            }
+            Uint32 lastCrossing = lastGreenCrossing(queueData, greenMovements, start);
+            UNLOCK_QUEUES(queueData);
+
+            if ((int)elapsed >= limit) {
+                queueData->stats.maxOuts += capped;
+                break;
+            }
+            //An empty lane has nothing left to protect, so it does not wait out the minimum
+            if (waiting == 0 ||
+                ((int)elapsed >= timing->minGreenMs && (int)(now - lastCrossing) >= timing->gapMs)) {
+                queueData->stats.gapOuts++;
+                break;
+            }
+        }
+    }
+
+    LOCK_QUEUES(queueData);
+    Uint32 end = start + elapsed;
+    Uint32 lastCrossing = lastGreenCrossing(queueData, greenMovements, start);
+    Uint32 lastActivity = (lastCrossing - start <= elapsed) ? lastCrossing : end;
+    queueData->stats.greenPhases++;
+    queueData->stats.totalGreenMs += elapsed;
+    queueData->stats.deadGreenMs += end - lastActivity;
+    UNLOCK_QUEUES(queueData);
+
+    return (int)elapsed;
+}
+
+void printGreenStats(QueueData *queueData)
+{
+    GreenStats *stats = &queueData->stats;
+    double deadShare = stats->totalGreenMs ? 100.0 * stats->deadGreenMs / stats->totalGreenMs : 0.0;
+    double avgWait = stats->servedVehicles ? stats->totalWaitMs / stats->servedVehicles / 1000.0 : 0.0;
+
+    SDL_Log("Green timing: %s, %ld greens (%ld gap-out, %ld max-out, %ld full length), %ld ms green, %ld ms dead (%.1f%%)",
+            queueData->timing.actuated ? "actuated" : "fixed", stats->greenPhases, stats->gapOuts, stats->maxOuts,
+            stats->greenPhases - stats->gapOuts - stats->maxOuts, stats->totalGreenMs, stats->deadGreenMs, deadShare);
+    SDL_Log("Served %ld vehicles, average wait %.1f s", stats->servedVehicles, avgWait);
+    if (stats->freeLeftServed > 0) {
+        SDL_Log("Free left turns: %ld vehicles, average wait %.1f s", stats->freeLeftServed,
+                stats->freeLeftWaitMs / stats->freeLeftServed / 1000.0);
+    }
+    for (int lane = 0; lane < QUEUED_LANE_COUNT; lane++) {
+        if (queueData->counters.rejected[lane] > 0) {
+            SDL_Log("Rejected %ld arrivals for lane %c, which layout %s leaves out",
+                    queueData->counters.rejected[lane], laneRoad(lane), layout.name);
+        }
+    }
+}
+
+static int latencyBucket(Uint32 ms)
+{
+    int msb = ms ? 31 - __builtin_clz(ms) : 0;
+    int shift = msb >= LATENCY_SUB_BITS ? msb - (LATENCY_SUB_BITS - 1) : 0;
+    return (shift << (LATENCY_SUB_BITS - 1)) + (int)(ms >> shift);
+}
+
+//Largest value that falls in bucket
+static Uint32 latencyBucketTop(int bucket)
+{
+    int half = 1 << (LATENCY_SUB_BITS - 1);
+    if (bucket < 2 * half) return (Uint32)bucket;
+    int shift = bucket / half - 1;
+    return ((Uint32)(bucket - shift * half) << shift) + ((1u << shift) - 1);
+}
+
+static void latencyRecord(LatencyHistogram *histogram, Uint32 ms)
+{
+    histogram->counts[latencyBucket(ms)]++;
+    histogram->samples++;
+    if (ms > histogram->maxMs) histogram->maxMs = ms;
+}
+
+//Top of the bucket holding the given fraction of samples, no more than the largest sample
+static Uint32 latencyPercentile(const LatencyHistogram *histogram, double fraction)
+{
+    long rank = (long)ceil(histogram->samples * fraction);
+    long seen = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += histogram->counts[bucket];
+        if (seen >= rank && seen > 0) {
+            Uint32 top = latencyBucketTop(bucket);
+            return top < histogram->maxMs ? top : histogram->maxMs;
+        }
+    }
+    return histogram->maxMs;
+}
+
+static LatencyHistogram journeyHistograms[QUEUED_LANE_COUNT][2][JOURNEY_METRIC_COUNT];
+static const char *journeyMetricNames[JOURNEY_METRIC_COUNT] = {"wait", "held", "crossing"};
+
+//Feed a vehicle leaving the screen into its lane's histograms, under the mode
+//it entered in (caller holds the mutex)
+void recordJourney(int lane, const VehicleNode *vehicle)
+{
+    const JourneyStamps *stamps = &journeyStamps[vehicleIndex(vehicle)];
+    if (!stamps->entered) return;  //restored from a snapshot after it entered
+    LatencyHistogram *histograms = journeyHistograms[lane][stamps->priority];
+    latencyRecord(&histograms[JOURNEY_WAIT], vehicleWaitedMs(vehicle, stamps->enteredTicks));
+    latencyRecord(&histograms[JOURNEY_HELD], stamps->enteredTicks - stamps->stopLineTicks);
+    latencyRecord(&histograms[JOURNEY_CROSSING], simTicks() - stamps->enteredTicks);
+}
+
+//p50/p90/p99/max per lane and mode for every finished journey so far. Called
+//from the main loop, the only thread that records, so it needs no lock.
+void printJourneyLatency(void)
+{
+    if (!journeyLatency) return;
+    static const char *modeNames[2] = {"normal", "priority"};
+    SDL_Log("Journey latency (ms, p50/p90/p99/max):");
+    SDL_Log("  %-4s %-8s %8s  %-23s  %-23s  %-23s", "lane", "mode", "vehicles",
+            journeyMetricNames[JOURNEY_WAIT], journeyMetricNames[JOURNEY_HELD], journeyMetricNames[JOURNEY_CROSSING]);
+    for (int lane = 0; lane < QUEUED_LANE_COUNT; lane++) {
+        for (int mode = 0; mode < 2; mode++) {
+            const LatencyHistogram *histograms = journeyHistograms[lane][mode];
+            if (histograms[JOURNEY_WAIT].samples == 0) continue;
+            char columns[JOURNEY_METRIC_COUNT][48];
+            for (int metric = 0; metric < JOURNEY_METRIC_COUNT; metric++) {
+                const LatencyHistogram *h = &histograms[metric];
+                snprintf(columns[metric], sizeof(columns[metric]), "%u/%u/%u/%u", latencyPercentile(h, 0.50),
+                         latencyPercentile(h, 0.90), latencyPercentile(h, 0.99), h->maxMs);
+            }
+            SDL_Log("  %-4c %-8s %8ld  %-23s  %-23s  %-23s", laneRoad(lane), modeNames[mode],
+                    histograms[JOURNEY_WAIT].samples, columns[0], columns[1], columns[2]);
+        }
+    }
+}
+
+void *checkQueue(void *arg)
+{
+    SharedData *sharedData = (SharedData *)arg;
+    QueueData *queueData = sharedData->queueData;
+    traceThread("controller");
+
+    //A green restored from a snapshot runs out its remaining time first
+    if (queueData->greenMovements != 0 && queueData->resumeGreenMs > 0) {
+        sharedData->nextLight = queueData->activeLane + 1;
+        queueData->greenEndTicks = simTicks() + queueData->resumeGreenMs;
+        SDL_Log("Resuming green for lane %d for up to %d ms", queueData->activeLane, queueData->resumeGreenMs);
+        runGreenPhase(queueData, queueData->greenMovements, queueData->resumeGreenMs);
+        sharedData->nextLight = 0;
+    }
+    queueData->activeLane = -1;
+    queueData->greenMovements = 0;
+
+    while (1)
+    {
+        uint64_t span = traceBegin();
+        while (1) {
+            LOCK_QUEUES(queueData);
+            bool intersectionBusy = isAnyVehicleCrossingIntersection(queueData);
+            UNLOCK_QUEUES(queueData);
+            
+            if (!intersectionBusy) {
+                break;
+            }
+            simDelay(50);
+        }
+        traceSpan("controller", "clear junction", span, NULL, 0);
+        
+        span = traceBegin();
+        LOCK_QUEUES(queueData);
+
+        LaneObservation obs;
+        observeLanes(queueData, &obs);
+
+        PolicyContext ctx = {queueData->currentLane, queueData->priorityMode};
+        PolicyDecision decision = queueData->policy->observe(&obs, &ctx);
+
+        if (ctx.priorityMode == 1 && queueData->priorityMode == 0) {
+            SDL_Log("Priority mode activated!! lane A has %d vehicles", obs.waiting[0]);
+        } else if (ctx.priorityMode == 0 && queueData->priorityMode == 1) {
+            SDL_Log("Normal Mode continued!! lane A has %d vehicle", obs.waiting[0]);
+        }
+        queueData->currentLane = ctx.currentLane;
+        queueData->priorityMode = ctx.priorityMode;
+
+        int laneToServe = decision.lane;
+        unsigned greenMovements = 0;
+        if (decision.greenMs > 0) {
+            greenMovements = chooseGreenMovements(queueData, &obs, laneToServe);
+        }
+
+        UNLOCK_QUEUES(queueData);
+        traceSpan("controller", "decision", span, "lane", laneToServe);
+
+        if (decision.greenMs > 0) {
+            char movements[40];
+            formatMovements(greenMovements, movements, sizeof(movements));
+
+            sharedData->nextLight = laneToServe + 1;
+            queueData->greenEndTicks = simTicks() + decision.greenMs;
+            queueData->activeLane = laneToServe;
+            queueData->greenMovements = greenMovements;
+            
+            SDL_Log("[%s] Green light for lane %d [%s] for up to %d ms (%d of %d waiting vehicles)", 
+                    queueData->policy->name, laneToServe, movements, decision.greenMs,
+                    decision.vehicles, obs.waiting[laneToServe]);
+            
+            span = traceBegin();
+            int greenMs = runGreenPhase(queueData, greenMovements, decision.greenMs);
+            traceSpan("controller", "green", span, "lane", laneToServe);
+            
+            sharedData->nextLight = 0;
+            queueData->activeLane = -1;
+            queueData->greenMovements = 0;
+            SDL_Log("Red light for lane %d after %d ms - waiting for crossing vehicles to clear", laneToServe, greenMs);
+            
+        } else {
+            SDL_Log("No vehicles in lane %d, skipping", laneToServe);
+            simDelay(200);
+        }
+    }
+    return NULL;
+}
+
+//Split complete lines of "PLATE:ROAD\n" into records without copying.
+//Stops at the first incomplete line or after maxRecords records and returns
+//how many bytes were consumed; the unconsumed tail is a torn record the
+//caller must keep until more data arrives. Lines without a plate or road are skipped.
+//memchr is vectorised in libc, which is about twice as fast as a byte loop on these short lines.
+size_t scanVehicleRecords(const char *data, size_t length, VehicleRecord *records, int maxRecords, int *count)
+{
+    const char *p = data;
+    const char *end = data + length;
+    const char *consumed = data;
+    int n = 0;
+
+    while (n < maxRecords && p < end) {
+        const char *line = p;
+        const char *newline = memchr(p, '\n', end - p);
+        if (newline == NULL) {
+            break;  //torn record, wait for the rest of the line
+        }
+        const char *colon = memchr(line, ':', newline - line);
+        p = newline;
+        if (colon != NULL && colon > line && colon + 1 < p) {
+            records[n].plate = line;
+            records[n].plateLength = (int)(colon - line);
+            records[n].road = colon[1];
+            n++;
+        }
+        p++;
+        consumed = p;
+    }
+
+    *count = n;
+    return consumed - data;
+}
+
+static const char *overflowPolicyName(OverflowPolicy policy)
+{
+    switch (policy) {
+        case OVERFLOW_DROP: return "drop";
+        case OVERFLOW_SPILL: return "spill";
+        default: return "block";
+    }
+}
+
+//Append arrivals for a full lane to its spool file as vehicle file lines
+static void spillRecords(QueueData *queueData, int lane, const VehicleRecord *records, int count)
+{
+    static char lines[PARSE_BATCH_RECORDS * (PLATE_LENGTH + 3)];
+    OverflowStats *overflow = &queueData->overflow;
+    size_t length = 0;
+    for (int i = 0; i < count; i++) {
+        int plateLength = records[i].plateLength < PLATE_LENGTH ? records[i].plateLength : PLATE_LENGTH;
+        memcpy(lines + length, records[i].plate, plateLength);
+        length += plateLength;
+        lines[length++] = ':';
+        lines[length++] = records[i].road;
+        lines[length++] = '\n';
+    }
+    ssize_t written = write(queueData->spoolFd[lane], lines, length);
+    if (written != (ssize_t)length) {
+        //a partial line would desynchronise the spool, so treat the batch as dropped
+        SDL_Log("failed to spill %d vehicles for lane %c: %s", count, 'A' + lane,
+                written < 0 ? strerror(errno) : "short write");
+        if (written > 0 && ftruncate(queueData->spoolFd[lane], overflow->spoolBytes[lane]) != 0) {
+            SDL_Log("failed to trim spool for lane %c", 'A' + lane);
+        }
+        overflow->dropped[lane] += count;
+        return;
+    }
+    overflow->spoolBytes[lane] += length;
+    overflow->spilled[lane] += count;
+    overflow->spoolPending[lane] += count;
+}
+
+//Enqueue one lane's share of a batch, applying the overflow policy for
+//whatever does not fit. Called with queueData->mutex held; OVERFLOW_BLOCK
+//releases it while waiting for the lane to drain. The free left-turn lanes
+//drain without waiting for a green, so they are never capped.
+static void admitRecords(QueueData *queueData, int lane, Queue *queue, const VehicleRecord *records, int count)
+{
+    OverflowStats *overflow = &queueData->overflow;
+    int capacity = queueData->laneCapacity;
+    if (capacity <= 0 || lane >= LANE_COUNT) {
+        enqueueBatch(queue, records, count);
+        return;
+    }
+
+    while (count > 0) {
+        int room = capacity - getQueueSize(queue);
+        //vehicles already in the spool go first, so new arrivals queue behind them
+        if (queueData->overflowPolicy == OVERFLOW_SPILL && overflow->spoolPending[lane] > 0) room = 0;
+        if (room > 0) {
+            int admitted = count < room ? count : room;
+            enqueueBatch(queue, records, admitted);
+            records += admitted;
+            count -= admitted;
+            overflow->full[lane] = false;
+            continue;
+        }
+
+        if (!overflow->full[lane]) {
+            SDL_Log("lane %c is full (%d vehicles), overflow policy %s", 'A' + lane, getQueueSize(queue),
+                    overflowPolicyName(queueData->overflowPolicy));
+            overflow->full[lane] = true;
+        }
+        switch (queueData->overflowPolicy) {
+            case OVERFLOW_BLOCK: {
+                Uint32 start = simTicks();
+                UNLOCK_QUEUES(queueData);
+                simDelay(OVERFLOW_RETRY_MS);
+                LOCK_QUEUES(queueData);
+                overflow->blockedMs += simTicks() - start;
+                break;
+            }
+            case OVERFLOW_DROP:
+                overflow->dropped[lane] += count;
+                count = 0;
+                break;
+            case OVERFLOW_SPILL:
+                spillRecords(queueData, lane, records, count);
+                count = 0;
+                break;
+        }
+    }
+}
+
+//Hand a batch of parsed records to their queues under a single mutex hold.
+//Records are split by road first so each queue takes one enqueueBatch call.
+void enqueueRecords(QueueData *queueData, const VehicleRecord *records, int count)
+{
+    static VehicleRecord laneRecords[QUEUED_LANE_COUNT][PARSE_BATCH_RECORDS];
+    static bool absentLogged[QUEUED_LANE_COUNT];
+    Queue *queues[QUEUED_LANE_COUNT];
+    laneQueues(queueData, queues);
+
+    while (count > 0) {
+        int chunk = count < PARSE_BATCH_RECORDS ? count : PARSE_BATCH_RECORDS;
+        int laneCounts[QUEUED_LANE_COUNT] = {0};
+        int rejected[QUEUED_LANE_COUNT] = {0};
+        for (int i = 0; i < chunk; i++) {
+            int lane = roadLane(records[i].road);
+            if (lane < 0) {
+                SDL_Log("Unknown road: %c", records[i].road);
+                continue;
+            }
+            if (!roadGeometry[lane].present) {
+                //a valid road this layout leaves out: count it, and say so once
+                if (!absentLogged[lane]) {
+                    SDL_Log("Layout %s has no lane %c, its arrivals are rejected and counted", layout.name,
+                            records[i].road);
+                    absentLogged[lane] = true;
+                }
+                rejected[lane]++;
+                continue;
+            }
+            laneRecords[lane][laneCounts[lane]++] = records[i];
+        }
+
+        uint64_t span = traceBegin();
+        LOCK_QUEUES(queueData);
+        for (int lane = 0; lane < QUEUED_LANE_COUNT; lane++) {
+            queueData->counters.rejected[lane] += rejected[lane];
+            queueData->counters.arrivals[lane] += laneCounts[lane];
+            if (laneCounts[lane] > 0) {
+                admitRecords(queueData, lane, queues[lane], laneRecords[lane], laneCounts[lane]);
+            }
+        }
+        UNLOCK_QUEUES(queueData);
+        traceSpan("reader", "enqueue", span, "vehicles", chunk);
+
+        records += chunk;
+        count -= chunk;
+    }
+}
+
+//Open the per-lane spool files for OVERFLOW_SPILL. A warm restart resumes
+//each spool where the snapshot left it: vehicles before its read position were
+//already re-admitted and are in the snapshot's queues, and vehicles spilled
+//after it are cut off because the reader reads them again from the snapshot's
+//read position. Otherwise the spools start empty.
+bool openSpoolFiles(QueueData *queueData)
+{
+    OverflowStats *overflow = &queueData->overflow;
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s.overflow.%c", VEHICLE_FILE, 'A' + lane);
+        int flags = O_RDWR | O_CREAT | O_APPEND | (queueData->resumeFromSnapshot ? 0 : O_TRUNC);
+        int fd = open(path, flags, 0644);
+        if (fd < 0) {
+            SDL_Log("failed to open spool file '%s': %s", path, strerror(errno));
+            return false;
+        }
+        queueData->spoolFd[lane] = fd;
+
+        struct stat st;
+        long size = fstat(fd, &st) == 0 ? (long)st.st_size : 0;
+        if (!queueData->resumeFromSnapshot || overflow->spoolPending[lane] <= 0) {
+            overflow->spoolPending[lane] = 0;
+            overflow->spoolBytes[lane] = 0;
+        } else if (size < overflow->spoolBytes[lane] || overflow->spoolReadPos[lane] < 0 ||
+                   overflow->spoolReadPos[lane] > overflow->spoolBytes[lane]) {
+            //drained and started over after the snapshot was taken
+            SDL_Log("lane %c: spool '%s' no longer matches the snapshot, %ld spilled vehicles lost",
+                    'A' + lane, path, overflow->spoolPending[lane]);
+            overflow->spoolPending[lane] = 0;
+            overflow->spoolBytes[lane] = 0;
+        }
+        if (overflow->spoolPending[lane] == 0) overflow->spoolReadPos[lane] = 0;
+        if (size > overflow->spoolBytes[lane] && ftruncate(fd, overflow->spoolBytes[lane]) != 0) {
+            SDL_Log("failed to truncate spool file '%s': %s", path, strerror(errno));
+            return false;
+        }
+        if (overflow->spoolPending[lane] > 0) {
+            SDL_Log("lane %c: %ld spilled vehicles carried over in '%s'", 'A' + lane, overflow->spoolPending[lane], path);
+        }
+    }
+    return true;
+}
+
+//Move spilled vehicles back into their lanes as room frees up, oldest first.
+//The spool file is read outside the mutex; only this thread reads it, and the
+//reader only appends to it under the mutex, so bytes below spoolBytes are stable.
+void *readmitSpilled(void *arg)
+{
+    QueueData *queueData = (QueueData *)arg;
+    traceThread("spool");
+    static char buffer[READ_BUFFER_SIZE];
+    static VehicleRecord records[PARSE_BATCH_RECORDS];
+    Queue *queues[LANE_COUNT] = {queueData->queueA, queueData->queueB, queueData->queueC, queueData->queueD};
+    OverflowStats *overflow = &queueData->overflow;
+
+    while (1)
+    {
+        for (int lane = 0; lane < LANE_COUNT; lane++) {
+            LOCK_QUEUES(queueData);
+            long pending = overflow->spoolPending[lane];
+            long end = overflow->spoolBytes[lane];
+            long readPos = overflow->spoolReadPos[lane];
+            int room = queueData->laneCapacity - getQueueSize(queues[lane]);
+            UNLOCK_QUEUES(queueData);
+            if (pending == 0 || room <= 0) continue;
+
+            size_t want = end - readPos < (long)sizeof(buffer) ? (size_t)(end - readPos) : sizeof(buffer);
+            ssize_t got = pread(queueData->spoolFd[lane], buffer, want, readPos);
+            if (got <= 0) continue;
+            int count;
+            size_t used = scanVehicleRecords(buffer, got, records, room < PARSE_BATCH_RECORDS ? room : PARSE_BATCH_RECORDS, &count);
+
+            LOCK_QUEUES(queueData);
+            enqueueBatch(queues[lane], records, count);
+            overflow->readmitted[lane] += count;
+            overflow->spoolPending[lane] -= count;
+            overflow->spoolReadPos[lane] += used;
+            if (overflow->spoolPending[lane] <= 0 || overflow->spoolReadPos[lane] >= overflow->spoolBytes[lane]) {
+                //drained: start the file over so the spool never outgrows the backlog
+                if (ftruncate(queueData->spoolFd[lane], 0) != 0) {
+                    SDL_Log("failed to truncate spool for lane %c: %s", 'A' + lane, strerror(errno));
+                }
+                overflow->spoolPending[lane] = 0;
+                overflow->spoolBytes[lane] = 0;
+                overflow->spoolReadPos[lane] = 0;
+            }
+            UNLOCK_QUEUES(queueData);
+        }
+        simDelay(OVERFLOW_RETRY_MS);
+    }
+    return NULL;
+}
+
+void printOverflowStats(QueueData *queueData)
+{
+    OverflowStats *overflow = &queueData->overflow;
+    SDL_Log("Lane capacity %d, overflow policy %s, reader blocked %ld ms", queueData->laneCapacity,
+            overflowPolicyName(queueData->overflowPolicy), overflow->blockedMs);
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        SDL_Log("  lane %c: %ld dropped, %ld spilled, %ld re-admitted, %ld still spooled", 'A' + lane,
+                overflow->dropped[lane], overflow->spilled[lane], overflow->readmitted[lane],
+                overflow->spoolPending[lane]);
+    }
+}
+
+//Append one lane metrics record to the history ring every intervalMs. The
+//record is filled under the mutex and written to the mapping after releasing
+//it, so a slow page fault on the file never holds up the main loop.
+void *sampleHistory(void *arg)
+{
+    HistorySampler *sampler = (HistorySampler *)arg;
+    QueueData *queueData = sampler->queueData;
+    traceThread("history");
+    Queue *queues[QUEUED_LANE_COUNT];
+    laneQueues(queueData, queues);
+    Uint32 nextSample = simTicks();
+
+    while (1)
+    {
+        LaneHistoryRecord record = {0};
+        struct timespec wall;
+        clock_gettime(CLOCK_REALTIME, &wall);
+        record.wallMs = (uint64_t)wall.tv_sec * 1000 + wall.tv_nsec / 1000000;
+
+        LOCK_QUEUES(queueData);
+        record.ticksMs = simTicks();
+        record.activeLane = queueData->activeLane;
+        record.greenMovements = queueData->greenMovements;
+        record.priorityMode = queueData->priorityMode;
+        record.frameMs = queueData->frameMs > UINT16_MAX ? UINT16_MAX : queueData->frameMs;
+        for (int lane = 0; lane < QUEUED_LANE_COUNT; lane++) {
+            record.waiting[lane] = getWaitingVehicleCount(queues[lane]);
+            record.arrivals[lane] = queueData->counters.arrivals[lane];
+            record.departures[lane] = queueData->counters.departures[lane];
+        }
+        UNLOCK_QUEUES(queueData);
+        laneHistoryAppend(sampler->history, &record);
+
+        //fixed schedule, so a late sample does not push back every later one
+        nextSample += sampler->intervalMs;
+        Uint32 now = simTicks();
+        if ((int32_t)(nextSample - now) > 0) {
+            simDelay(nextSample - now);
+        } else {
+            nextSample = now;
+        }
+    }
+    return NULL;
+}
+
+//--history-dump: print every record still in a history file as CSV. Only maps
+//the file, so it works on a live simulator's history as well as a dead one's.
+int dumpHistory(const char *path)
+{
+    LaneHistory *history = laneHistoryMap(path);
+    if (!history) {
+        fprintf(stderr, "cannot read history file %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    printf("sequence,wall_ms,ticks_ms,active_lane,green_movements,priority_mode,frame_ms");
+    const char *columns[] = {"waiting", "arrivals", "departures"};
+    for (int column = 0; column < 3; column++) {
+        for (int lane = 0; lane < QUEUED_LANE_COUNT; lane++) {
+            printf(",%s_%c", columns[column], laneRoad(lane));
+        }
+    }
+    printf("\n");
+
+    uint64_t head = atomic_load_explicit(&history->head, memory_order_acquire);
+    uint64_t first = head > history->capacity ? head - history->capacity : 0;
+    long skipped = 0;
+    for (uint64_t index = first; index < head; index++) {
+        LaneHistoryRecord record;
+        if (!laneHistoryRead(history, index, &record)) {
+            skipped++;  //overwritten while we were reading
+            continue;
+        }
+        printf("%llu,%llu,%u,%d,0x%x,%u,%u", (unsigned long long)record.sequence,
+               (unsigned long long)record.wallMs, record.ticksMs, record.activeLane,
+               record.greenMovements, record.priorityMode, record.frameMs);
+        for (int lane = 0; lane < QUEUED_LANE_COUNT; lane++) printf(",%d", record.waiting[lane]);
+        for (int lane = 0; lane < QUEUED_LANE_COUNT; lane++) printf(",%llu", (unsigned long long)record.arrivals[lane]);
+        for (int lane = 0; lane < QUEUED_LANE_COUNT; lane++) printf(",%llu", (unsigned long long)record.departures[lane]);
+        printf("\n");
+    }
+    if (skipped > 0) {
+        fprintf(stderr, "%ld records were overwritten while reading\n", skipped);
+    }
+    laneHistoryUnmap(history);
+    return 0;
+}
+
+//Parse and enqueue every complete record in buffer[0..available), move a torn
+//record at the end to the front of buffer and return its length
+static size_t ingestBuffer(QueueData *queueData, char *buffer, size_t available)
+{
+    static VehicleRecord records[PARSE_BATCH_RECORDS];
+    size_t consumed = 0;
+    int count;
+    do {
+        consumed += scanVehicleRecords(buffer + consumed, available - consumed,
+                                       records, PARSE_BATCH_RECORDS, &count);
+        if (count > 0) {
+            enqueueRecords(queueData, records, count);
+        }
+    } while (count == PARSE_BATCH_RECORDS);
+
+    size_t carry = available - consumed;
+    if (carry == READ_BUFFER_SIZE) {
+        SDL_Log("dropping %zu bytes without a line break", carry);
+        carry = 0;
+    }
+    memmove(buffer, buffer + consumed, carry);
+    return carry;
+}
+
+//Rename an fsync'd tmpPath over path and fsync the directory so the rename
+//itself survives a crash
+static bool replaceFileDurably(const char *tmpPath, const char *path)
+{
+    if (rename(tmpPath, path) != 0) return false;
+
+    char dir[512];
+    const char *slash = strrchr(path, '/');
+    if (slash) {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    } else {
+        snprintf(dir, sizeof(dir), ".");
+    }
+    int dirFd = open(dir[0] ? dir : "/", O_RDONLY);
+    if (dirFd >= 0) {
+        fsync(dirFd);
+        close(dirFd);
+    }
+    return true;
+}
+
+bool loadCheckpoint(ReadCheckpoint *checkpoint)
+{
+    snprintf(checkpoint->path, sizeof(checkpoint->path), "%s.ckpt", VEHICLE_FILE);
+    checkpoint->segment = 0;
+    checkpoint->offset = 0;
+    checkpoint->inode = 0;
+    checkpoint->savedSegment = -1;
+    checkpoint->savedOffset = -1;
+    checkpoint->lastSaveTicks = 0;
+
+    FILE *file = fopen(checkpoint->path, "r");
+    if (!file) return false;
+    int version = 0;
+    int fields = fscanf(file, "vehicles-checkpoint %d %ld %ld %lu", &version,
+                        &checkpoint->segment, &checkpoint->offset, &checkpoint->inode);
+    fclose(file);
+    if (fields != 4 || version != CHECKPOINT_VERSION || checkpoint->segment < 0 || checkpoint->offset < 0) {
+        SDL_Log("ignoring unreadable checkpoint '%s'", checkpoint->path);
+        checkpoint->segment = checkpoint->offset = 0;
+        checkpoint->inode = 0;
+        return false;
+    }
+    checkpoint->savedSegment = checkpoint->segment;
+    checkpoint->savedOffset = checkpoint->offset;
+    return true;
+}
+
+//Persist the read position if it moved and intervalMs has passed (0 forces it).
+//Written to a temporary file, fsync'd and renamed so a crash leaves either the
+//old or the new checkpoint, never a torn one.
+void saveCheckpoint(ReadCheckpoint *checkpoint, int intervalMs)
+{
+    Uint32 now = SDL_GetTicks();
+    if (checkpoint->segment == checkpoint->savedSegment && checkpoint->offset == checkpoint->savedOffset) return;
+    if (intervalMs > 0 && now - checkpoint->lastSaveTicks < (Uint32)intervalMs) return;
+
+    char tmpPath[sizeof(checkpoint->path) + 8];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", checkpoint->path);
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        SDL_Log("failed to write checkpoint '%s': %s", tmpPath, strerror(errno));
+        return;
+    }
+    char line[128];
+    int len = snprintf(line, sizeof(line), "vehicles-checkpoint %d %ld %ld %lu\n", CHECKPOINT_VERSION,
+                       checkpoint->segment, checkpoint->offset, checkpoint->inode);
+    bool ok = write(fd, line, len) == len && fsync(fd) == 0;
+    close(fd);
+    if (!ok || !replaceFileDurably(tmpPath, checkpoint->path)) {
+        SDL_Log("failed to write checkpoint '%s': %s", checkpoint->path, strerror(errno));
+        return;
+    }
+    checkpoint->savedSegment = checkpoint->segment;
+    checkpoint->savedOffset = checkpoint->offset;
+    checkpoint->lastSaveTicks = now;
+}
+
+//Offset just past the last complete record in the first size bytes of fd,
+//so starting at the tail never begins in the middle of a line
+static off_t lastRecordBoundary(int fd, off_t size)
+{
+    char window[4096];
+    off_t start = size > (off_t)sizeof(window) ? size - (off_t)sizeof(window) : 0;
+    ssize_t bytes = pread(fd, window, size - start, start);
+    for (ssize_t i = bytes - 1; i >= 0; i--) {
+        if (window[i] == '\n') return start + i + 1;
+    }
+    return start;
+}
+
+//Record how far the reader has enqueued, for snapshots taken under the same mutex
+static void publishReadPosition(QueueData *queueData, long segment, long offset, unsigned long inode)
+{
+    LOCK_QUEUES(queueData);
+    queueData->ingested.segment = segment;
+    queueData->ingested.offset = offset;
+    queueData->ingested.inode = inode;
+    UNLOCK_QUEUES(queueData);
+}
+
+//Tail the vehicle file with large reads. A partial line at the end of a read
+//stays at the front of the buffer and is completed by the next read.
+void *readAndParseFile(void *arg)
+{
+    QueueData *queueData = (QueueData *)arg;
+    traceThread("reader");
+    static char buffer[READ_BUFFER_SIZE];
+    size_t carry = 0;     //bytes of a torn record kept at the front of buffer
+    off_t filePos = 0;    //file offset of the next byte to read
+    ino_t inode = 0;
+    int fd = -1;
+    ReadCheckpoint checkpoint;
+
+    bool hasCheckpoint = loadCheckpoint(&checkpoint);
+    StartMode startMode = queueData->startMode == START_AUTO ? START_REPLAY : queueData->startMode;
+
+    while (1)
+    {
+        if (fd < 0) {
+            fd = open(VEHICLE_FILE, O_RDONLY);
+            if (fd < 0)
+            {
+                SDL_Log("waiting for vehicle file '%s'...", VEHICLE_FILE);
+                simDelay(FILE_WAIT_INTERVAL_MS);
+                continue;
+            }
+            struct stat st;
+            fstat(fd, &st);
+            if (inode == 0) {
+                //First open: pick the starting point in whatever backlog is already there
+                ReadPosition *restored = &queueData->ingested;
+                if (queueData->resumeFromSnapshot && restored->segment == 0 &&
+                    restored->inode == (unsigned long)st.st_ino && restored->offset <= st.st_size) {
+                    filePos = restored->offset;
+                    SDL_Log("resuming '%s' at snapshot offset %ld", VEHICLE_FILE, (long)filePos);
+                } else if (startMode == START_TAIL) {
+                    filePos = lastRecordBoundary(fd, st.st_size);
+                    SDL_Log("starting at the tail of '%s', skipping %ld bytes", VEHICLE_FILE, (long)filePos);
+                } else if (startMode == START_CHECKPOINT) {
+                    if (hasCheckpoint && checkpoint.segment == 0 && checkpoint.inode == (unsigned long)st.st_ino &&
+                        checkpoint.offset <= st.st_size) {
+                        filePos = checkpoint.offset;
+                        SDL_Log("resuming '%s' at checkpoint offset %ld", VEHICLE_FILE, (long)filePos);
+                    } else {
+                        SDL_Log("no usable checkpoint for '%s', replaying from the start", VEHICLE_FILE);
+                    }
+                }
+            } else if (st.st_ino != inode || st.st_size < filePos) {
+                SDL_Log("vehicle file '%s' was replaced, reading from the start", VEHICLE_FILE);
+                filePos = 0;
+                carry = 0;
+            }
+            inode = st.st_ino;
+            lseek(fd, filePos, SEEK_SET);
+        }
+
+        uint64_t span = traceBegin();
+        ssize_t bytesRead = read(fd, buffer + carry, sizeof(buffer) - carry);
+        traceSpan("reader", "read", span, "bytes", bytesRead);
+        if (bytesRead <= 0) {
+            //Caught up; reopen if the file was removed, replaced or truncated
+            struct stat st;
+            if (stat(VEHICLE_FILE, &st) != 0 || st.st_ino != inode || st.st_size < filePos) {
+                close(fd);
+                fd = -1;
+                continue;
+            }
+            saveCheckpoint(&checkpoint, queueData->checkpointIntervalMs);
+            simDelay(FILE_POLL_INTERVAL_MS);
+            continue;
+        }
+        filePos += bytesRead;
+        carry = ingestBuffer(queueData, buffer, carry + bytesRead);
+
+        checkpoint.segment = 0;
+        checkpoint.offset = filePos - carry;
+        checkpoint.inode = inode;
+        publishReadPosition(queueData, 0, checkpoint.offset, inode);
+        saveCheckpoint(&checkpoint, queueData->checkpointIntervalMs);
+    }
+    return NULL;
+}
+
+//Read the segmented arrival log written by traffic_gen --segment-size.
+//Resumes from the checkpoint in constant time, and deletes each segment once
+//the checkpoint has durably moved past it, so disk use stays bounded by the
+//backlog rather than the whole history.
+void *readSegmentedLog(void *arg)
+{
+    QueueData *queueData = (QueueData *)arg;
+    traceThread("reader");
+    static char buffer[READ_BUFFER_SIZE];
+    size_t carry = 0;
+    long readPos = 0;      //offset of the next byte to read from the segment
+    bool recheck = false;  //next segment seen, read the current one once more before leaving it
+    int fd = -1;
+    ReadCheckpoint checkpoint;
+    char path[512];
+
+    StartMode startMode = queueData->startMode == START_AUTO ? START_CHECKPOINT : queueData->startMode;
+    bool hasCheckpoint = loadCheckpoint(&checkpoint);
+    if (queueData->resumeFromSnapshot && queueData->ingested.segment > 0) {
+        checkpoint.segment = queueData->ingested.segment;
+        checkpoint.offset = queueData->ingested.offset;
+        startMode = START_CHECKPOINT;
+        SDL_Log("resuming segmented log at snapshot segment %ld offset %ld", checkpoint.segment, checkpoint.offset);
+    } else if (hasCheckpoint && checkpoint.segment > 0 && startMode == START_CHECKPOINT) {
+        SDL_Log("resuming segmented log at segment %ld offset %ld", checkpoint.segment, checkpoint.offset);
+    } else {
+        checkpoint.segment = 0;  //replay from the lowest segment still on disk
+        checkpoint.offset = 0;
+    }
+    checkpoint.inode = 0;
+    bool seekTail = startMode == START_TAIL;
+
+    while (1)
+    {
+        if (fd < 0) {
+            long lowest, highest;
+            if (!segmentRange(VEHICLE_FILE, &lowest, &highest)) {
+                SDL_Log("waiting for vehicle log segments '%s.*'...", VEHICLE_FILE);
+                simDelay(FILE_WAIT_INTERVAL_MS);
+                continue;
+            }
+            if (seekTail) {
+                checkpoint.segment = highest;
+                checkpoint.offset = -1;  //resolved once the segment is open
+            } else if (checkpoint.segment < lowest || checkpoint.segment > highest) {
+                if (checkpoint.segment != 0) {
+                    SDL_Log("segment %ld is gone, continuing from segment %ld", checkpoint.segment, lowest);
+                }
+                checkpoint.segment = lowest;
+                checkpoint.offset = 0;
+            }
+            segmentPath(path, sizeof(path), VEHICLE_FILE, checkpoint.segment);
+            fd = open(path, O_RDONLY);
+            if (fd < 0) {
+                simDelay(FILE_POLL_INTERVAL_MS);
+                continue;
+            }
+            if (seekTail) {
+                struct stat st;
+                fstat(fd, &st);
+                checkpoint.offset = lastRecordBoundary(fd, st.st_size);
+                SDL_Log("starting at the tail of segment %ld offset %ld", checkpoint.segment, checkpoint.offset);
+                seekTail = false;
+            }
+            readPos = lseek(fd, checkpoint.offset, SEEK_SET);
+            carry = 0;
+            recheck = false;
+        }
+
+        uint64_t span = traceBegin();
+        ssize_t bytesRead = read(fd, buffer + carry, sizeof(buffer) - carry);
+        traceSpan("reader", "read", span, "bytes", bytesRead);
+        if (bytesRead > 0) {
+            readPos += bytesRead;
+            carry = ingestBuffer(queueData, buffer, carry + bytesRead);
+            checkpoint.offset = readPos - carry;
+            publishReadPosition(queueData, checkpoint.segment, checkpoint.offset, 0);
+            saveCheckpoint(&checkpoint, queueData->checkpointIntervalMs);
+            recheck = false;
+            continue;
+        }
+
+        //At the end of this segment. The generator only creates the next one
+        //after its last write to this one, so one more empty read after seeing
+        //the next segment means this one is complete. If the next one is gone
+        //already (traffic_gen -k deleted it while we were behind), any later
+        //segment shows this one is complete just the same.
+        long next = checkpoint.segment + 1;
+        long highest;
+        if (!segmentExists(VEHICLE_FILE, next) &&
+            !segmentRangeAbove(VEHICLE_FILE, checkpoint.segment, &next, &highest)) {
+            saveCheckpoint(&checkpoint, queueData->checkpointIntervalMs);
+            simDelay(FILE_POLL_INTERVAL_MS);
+            continue;
+        }
+        if (!recheck) {
+            recheck = true;
+            continue;
+        }
+
+        if (carry > 0) {
+            SDL_Log("discarding %zu byte torn record at the end of segment %ld", carry, checkpoint.segment);
+        }
+        close(fd);
+        fd = -1;
+        long finished = checkpoint.segment;
+        if (next > finished + 1) {
+            SDL_Log("segments %ld to %ld are gone, continuing from segment %ld", finished + 1, next - 1, next);
+        }
+        checkpoint.segment = next;
+        checkpoint.offset = 0;
+        publishReadPosition(queueData, checkpoint.segment, 0, 0);
+        saveCheckpoint(&checkpoint, 0);
+        segmentPath(path, sizeof(path), VEHICLE_FILE, finished);
+        if (unlink(path) != 0) {
+            SDL_Log("failed to delete consumed segment '%s': %s", path, strerror(errno));
+        }
+    }
+    return NULL;
+}
+
+//Consume arrivals straight from the shared-memory ring written by
+//traffic_generator --shm. Records are enqueued from the ring slots in place,
+//and the thread sleeps on the ring's futex whenever it is empty.
+void *readFromRing(void *arg)
+{
+    QueueData *queueData = (QueueData *)arg;
+    traceThread("reader");
+    static VehicleRecord records[PARSE_BATCH_RECORDS];
+    VehicleRing *ring;
+
+    while ((ring = vehicleRingAttach(queueData->ringName, VEHICLE_RING_DEFAULT_CAPACITY)) == NULL) {
+        SDL_Log("waiting for vehicle ring '%s': %s", queueData->ringName, strerror(errno));
+        sleep(2);
+    }
+    SDL_Log("reading arrivals from shared-memory ring '%s' (%u slots)", queueData->ringName, ring->capacity);
+
+    uint32_t mask = ring->capacity - 1;
+    long received = 0;
+    uint64_t latencySumNs = 0, latencyMaxNs = 0;
+    Uint32 lastReport = SDL_GetTicks();
+
+    while (1)
+    {
+        uint64_t first;
+        uint32_t available = vehicleRingPeek(ring, &first);
+        if (available == 0) {
+            vehicleRingWaitForData(ring);
+        } else {
+            if (available > PARSE_BATCH_RECORDS) available = PARSE_BATCH_RECORDS;
+
+            uint64_t now = vehicleRingNowNs();
+            for (uint32_t i = 0; i < available; i++) {
+                const VehicleRingRecord *slot = &ring->records[(first + i) & mask];
+                records[i].plate = slot->plate;
+                records[i].plateLength = (int)strnlen(slot->plate, sizeof(slot->plate));
+                records[i].road = slot->road;
+
+                uint64_t latency = now - slot->producedNs;
+                latencySumNs += latency;
+                if (latency > latencyMaxNs) latencyMaxNs = latency;
+            }
+            enqueueRecords(queueData, records, available);
+            vehicleRingConsume(ring, available);
+            received += available;
+        }
+
+        Uint32 ticks = SDL_GetTicks();
+        if (ticks - lastReport >= RING_STATS_INTERVAL_MS && received > 0) {
+            SDL_Log("ring: %ld arrivals, latency avg %.1f us max %.1f us", received,
+                    latencySumNs / 1000.0 / received, latencyMaxNs / 1000.0);
+            received = 0;
+            latencySumNs = latencyMaxNs = 0;
+            lastReport = ticks;
+        }
+    }
+    return NULL;
+}
+
+//Snapshot file layout: SnapshotHeader, then every queued vehicle as a
+//SnapshotVehicle, in laneQueues order, each lane front to rear
+typedef struct {
+    uint64_t plate;          //packPlate() form
+    char road;
+    uint8_t flags;           //SNAPSHOT_* bits
+    uint8_t turnDirection;
+    uint8_t reserved[5];
+    float x, y;
+    float targetX, targetY;
+    uint32_t ageMs;          //time since arrival; SDL ticks restart with the process
+} SnapshotVehicle;
+
+#define SNAPSHOT_MOVING 0x01
+#define SNAPSHOT_CROSSED 0x02
+#define SNAPSHOT_TURNING 0x04
+#define SNAPSHOT_COMPLETED_TURN 0x08
+#define SNAPSHOT_BACKLOG 0x10        //plate and age only, restored into the lane backlog
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vehicleSize;    //sizeof(SnapshotVehicle)
+    uint32_t laneCount;      //QUEUED_LANE_COUNT
+    int32_t currentLane;
+    int32_t priorityMode;
+    int32_t activeLane;
+    uint32_t greenMovements;
+    int32_t greenRemainingMs;
+    int32_t queueSizes[QUEUED_LANE_COUNT];
+    int64_t readSegment;
+    int64_t readOffset;
+    uint64_t readInode;
+    int64_t spoolReadPos[LANE_COUNT];  //OverflowStats spool state, all 0 without --overflow spill
+    int64_t spoolPending[LANE_COUNT];
+    int64_t spoolBytes[LANE_COUNT];
+} SnapshotHeader;
+
+//Write the whole simulation state to path. The state is copied straight into
+//a mapping of a temporary file under the mutex, then flushed, fsync'd and
+//renamed over path outside it, so a crash leaves the previous snapshot intact.
+bool saveSnapshot(QueueData *queueData, const char *path)
+{
+    Queue *queues[QUEUED_LANE_COUNT];
+    laneQueues(queueData, queues);
+    char tmpPath[512];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    double start = benchSeconds();
+
+    int fd = open(tmpPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        SDL_Log("failed to write snapshot '%s': %s", tmpPath, strerror(errno));
+        return false;
+    }
+
+    LOCK_QUEUES(queueData);
+    long vehicles = 0;
+    for (int q = 0; q < QUEUED_LANE_COUNT; q++) {
+        vehicles += getQueueSize(queues[q]);
+    }
+    size_t bytes = sizeof(SnapshotHeader) + vehicles * sizeof(SnapshotVehicle);
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, bytes) == 0) {
+        map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (map == MAP_FAILED) {
+        UNLOCK_QUEUES(queueData);
+        SDL_Log("failed to map snapshot '%s': %s", tmpPath, strerror(errno));
+        close(fd);
+        unlink(tmpPath);
+        return false;
+    }
+
+    Uint32 now = simTicks();
+    SnapshotHeader *header = (SnapshotHeader *)map;
+    header->magic = SNAPSHOT_MAGIC;
+    header->version = SNAPSHOT_VERSION;
+    header->vehicleSize = sizeof(SnapshotVehicle);
+    header->laneCount = QUEUED_LANE_COUNT;
+    header->currentLane = queueData->currentLane;
+    header->priorityMode = queueData->priorityMode;
+    header->activeLane = queueData->activeLane;
+    header->greenMovements = queueData->greenMovements;
+    header->greenRemainingMs = queueData->greenMovements && (Sint32)(queueData->greenEndTicks - now) > 0 ?
+                               (int32_t)(queueData->greenEndTicks - now) : 0;
+    header->readSegment = queueData->ingested.segment;
+    header->readOffset = queueData->ingested.offset;
+    header->readInode = queueData->ingested.inode;
+    for (int q = 0; q < QUEUED_LANE_COUNT; q++) {
+        header->queueSizes[q] = getQueueSize(queues[q]);
+    }
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        header->spoolReadPos[lane] = queueData->overflow.spoolReadPos[lane];
+        header->spoolPending[lane] = queueData->overflow.spoolPending[lane];
+        header->spoolBytes[lane] = queueData->overflow.spoolBytes[lane];
+    }
+
+    SnapshotVehicle *out = (SnapshotVehicle *)(header + 1);
+    for (int q = 0; q < QUEUED_LANE_COUNT; q++) {
+        for (VehicleNode *node = queues[q]->front; node != NULL; node = nextVehicle(node), out++) {
+            out->plate = node->plate;
+            out->road = node->road;
+            out->flags = (node->isMoving ? SNAPSHOT_MOVING : 0) | (node->hasCrossed ? SNAPSHOT_CROSSED : 0) |
+                         (node->isTurning ? SNAPSHOT_TURNING : 0) | (node->hasCompletedTurn ? SNAPSHOT_COMPLETED_TURN : 0);
+            out->turnDirection = node->turnDirection;
+            memset(out->reserved, 0, sizeof(out->reserved));
+            out->x = fromCoord(node->x);
+            out->y = fromCoord(node->y);
+            out->targetX = fromCoord(node->targetX);
+            out->targetY = fromCoord(node->targetY);
+            out->ageMs = vehicleWaitedMs(node, now);
+        }
+        for (size_t i = 0; i < queues[q]->backlog.count; i++, out++) {
+            BackloggedVehicle *vehicle = backlogAt(&queues[q]->backlog, i);
+            memset(out, 0, sizeof(*out));
+            out->plate = vehicle->plate;
+            out->road = laneRoad(q);
+            out->flags = SNAPSHOT_BACKLOG;
+            out->ageMs = now - vehicle->arrivalTicks;
+        }
+    }
+    UNLOCK_QUEUES(queueData);
+    double lockedMs = (benchSeconds() - start) * 1e3;
+
+    bool ok = msync(map, bytes, MS_SYNC) == 0;
+    munmap(map, bytes);
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+    if (!ok || !replaceFileDurably(tmpPath, path)) {
+        SDL_Log("failed to write snapshot '%s': %s", path, strerror(errno));
+        unlink(tmpPath);
+        return false;
+    }
+    SDL_Log("snapshot '%s': %ld vehicles, %zu KB in %.1f ms (%.1f ms holding the queues)",
+            path, vehicles, bytes / 1024, (benchSeconds() - start) * 1e3, lockedMs);
+    return true;
+}
+
+//Restore a snapshot written by saveSnapshot into empty queues. The file is
+//mapped read-only and each vehicle is rebuilt directly into a pool node.
+//Returns false, leaving the queues untouched, if there is no usable snapshot.
+bool loadSnapshot(QueueData *queueData, const char *path)
+{
+    Queue *queues[QUEUED_LANE_COUNT];
+    laneQueues(queueData, queues);
+    double start = benchSeconds();
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT) SDL_Log("failed to open snapshot '%s': %s", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(SnapshotHeader)) {
+        SDL_Log("ignoring truncated snapshot '%s'", path);
+        close(fd);
+        return false;
+    }
+    size_t bytes = st.st_size;
+    void *map = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        SDL_Log("failed to map snapshot '%s': %s", path, strerror(errno));
+        return false;
+    }
+
+    const SnapshotHeader *header = (const SnapshotHeader *)map;
+    long vehicles = 0;
+    bool valid = header->magic == SNAPSHOT_MAGIC && header->version == SNAPSHOT_VERSION &&
+                 header->vehicleSize == sizeof(SnapshotVehicle) && header->laneCount == QUEUED_LANE_COUNT;
+    for (int q = 0; valid && q < QUEUED_LANE_COUNT; q++) {
+        valid = header->queueSizes[q] >= 0;
+        vehicles += header->queueSizes[q];
+    }
+    if (!valid || bytes != sizeof(SnapshotHeader) + vehicles * sizeof(SnapshotVehicle)) {
+        SDL_Log("ignoring snapshot '%s': wrong version or size", path);
+        munmap(map, bytes);
+        return false;
+    }
+
+    //the controller indexes arrays with these, so check them before taking any
+    valid = header->currentLane >= 0 && header->currentLane < LANE_COUNT &&
+            header->activeLane >= -1 && header->activeLane < LANE_COUNT &&
+            (header->greenMovements >> MOVEMENT_COUNT) == 0 && header->greenRemainingMs >= 0;
+    const SnapshotVehicle *in = (const SnapshotVehicle *)(header + 1);
+    for (int q = 0; valid && q < QUEUED_LANE_COUNT; q++) {
+        for (int i = 0; valid && i < header->queueSizes[q]; i++, in++) {
+            valid = roadLane(in->road) == q;
+        }
+    }
+    if (!valid) {
+        SDL_Log("ignoring snapshot '%s': controller state or vehicle lanes out of range", path);
+        munmap(map, bytes);
+        return false;
+    }
+
+    LOCK_QUEUES(queueData);
+    Uint32 now = simTicks();
+    long restored = 0;
+    const SnapshotVehicle *laneStart = (const SnapshotVehicle *)(header + 1);
+    for (int q = 0; q < QUEUED_LANE_COUNT; laneStart += header->queueSizes[q], q++) {
+        //out of memory drops the rest of this lane, keeping it in order, and
+        //the next lane starts from its own records
+        in = laneStart;
+        for (int i = 0; i < header->queueSizes[q]; i++, in++, restored++) {
+            if (in->flags & SNAPSHOT_BACKLOG) {
+                if (!backlogPush(&queues[q]->backlog, q, in->plate, now - in->ageMs)) {
+                    SDL_Log("out of memory restoring snapshot '%s', lane %c loses %d vehicles",
+                            path, laneRoad(q), header->queueSizes[q] - i);
+                    break;
+                }
+                continue;
+            }
+            VehicleNode *node = allocVehicleNode();
+            if (!node) {
+                SDL_Log("out of memory restoring snapshot '%s', lane %c loses %d vehicles",
+                        path, laneRoad(q), header->queueSizes[q] - i);
+                break;
+            }
+            node->plate = in->plate;
+            node->road = in->road;
+            node->isMoving = in->flags & SNAPSHOT_MOVING;
+            node->hasCrossed = in->flags & SNAPSHOT_CROSSED;
+            node->isTurning = in->flags & SNAPSHOT_TURNING;
+            node->hasCompletedTurn = in->flags & SNAPSHOT_COMPLETED_TURN;
+            node->turnDirection = in->turnDirection < TURN_COUNT ? in->turnDirection : TURN_STRAIGHT;
+            node->x = toCoord(in->x);
+            node->y = toCoord(in->y);
+            node->targetX = toCoord(in->targetX);
+            node->targetY = toCoord(in->targetY);
+            node->arrivalTicks = (now - in->ageMs) & ARRIVAL_TICKS_MASK;
+            node->next = VEHICLE_NONE;
+            plateIndexInsert(node);
+
+            if (queues[q]->rear == NULL) {
+                queues[q]->front = node;
+            } else {
+                setNextVehicle(queues[q]->rear, node);
+            }
+            queues[q]->rear = node;
+            queues[q]->size++;
+        }
+    }
+
+    queueData->currentLane = header->currentLane;
+    queueData->priorityMode = header->priorityMode;
+    queueData->activeLane = header->activeLane;
+    queueData->greenMovements = header->greenMovements;
+    queueData->resumeGreenMs = header->greenRemainingMs;
+    queueData->ingested.segment = header->readSegment;
+    queueData->ingested.offset = header->readOffset;
+    queueData->ingested.inode = header->readInode;
+    for (int lane = 0; queueData->laneCapacity > 0 && queueData->overflowPolicy == OVERFLOW_SPILL && lane < LANE_COUNT; lane++) {
+        queueData->overflow.spoolReadPos[lane] = header->spoolReadPos[lane];
+        queueData->overflow.spoolPending[lane] = header->spoolPending[lane];
+        queueData->overflow.spoolBytes[lane] = header->spoolBytes[lane];
+    }
+    queueData->resumeFromSnapshot = true;
+    UNLOCK_QUEUES(queueData);
+
+    munmap(map, bytes);
+    SDL_Log("restored %ld of %ld vehicles from snapshot '%s' in %.1f ms", restored, vehicles, path,
+            (benchSeconds() - start) * 1e3);
+    return true;
+}
+
+//Copy the state the query API serves into a new LiveState and swap it in.
+//Called by the main loop with queueData->mutex held; queries never take it.
+//Backlogged vehicles are copied as they are, plate and arrival time, straight
+//out of each lane's ring; their position follows from their place in the lane.
+void publishLiveState(QueueData *queueData)
+{
+    Queue *queues[QUEUED_LANE_COUNT];
+    laneQueues(queueData, queues);
+    long total = 0, backlogged = 0;
+    for (int q = 0; q < QUEUED_LANE_COUNT; q++) {
+        total += queues[q]->size;
+        backlogged += queues[q]->backlog.count;
+    }
+    LiveState *state = (LiveState *)malloc(sizeof(LiveState) + total * sizeof(LiveVehicle) +
+                                           backlogged * sizeof(BackloggedVehicle));
+    if (!state) return;
+    state->backlogged = (BackloggedVehicle *)&state->vehicles[total];
+
+    Uint32 now = simTicks();
+    atomic_init(&state->refs, 1);  //the published reference
+    state->publishedTicks = now;
+    state->currentLane = queueData->currentLane;
+    state->priorityMode = queueData->priorityMode;
+    state->activeLane = queueData->activeLane;
+    state->greenMovements = queueData->greenMovements;
+    state->greenRemainingMs = queueData->greenMovements && (Sint32)(queueData->greenEndTicks - now) > 0 ?
+                              (int)(queueData->greenEndTicks - now) : 0;
+    state->oldestIndex = -1;
+
+    long n = 0, b = 0;
+    Uint32 oldestWait = 0;
+    for (int q = 0; q < QUEUED_LANE_COUNT; q++) {
+        bool capped = q < LANE_COUNT;  //only the signalised lanes overflow
+        state->laneVehicles[q] = n;
+        state->laneBacklogged[q] = b;
+        state->waiting[q] = 0;
+        state->queued[q] = getQueueSize(queues[q]);
+        state->dropped[q] = capped ? queueData->overflow.dropped[q] : 0;
+        state->spooled[q] = capped ? queueData->overflow.spoolPending[q] : 0;
+        state->rejected[q] = queueData->counters.rejected[q];
+        for (VehicleNode *node = queues[q]->front; node != NULL && n < total; node = nextVehicle(node), n++) {
+            LiveVehicle *vehicle = &state->vehicles[n];
+            vehicle->plate = node->plate;
+            vehicle->road = node->road;
+            vehicle->crossed = node->hasCrossed;
+            vehicle->x = fromCoord(node->x);
+            vehicle->y = fromCoord(node->y);
+            vehicle->waitedMs = vehicleWaitedMs(node, now);
+            if (!node->hasCrossed) {
+                state->waiting[q]++;
+                if (state->oldestIndex < 0 || vehicle->waitedMs > oldestWait) {
+                    state->oldestIndex = (int)n;
+                    oldestWait = vehicle->waitedMs;
+                }
+            }
+        }
+        state->backlogSlot[q] = state->waiting[q];
+
+        VehicleBacklog *backlog = &queues[q]->backlog;
+        if (backlog->count > 0) {
+            size_t first = backlog->capacity - backlog->head;
+            if (first > backlog->count) first = backlog->count;
+            memcpy(&state->backlogged[b], &backlog->items[backlog->head], first * sizeof(BackloggedVehicle));
+            memcpy(&state->backlogged[b + first], backlog->items, (backlog->count - first) * sizeof(BackloggedVehicle));
+            b += backlog->count;
+        }
+        state->waiting[q] += (int)backlog->count;
+    }
+    state->laneVehicles[QUEUED_LANE_COUNT] = n;
+    state->laneBacklogged[QUEUED_LANE_COUNT] = b;
+    state->vehicleCount = n;
+
+    SDL_LockMutex(queueData->liveStateMutex);
+    LiveState *old = queueData->liveState;
+    queueData->liveState = state;
+    SDL_UnlockMutex(queueData->liveStateMutex);
+    if (old && atomic_fetch_sub(&old->refs, 1) == 1) {
+        free(old);
+    }
+}
+
+static LiveState *acquireLiveState(QueueData *queueData)
+{
+    SDL_LockMutex(queueData->liveStateMutex);
+    LiveState *state = queueData->liveState;
+    if (state) atomic_fetch_add(&state->refs, 1);
+    SDL_UnlockMutex(queueData->liveStateMutex);
+    return state;
+}
+
+static void releaseLiveState(LiveState *state)
+{
+    if (state && atomic_fetch_sub(&state->refs, 1) == 1) {
+        free(state);
+    }
+}
+
+//Growable response buffer
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} QueryReply;
+
+static void replyAppend(QueryReply *reply, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(reply->data + reply->length, reply->capacity - reply->length, format, args);
+    va_end(args);
+    if (needed < 0) return;
+    if (reply->length + needed + 1 > reply->capacity) {
+        size_t capacity = reply->capacity * 2;
+        while (capacity < reply->length + needed + 1) capacity *= 2;
+        char *data = (char *)realloc(reply->data, capacity);
+        if (!data) return;
+        reply->data = data;
+        reply->capacity = capacity;
+        va_start(args, format);
+        vsnprintf(reply->data + reply->length, reply->capacity - reply->length, format, args);
+        va_end(args);
+    }
+    reply->length += needed;
+}
+
+static void replyVehicle(QueryReply *reply, const LiveVehicle *vehicle)
+{
+    replyAppend(reply, "{\"plate\":\"%s\",\"lane\":\"%c\",\"crossed\":%s,\"x\":%.0f,\"y\":%.0f,\"waited_ms\":%u}",
+                plateText(vehicle->plate).text, vehicle->road, vehicle->crossed ? "true" : "false",
+                vehicle->x, vehicle->y, vehicle->waitedMs);
+}
+
+//The i-th published backlogged vehicle, which is in lane q, as the query API shows it
+static LiveVehicle liveBackloggedVehicle(const LiveState *state, int q, long i)
+{
+    const BackloggedVehicle *backlogged = &state->backlogged[i];
+    int slot = state->backlogSlot[q] + (int)(i - state->laneBacklogged[q]);
+    LiveVehicle vehicle = {backlogged->plate, laneRoad(q), false, getStopPositionX(laneRoad(q), slot),
+                           getStopPositionY(laneRoad(q), slot), state->publishedTicks - backlogged->arrivalTicks};
+    return vehicle;
+}
+
+static void replyPhase(QueryReply *reply, const LiveState *state)
+{
+    char movements[40];
+    formatMovements(state->greenMovements, movements, sizeof(movements));
+    if (state->activeLane >= 0) {
+        replyAppend(reply, "\"active_lane\":\"%c\",", 'A' + state->activeLane);
+    } else {
+        replyAppend(reply, "\"active_lane\":null,");
+    }
+    replyAppend(reply, "\"green\":\"%s\",\"remaining_ms\":%d,\"current_lane\":\"%c\"",
+                movements, state->greenRemainingMs, 'A' + state->currentLane);
+}
+
+static void replyLanes(QueryReply *reply, const LiveState *state)
+{
+    replyAppend(reply, "\"lanes\":[");
+    for (int q = 0; q < QUEUED_LANE_COUNT; q++) {
+        replyAppend(reply, "%s{\"lane\":\"%c\",\"waiting\":%d,\"queued\":%d,\"dropped\":%ld,\"spooled\":%ld,\"rejected\":%ld}",
+                    q ? "," : "", laneRoad(q), state->waiting[q], state->queued[q], state->dropped[q], state->spooled[q],
+                    state->rejected[q]);
+    }
+    replyAppend(reply, "]");
+}
+
+static void replyOldest(QueryReply *reply, const LiveState *state)
+{
+    replyAppend(reply, "\"oldest\":");
+    if (state->oldestIndex >= 0) {
+        replyVehicle(reply, &state->vehicles[state->oldestIndex]);
+    } else {
+        replyAppend(reply, "null");
+    }
+}
+
+//Answer one query line from a published state. Queries:
+//state, lanes, phase, priority, oldest, vehicles [LANE], vehicle PLATE
+static void answerQuery(const LiveState *state, const char *line, QueryReply *reply)
+{
+    char command[16] = "", argument[16] = "";
+    sscanf(line, "%15s %15s", command, argument);
+
+    replyAppend(reply, "{\"age_ms\":%u,", simTicks() - state->publishedTicks);
+    if (strcmp(command, "state") == 0) {
+        replyLanes(reply, state);
+        replyAppend(reply, ",");
+        replyPhase(reply, state);
+        replyAppend(reply, ",\"priority_mode\":%d,", state->priorityMode);
+        replyOldest(reply, state);
+    } else if (strcmp(command, "lanes") == 0) {
+        replyLanes(reply, state);
+    } else if (strcmp(command, "phase") == 0) {
+        replyPhase(reply, state);
+    } else if (strcmp(command, "priority") == 0) {
+        replyAppend(reply, "\"priority_mode\":%d", state->priorityMode);
+    } else if (strcmp(command, "oldest") == 0) {
+        replyOldest(reply, state);
+    } else if (strcmp(command, "vehicles") == 0) {
+        char lane = argument[0];
+        replyAppend(reply, "\"vehicles\":[");
+        bool first = true;
+        for (int q = 0; q < QUEUED_LANE_COUNT; q++) {
+            if (lane && laneRoad(q) != lane) continue;
+            for (long i = state->laneVehicles[q]; i < state->laneVehicles[q + 1]; i++) {
+                if (!first) replyAppend(reply, ",");
+                replyVehicle(reply, &state->vehicles[i]);
+                first = false;
+            }
+            for (long i = state->laneBacklogged[q]; i < state->laneBacklogged[q + 1]; i++) {
+                LiveVehicle vehicle = liveBackloggedVehicle(state, q, i);
+                if (!first) replyAppend(reply, ",");
+                replyVehicle(reply, &vehicle);
+                first = false;
+            }
+        }
+        replyAppend(reply, "]");
+    } else if (strcmp(command, "vehicle") == 0) {
+        uint64_t plate = packPlate(argument, (int)strnlen(argument, PLATE_LENGTH));
+        replyAppend(reply, "\"vehicle\":");
+        long i = 0;
+        while (i < state->vehicleCount && state->vehicles[i].plate != plate) i++;
+        long backlogged = state->laneBacklogged[QUEUED_LANE_COUNT];
+        long j = 0;
+        if (i == state->vehicleCount) {
+            while (j < backlogged && state->backlogged[j].plate != plate) j++;
+        }
+        if (i < state->vehicleCount) {
+            replyVehicle(reply, &state->vehicles[i]);
+        } else if (j < backlogged) {
+            int q = 0;
+            while (state->laneBacklogged[q + 1] <= j) q++;
+            LiveVehicle vehicle = liveBackloggedVehicle(state, q, j);
+            replyVehicle(reply, &vehicle);
+        } else {
+            replyAppend(reply, "null");
+        }
+    } else {
+        replyAppend(reply, "\"error\":\"unknown query '%s'\"", command);
+    }
+    replyAppend(reply, "}\n");
+}
+
+static bool sendAll(int fd, const char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+//Query server thread: line-based requests over a Unix-domain socket, one JSON
+//object per reply. All answers come from the last published LiveState, so a
+//query costs the simulation nothing beyond the periodic publish.
+void *serveQueries(void *arg)
+{
+    QueueData *queueData = (QueueData *)arg;
+    traceThread("queries");
+    const char *path = queueData->querySocketPath;
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    unlink(path);
+    if (listenFd < 0 || bind(listenFd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(listenFd, QUERY_MAX_CLIENTS) != 0) {
+        SDL_Log("query API disabled, cannot listen on '%s': %s", path, strerror(errno));
+        if (listenFd >= 0) close(listenFd);
+        return NULL;
+    }
+    SDL_Log("query API listening on '%s'", path);
+
+    struct pollfd fds[QUERY_MAX_CLIENTS + 1];
+    char lines[QUERY_MAX_CLIENTS + 1][QUERY_LINE_MAX];
+    size_t lineLengths[QUERY_MAX_CLIENTS + 1];
+    int count = 1;
+    fds[0].fd = listenFd;
+    fds[0].events = POLLIN;
+    QueryReply reply = {malloc(4096), 0, 4096};
+
+    while (1)
+    {
+        //While every client slot is taken, leave pending connections in the
+        //backlog; polling for them would wake this thread without end
+        fds[0].events = count <= QUERY_MAX_CLIENTS ? POLLIN : 0;
+        if (poll(fds, count, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            int clientFd = accept(listenFd, NULL, NULL);
+            if (clientFd >= 0) {
+                struct timeval timeout = {1, 0};  //a stalled reader can't hold up the others for long
+                setsockopt(clientFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                fds[count].fd = clientFd;
+                fds[count].events = POLLIN;
+                fds[count].revents = 0;
+                lineLengths[count] = 0;
+                count++;
+            }
+        }
+
+        for (int i = 1; i < count; i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            char *line = lines[i];
+            ssize_t bytes = recv(fds[i].fd, line + lineLengths[i], QUERY_LINE_MAX - 1 - lineLengths[i], 0);
+            bool open = bytes > 0;
+            if (open) lineLengths[i] += bytes;
+
+            //Answer every complete line received so far
+            char *newline;
+            while (open && (newline = memchr(line, '\n', lineLengths[i])) != NULL) {
+                *newline = '\0';
+                LiveState *state = acquireLiveState(queueData);
+                reply.length = 0;
+                if (state) {
+                    answerQuery(state, line, &reply);
+                } else {
+                    replyAppend(&reply, "{\"error\":\"no state published yet\"}\n");
+                }
+                releaseLiveState(state);
+                open = sendAll(fds[i].fd, reply.data, reply.length);
+
+                size_t used = newline - line + 1;
+                lineLengths[i] -= used;
+                memmove(line, newline + 1, lineLengths[i]);
+            }
+            if (open && lineLengths[i] == QUERY_LINE_MAX - 1) {
+                open = false;  //overlong query
+            }
+            if (!open) {
+                close(fds[i].fd);
+                count--;
+                fds[i] = fds[count];
+                memcpy(lines[i], lines[count], lineLengths[count]);
+                lineLengths[i] = lineLengths[count];
+                i--;
+            }
+        }
+    }
+    free(reply.data);
+    close(listenFd);
+    return NULL;
+}
+
+static int lockHistogramBucket(uint64_t ns)
+{
+    int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+    return bucket < LOCK_HISTOGRAM_BUCKETS ? bucket : LOCK_HISTOGRAM_BUCKETS - 1;
+}
+
+//Take queueData->mutex for site. A contended wait is traced, and with
+//--lock-profile every acquisition is added to the site's wait histogram.
+void lockQueues(QueueData *queueData, LockSite *site)
+{
+    if (!traceEnabled && !lockProfileEnabled) {
+        SDL_LockMutex(queueData->mutex);
+        return;
+    }
+    uint64_t start = vehicleRingNowNs();
+    bool contended = SDL_TryLockMutex(queueData->mutex) != 0;
+    if (contended) {
+        SDL_LockMutex(queueData->mutex);
+        traceSpan("lock", site->function, start, "line", site->line);
+    }
+    if (!lockProfileEnabled) return;
+
+    uint64_t acquired = contended ? vehicleRingNowNs() : start;
+    uint64_t waitNs = acquired - start;
+    if (!site->registered) {
+        site->registered = true;
+        site->nextSite = lockSites;
+        lockSites = site;
+    }
+    site->acquisitions++;
+    if (contended) site->contended++;
+    site->totalWaitNs += waitNs;
+    if (waitNs > site->maxWaitNs) site->maxWaitNs = waitNs;
+    site->waitHistogram[lockHistogramBucket(waitNs)]++;
+    lockHolder = site;
+    lockAcquiredNs = acquired;
+}
+
+//Release queueData->mutex, charging the hold to the site that took it and
+//logging holds past the threshold
+void unlockQueues(QueueData *queueData)
+{
+    LockSite *site = lockHolder;
+    if (!lockProfileEnabled || !site) {
+        SDL_UnlockMutex(queueData->mutex);
+        return;
+    }
+    uint64_t holdNs = vehicleRingNowNs() - lockAcquiredNs;
+    bool longHold = holdNs >= lockHoldThresholdNs;
+    lockHolder = NULL;
+    site->totalHoldNs += holdNs;
+    if (holdNs > site->maxHoldNs) site->maxHoldNs = holdNs;
+    site->holdHistogram[lockHistogramBucket(holdNs)]++;
+    if (longHold) site->longHolds++;
+    SDL_UnlockMutex(queueData->mutex);
+
+    if (longHold) {
+        SDL_Log("queue mutex held %.1f ms by %s:%d (threshold %.0f ms)", holdNs / 1e6,
+                site->function, site->line, lockHoldThresholdNs / 1e6);
+    }
+}
+
+static void requestLockReport(int signum)
+{
+    (void)signum;
+    lockReportRequested = 1;
+}
+
+//Profile queueData->mutex for the rest of the run. SIGUSR2 asks the main loop
+//for a summary.
+void startLockProfile(int holdThresholdMs)
+{
+    lockHoldThresholdNs = (uint64_t)holdThresholdMs * 1000000ull;
+    lockProfileEnabled = true;
+    signal(SIGUSR2, requestLockReport);
+    SDL_Log("Profiling the queue mutex, holds of %d ms or more are logged (kill -USR2 %d for a summary)",
+            holdThresholdMs, (int)getpid());
+}
+
+//Upper bound of the bucket holding the given fraction of samples, no more
+//than the largest sample, in microseconds
+static double lockHistogramPercentile(const long *histogram, long samples, double fraction, uint64_t maxNs)
+{
+    long rank = (long)ceil(samples * fraction);
+    uint64_t boundNs = maxNs;
+    long seen = 0;
+    for (int bucket = 0; bucket < LOCK_HISTOGRAM_BUCKETS - 1; bucket++) {
+        seen += histogram[bucket];
+        if (seen >= rank && seen > 0) {
+            boundNs = 1ull << bucket;
+            break;
+        }
+    }
+    return (boundNs < maxNs ? boundNs : maxNs) / 1000.0;
+}
+
+//One line per call site, busiest holder first. Takes the mutex directly so
+//the report does not count itself.
+void printLockProfile(QueueData *queueData)
+{
+    if (!lockProfileEnabled) return;
+    LockSite sites[LOCK_REPORT_MAX_SITES];
+    int count = 0;
+    SDL_LockMutex(queueData->mutex);
+    for (LockSite *site = lockSites; site && count < LOCK_REPORT_MAX_SITES; site = site->nextSite) {
+        sites[count++] = *site;
+    }
+    SDL_UnlockMutex(queueData->mutex);
+
+    //insertion sort by total hold time, there are a handful of sites
+    for (int i = 1; i < count; i++) {
+        LockSite site = sites[i];
+        int j = i - 1;
+        for (; j >= 0 && sites[j].totalHoldNs < site.totalHoldNs; j--) sites[j + 1] = sites[j];
+        sites[j + 1] = site;
+    }
+
+    SDL_Log("Queue mutex profile (us; percentiles are power-of-two bucket bounds):");
+    SDL_Log("  %-28s %9s %9s %9s %9s %9s %9s %9s %9s %6s", "site", "locks", "contended",
+            "wait avg", "wait p99", "wait max", "hold avg", "hold p99", "hold max", "long");
+    for (int i = 0; i < count; i++) {
+        LockSite *site = &sites[i];
+        char name[64];
+        snprintf(name, sizeof(name), "%s:%d", site->function, site->line);
+        long n = site->acquisitions;
+        SDL_Log("  %-28s %9ld %9ld %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %6ld", name, n, site->contended,
+                n ? site->totalWaitNs / 1000.0 / n : 0.0, lockHistogramPercentile(site->waitHistogram, n, 0.99, site->maxWaitNs),
+                site->maxWaitNs / 1000.0,
+                n ? site->totalHoldNs / 1000.0 / n : 0.0, lockHistogramPercentile(site->holdHistogram, n, 0.99, site->maxHoldNs),
+                site->maxHoldNs / 1000.0, site->longHolds);
+    }
+}
+
+static void requestTraceDump(int signum)
+{
+    (void)signum;
+    traceDumpRequested = 1;
+}
+
+//Turn tracing on for the rest of the run. SIGUSR1 asks the main loop to write
+//what has been recorded so far to path.
+void startTrace(const char *path)
+{
+    traceStartNs = vehicleRingNowNs();
+    traceEnabled = true;
+    traceThread("main");
+    signal(SIGUSR1, requestTraceDump);
+    SDL_Log("Tracing thread activity to %s (kill -USR1 %d to write it now)", path, (int)getpid());
+}
+
+//Give the calling thread its event buffer. Does nothing unless tracing is on.
+void traceThread(const char *name)
+{
+    if (!traceEnabled || traceLocal) return;
+    int slot = atomic_fetch_add(&traceThreadCount, 1);
+    if (slot >= TRACE_MAX_THREADS) {
+        SDL_Log("trace: more than %d threads, %s is not traced", TRACE_MAX_THREADS, name);
+        return;
+    }
+    TraceBuffer *buffer = (TraceBuffer *)malloc(sizeof(TraceBuffer) + TRACE_EVENTS_PER_THREAD * sizeof(TraceEvent));
+    if (!buffer) return;
+    buffer->threadName = name;
+    buffer->tid = syscall(SYS_gettid);
+    atomic_init(&buffer->count, 0);
+    buffer->fullLogged = false;
+    traceLocal = buffer;
+    traceBuffers[slot] = buffer;
+}
+
+//Record a span from startNs (a traceBegin value) to now on the calling thread.
+//Lock free: only this thread appends to its buffer.
+void traceSpan(const char *category, const char *name, uint64_t startNs, const char *argName, int64_t arg)
+{
+    TraceBuffer *buffer = traceLocal;
+    if (!traceEnabled || !buffer) return;
+    long count = atomic_load_explicit(&buffer->count, memory_order_relaxed);
+    if (count >= TRACE_EVENTS_PER_THREAD) {
+        if (!buffer->fullLogged) {
+            SDL_Log("trace: buffer of thread %s is full, later events are not recorded", buffer->threadName);
+            buffer->fullLogged = true;
+        }
+        return;
+    }
+    TraceEvent *event = &buffer->events[count];
+    event->name = name;
+    event->category = category;
+    event->argName = argName;
+    event->arg = arg;
+    event->startNs = startNs;
+    event->durationNs = vehicleRingNowNs() - startNs;
+    atomic_store_explicit(&buffer->count, count + 1, memory_order_release);
+}
+
+//Write every recorded span as Chrome trace-event JSON ("X" complete events
+//plus thread names), through a temporary file so a reader never sees half a trace
+bool writeTrace(const char *path)
+{
+    if (!traceEnabled) return false;
+    char tmpPath[512];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE *file = fopen(tmpPath, "w");
+    if (!file) {
+        SDL_Log("failed to write trace %s: %s", tmpPath, strerror(errno));
+        return false;
+    }
+
+    int pid = (int)getpid();
+    long total = 0;
+    int threads = atomic_load(&traceThreadCount);
+    if (threads > TRACE_MAX_THREADS) threads = TRACE_MAX_THREADS;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"simulator\"}}", pid);
+    for (int t = 0; t < threads; t++) {
+        TraceBuffer *buffer = traceBuffers[t];
+        if (!buffer) continue;
+        fprintf(file, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+                pid, buffer->tid, buffer->threadName);
+        long count = atomic_load_explicit(&buffer->count, memory_order_acquire);
+        for (long i = 0; i < count; i++) {
+            const TraceEvent *event = &buffer->events[i];
+            fprintf(file, ",\n{\"ph\":\"X\",\"cat\":\"%s\",\"name\":\"%s\",\"pid\":%d,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f",
+                    event->category, event->name, pid, buffer->tid,
+                    (event->startNs - traceStartNs) / 1000.0, event->durationNs / 1000.0);
+            if (event->argName) {
+                fprintf(file, ",\"args\":{\"%s\":%lld}", event->argName, (long long)event->arg);
+            }
+            fputc('}', file);
+        }
+        total += count;
+    }
+    fprintf(file, "\n]}\n");
+
+    bool ok = fflush(file) == 0;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmpPath, path) != 0) {
+        SDL_Log("failed to write trace %s: %s", path, strerror(errno));
+        unlink(tmpPath);
+        return false;
+    }
+    SDL_Log("Wrote %ld trace events from %d threads to %s", total, threads, path);
+    return true;
+}
+
+typedef struct {
+    VehicleRing *ring;   //ring transport, or
+    int fd;              //file transport
+    long records;
+    int rate;            //records per second, 0 for as fast as possible
+    uint64_t *batchNs;   //file transport: when each batch was written
+} TransportBenchProducer;
+
+static void benchSleepUntil(uint64_t deadlineNs)
+{
+    uint64_t now = vehicleRingNowNs();
+    if (deadlineNs > now) {
+        struct timespec ts = {(deadlineNs - now) / 1000000000ull, (deadlineNs - now) % 1000000000ull};
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void *transportBenchProducer(void *arg)
+{
+    TransportBenchProducer *producer = (TransportBenchProducer *)arg;
+    static VehicleRingRecord batch[BENCH_TRANSPORT_BATCH];
+    static char text[BENCH_TRANSPORT_BATCH * 11];
+    uint64_t start = vehicleRingNowNs();
+
+    for (long sent = 0, b = 0; sent < producer->records; b++) {
+        int count = producer->records - sent < BENCH_TRANSPORT_BATCH ? (int)(producer->records - sent) : BENCH_TRANSPORT_BATCH;
+        if (producer->rate > 0) {
+            benchSleepUntil(start + (uint64_t)(sent * 1e9 / producer->rate));
+        }
+        uint64_t now = vehicleRingNowNs();
+        for (int i = 0; i < count; i++) {
+            memcpy(batch[i].plate, "BN1CH000", 8);
+            batch[i].road = 'A' + i % 4;
+            batch[i].producedNs = now;
+            memcpy(text + i * 11, "BN1CH000:A\n", 11);
+            text[i * 11 + 9] = 'A' + i % 4;
+        }
+        if (producer->ring) {
+            int pushed = 0;
+            while (pushed < count) {
+                uint32_t n = vehicleRingPush(producer->ring, batch + pushed, count - pushed);
+                if (n == 0) vehicleRingWaitForSpace(producer->ring);
+                pushed += n;
+            }
+        } else {
+            producer->batchNs[b] = now;
+            if (write(producer->fd, text, count * 11) != count * 11) {
+                perror("bench write");
+                break;
+            }
+        }
+        sent += count;
+    }
+    return NULL;
+}
+
+//Push records through the ring or the file and report throughput and
+//producer-to-consumer latency. The file consumer uses the same read loop and
+//poll interval as readAndParseFile.
+static void benchmarkOneTransport(bool useRing, long records, int rate)
+{
+    char name[64];
+    snprintf(name, sizeof(name), useRing ? "/junction_bench_%d" : "/tmp/junction_bench_%d.data", (int)getpid());
+
+    TransportBenchProducer producer = {NULL, -1, records, rate, NULL};
+    int readFd = -1;
+    if (useRing) {
+        shm_unlink(name);
+        producer.ring = vehicleRingAttach(name, VEHICLE_RING_DEFAULT_CAPACITY);
+        if (!producer.ring) {
+            perror("bench ring");
+            return;
+        }
+    } else {
+        producer.fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        readFd = open(name, O_RDONLY);
+        producer.batchNs = calloc(records / BENCH_TRANSPORT_BATCH + 1, sizeof(uint64_t));
+        if (producer.fd < 0 || readFd < 0 || !producer.batchNs) {
+            perror("bench file");
+            return;
+        }
+    }
+
+    pthread_t thread;
+    uint64_t start = vehicleRingNowNs();
+    pthread_create(&thread, NULL, transportBenchProducer, &producer);
+
+    static char buffer[READ_BUFFER_SIZE];
+    static VehicleRecord parsed[PARSE_BATCH_RECORDS];
+    long received = 0;
+    uint64_t latencySum = 0, latencyMax = 0;
+    size_t carry = 0;
+
+    while (received < records) {
+        if (useRing) {
+            uint64_t first;
+            uint32_t available = vehicleRingPeek(producer.ring, &first);
+            if (available == 0) {
+                vehicleRingWaitForData(producer.ring);
+                continue;
+            }
+            uint64_t now = vehicleRingNowNs();
+            uint32_t mask = producer.ring->capacity - 1;
+            for (uint32_t i = 0; i < available; i++) {
+                uint64_t latency = now - producer.ring->records[(first + i) & mask].producedNs;
+                latencySum += latency;
+                if (latency > latencyMax) latencyMax = latency;
+            }
+            vehicleRingConsume(producer.ring, available);
+            received += available;
+        } else {
+            ssize_t n = read(readFd, buffer + carry, sizeof(buffer) - carry);
+            if (n <= 0) {
+                SDL_Delay(FILE_POLL_INTERVAL_MS);
+                continue;
+            }
+            size_t available = carry + n, consumed = 0;
+            int count;
+            do {
+                consumed += scanVehicleRecords(buffer + consumed, available - consumed,
+                                               parsed, PARSE_BATCH_RECORDS, &count);
+                uint64_t now = vehicleRingNowNs();
+                for (int i = 0; i < count; i++, received++) {
+                    uint64_t latency = now - producer.batchNs[received / BENCH_TRANSPORT_BATCH];
+                    latencySum += latency;
+                    if (latency > latencyMax) latencyMax = latency;
+                }
+            } while (count == PARSE_BATCH_RECORDS);
+            carry = available - consumed;
+            memmove(buffer, buffer + consumed, carry);
+        }
+    }
+    double seconds = (vehicleRingNowNs() - start) / 1e9;
+    pthread_join(thread, NULL);
+
+    printf("%-5s %-8s %9ld records  %7.2f M rec/s  latency avg %10.1f us  max %10.1f us\n",
+           useRing ? "ring" : "file", rate ? "paced" : "max", records, records / seconds / 1e6,
+           latencySum / 1000.0 / records, latencyMax / 1000.0);
+
+    if (useRing) {
+        vehicleRingDetach(producer.ring);
+        shm_unlink(name);
+    } else {
+        close(producer.fd);
+        close(readFd);
+        unlink(name);
+        free(producer.batchNs);
+    }
+}
+
+int benchmarkTransport(void)
+{
+    long paced = (long)BENCH_TRANSPORT_RATE * BENCH_TRANSPORT_PACED_MS / 1000;
+    benchmarkOneTransport(true, BENCH_TRANSPORT_RECORDS, 0);
+    benchmarkOneTransport(false, BENCH_TRANSPORT_RECORDS, 0);
+    benchmarkOneTransport(true, paced, BENCH_TRANSPORT_RATE);
+    benchmarkOneTransport(false, paced, BENCH_TRANSPORT_RATE);
+    return 0;
+}
+
+//Measure scanVehicleRecords on a file, feeding it in READ_BUFFER_SIZE reads
+//with the same carry-over as the reader thread
+int benchmarkParser(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *contents = malloc(size > 0 ? size : 1);
+    if (!contents || fread(contents, 1, size, file) != (size_t)size) {
+        fprintf(stderr, "failed to read %s\n", path);
+        fclose(file);
+        free(contents);
+        return 1;
+    }
+    fclose(file);
+
+    static char buffer[READ_BUFFER_SIZE];
+    static VehicleRecord records[PARSE_BATCH_RECORDS];
+    long lines = 0, passes = 0;
+    unsigned long checksum = 0;
+    double start = benchSeconds(), elapsed;
+
+    do {
+        size_t carry = 0;
+        long offset = 0;
+        while (offset < size) {
+            size_t chunk = sizeof(buffer) - carry;
+            if ((long)chunk > size - offset) chunk = size - offset;
+            memcpy(buffer + carry, contents + offset, chunk);
+            offset += chunk;
+
+            size_t available = carry + chunk, consumed = 0;
+            int count;
+            do {
+                consumed += scanVehicleRecords(buffer + consumed, available - consumed,
+                                               records, PARSE_BATCH_RECORDS, &count);
+                lines += count;
+                if (count > 0) checksum += records[count - 1].road + records[count - 1].plateLength;
+            } while (count == PARSE_BATCH_RECORDS);
+            carry = available - consumed;
+            if (carry == sizeof(buffer)) carry = 0;
+            memmove(buffer, buffer + consumed, carry);
+        }
+        passes++;
+        elapsed = benchSeconds() - start;
+    } while (elapsed < 1.0);
+
+    printf("%s: %ld bytes, %ld records per pass, %ld passes\n", path, size, lines / passes, passes);
+    printf("%.1f M lines/s, %.0f MB/s (checksum %lu)\n",
+           lines / elapsed / 1e6, (double)size * passes / elapsed / 1e6, checksum);
+
+    //Startup cost of loading the whole file as a backlog, at the default
+    //micro depth, so most lookups below go through the backlog index
+    SDL_LogSetAllPriority(SDL_LOG_PRIORITY_WARN);
+    Queue queueA, queueB, queueC, queueD;
+    initQueue(&queueA);
+    initQueue(&queueB);
+    initQueue(&queueC);
+    initQueue(&queueD);
+    QueueData queueData = {0};
+    queueData.queueA = &queueA;
+    queueData.queueB = &queueB;
+    queueData.queueC = &queueC;
+    queueData.queueD = &queueD;
+    queueData.mutex = SDL_CreateMutex();
+
+    long loaded = 0;
+    size_t consumed = 0;
+    int count;
+    start = benchSeconds();
+    do {
+        consumed += scanVehicleRecords(contents + consumed, size - consumed,
+                                       records, PARSE_BATCH_RECORDS, &count);
+        enqueueRecords(&queueData, records, count);
+        loaded += count;
+    } while (count == PARSE_BATCH_RECORDS);
+    elapsed = benchSeconds() - start;
+    printf("backlog load: %ld vehicles enqueued in %.1f ms (%.2f M/s)\n",
+           loaded, elapsed * 1e3, loaded / elapsed / 1e6);
+
+    //Plate lookups against the loaded backlog: hash index vs scanning the queues.
+    //Generator lines are a fixed 11 bytes, "LLDLLDDD:R\n", so line n starts at n * 11.
+    if (loaded > 0) {
+        uint32_t seed = 12345;
+        long found = 0;
+        VehicleLocation location;
+        start = benchSeconds();
+        for (long i = 0; i < BENCH_LOOKUPS; i++) {
+            long line = benchRandom(&seed) % (size / 11);
+            found += findVehicle(&queueData, contents + line * 11, &location);
+        }
+        elapsed = benchSeconds() - start;
+        printf("findVehicle: %.0f ns per lookup (%ld of %d found)\n", elapsed * 1e9 / BENCH_LOOKUPS, found, BENCH_LOOKUPS);
+
+        Queue *queues[LANE_COUNT] = {&queueA, &queueB, &queueC, &queueD};
+        start = benchSeconds();
+        for (long i = 0; i < BENCH_SCAN_LOOKUPS; i++) {
+            long line = benchRandom(&seed) % (size / 11);
+            uint64_t plate = packPlate(contents + line * 11, PLATE_LENGTH);
+            bool hit = false;
+            for (int q = 0; q < LANE_COUNT && !hit; q++) {
+                for (VehicleNode *node = queues[q]->front; node != NULL; node = nextVehicle(node)) {
+                    if (node->plate == plate) {
+                        hit = true;
+                        break;
+                    }
+                }
+                for (size_t b = 0; b < queues[q]->backlog.count && !hit; b++) {
+                    hit = backlogAt(&queues[q]->backlog, b)->plate == plate;
+                }
+            }
+            found += hit;
+        }
+        elapsed = benchSeconds() - start;
+        printf("queue scan: %.0f ns per lookup\n", elapsed * 1e9 / BENCH_SCAN_LOOKUPS);
+    }
+
+    freeQueue(&queueA);
+    freeQueue(&queueB);
+    freeQueue(&queueC);
+    freeQueue(&queueD);
+    SDL_DestroyMutex(queueData.mutex);
+    free(contents);
+    return 0;
+}
+
+//Resident set size in bytes, from /proc/self/statm
+static long residentBytes(void)
+{
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        fclose(statm);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+//LLDLLDDD like the generator, numbered so every plate is distinct
+static void benchPlate(long n, char *plate)
+{
+    for (int c = PLATE_LENGTH - 1; c >= 0; c--) {
+        bool digit = c == 2 || c >= 5;
+        plate[c] = digit ? '0' + n % 10 : 'A' + n % 26;
+        n /= digit ? 10 : 26;
+    }
+}
+
+//Queue a synthetic backlog of distinct plates with microscopic depth depth
+//and report the resident memory it added
+static void measureQueueMemory(long vehicles, int depth)
+{
+    Queue queueA, queueB, queueC, queueD;
+    initQueue(&queueA);
+    initQueue(&queueB);
+    initQueue(&queueC);
+    initQueue(&queueD);
+    QueueData queueData = {0};
+    queueData.queueA = &queueA;
+    queueData.queueB = &queueB;
+    queueData.queueC = &queueC;
+    queueData.queueD = &queueD;
+    queueData.mutex = SDL_CreateMutex();
+    microQueueDepth = depth;
+
+    static VehicleRecord records[PARSE_BATCH_RECORDS];
+    static char plates[PARSE_BATCH_RECORDS][PLATE_LENGTH];
+    long before = residentBytes();
+    double start = benchSeconds();
+    if (depth == 0) plateIndexReserve(vehicles);
+    for (long queued = 0; queued < vehicles; ) {
+        int count = 0;
+        for (; count < PARSE_BATCH_RECORDS && queued < vehicles; count++, queued++) {
+            benchPlate(queued, plates[count]);
+            records[count].plate = plates[count];
+            records[count].plateLength = PLATE_LENGTH;
+            records[count].road = 'A' + queued % LANE_COUNT;
+        }
+        enqueueRecords(&queueData, records, count);
+    }
+    double elapsed = benchSeconds() - start;
+    long used = residentBytes() - before;
+
+    if (depth == 0) {
+        printf("all nodes: %ld vehicles queued in %.0f ms\n", vehicles, elapsed * 1e3);
+        printf("  vehicle node: %zu bytes (%s coordinates)\n", sizeof(VehicleNode),
+               sizeof(VehicleCoord) == sizeof(float) ? "float" : "16-bit fixed-point");
+        printf("  plate index: %zu slots, %.1f bytes per vehicle\n", plateIndex.capacity,
+               (double)plateIndex.capacity * sizeof(uint32_t) / vehicles);
+    } else {
+        printf("micro depth %d: %ld vehicles queued in %.0f ms, %d nodes\n", depth, vehicles, elapsed * 1e3,
+               queueA.size + queueB.size + queueC.size + queueD.size);
+        printf("  backlog entry: %zu bytes\n", sizeof(BackloggedVehicle));
+        printf("  backlog index: %zu slots, %.1f bytes per vehicle\n", backlogIndex.capacity,
+               (double)backlogIndex.capacity * sizeof(uint32_t) / vehicles);
+    }
+    printf("  resident: %.1f MB, %.1f bytes per vehicle\n", used / 1e6, (double)used / vehicles);
+
+    freeQueue(&queueA);
+    freeQueue(&queueB);
+    freeQueue(&queueC);
+    freeQueue(&queueD);
+    SDL_DestroyMutex(queueData.mutex);
+}
+
+//What each queued vehicle costs in memory, as a bounded micro queue plus
+//backlog and with every vehicle a node (its node plus its share of the plate index)
+int benchmarkMemory(long vehicles)
+{
+    if (vehicles > VEHICLE_POOL_CAPACITY) {
+        fprintf(stderr, "at most %u vehicles fit in the vehicle pool\n", VEHICLE_POOL_CAPACITY);
+        return 1;
+    }
+    SDL_LogSetAllPriority(SDL_LOG_PRIORITY_WARN);
+    measureQueueMemory(vehicles, DEFAULT_MICRO_DEPTH);
+    measureQueueMemory(vehicles, 0);
+    return 0;
+}
+
+//Drive updateVehicles for a minute of frames with depth vehicles waiting per
+//lane, the backlog topping each lane back up as vehicles leave. The green
+//alternates between the A-B and C-D axes so every lane both queues and drains.
+static void measureUpdate(int depth, long *plateNumber)
+{
+    Queue queueA, queueB, queueC, queueD;
+    initQueue(&queueA);
+    initQueue(&queueB);
+    initQueue(&queueC);
+    initQueue(&queueD);
+    QueueData queueData = {0};
+    queueData.queueA = &queueA;
+    queueData.queueB = &queueB;
+    queueData.queueC = &queueC;
+    queueData.queueD = &queueD;
+    Queue freeLeft[LANE_COUNT];
+    for (int road = 0; road < LANE_COUNT; road++) {
+        initQueue(&freeLeft[road]);
+        queueData.freeLeft[road] = &freeLeft[road];
+    }
+    queueData.mutex = SDL_CreateMutex();
+    microQueueDepth = depth;
+
+    //Enough behind each lane to keep it full for the whole run
+    static VehicleRecord records[PARSE_BATCH_RECORDS];
+    static char plates[PARSE_BATCH_RECORDS][PLATE_LENGTH];
+    long vehicles = (long)(depth + 200) * LANE_COUNT;
+    for (long queued = 0; queued < vehicles; ) {
+        int count = 0;
+        for (; count < PARSE_BATCH_RECORDS && queued < vehicles; count++, queued++) {
+            benchPlate((*plateNumber)++, plates[count]);
+            records[count].plate = plates[count];
+            records[count].plateLength = PLATE_LENGTH;
+            records[count].road = 'A' + queued % LANE_COUNT;
+        }
+        enqueueRecords(&queueData, records, count);
+    }
+
+    const unsigned axes[2] = {LANE_MOVEMENTS(0) | LANE_MOVEMENTS(1), LANE_MOVEMENTS(2) | LANE_MOVEMENTS(3)};
+    uint64_t elapsedNs = 0;
+    long vehicleTicks = 0;
+    for (int tick = 0; tick < BENCH_UPDATE_TICKS; tick++) {
+        queueData.greenMovements = axes[(tick / BENCH_UPDATE_PHASE_TICKS) % 2];
+        uint64_t start = vehicleRingNowNs();
+        updateVehicles(&queueData, 1.0f / 60);
+        elapsedNs += vehicleRingNowNs() - start;
+        vehicleTicks += queueA.size + queueB.size + queueC.size + queueD.size;
+    }
+
+    printf("%5d per lane: %6.1f vehicles per tick, %7.1f ns per tick, %6.2f ns/vehicle/tick, %ld served\n",
+           depth, (double)vehicleTicks / BENCH_UPDATE_TICKS, (double)elapsedNs / BENCH_UPDATE_TICKS,
+           vehicleTicks ? (double)elapsedNs / vehicleTicks : 0.0, queueData.stats.servedVehicles);
+
+    freeQueue(&queueA);
+    freeQueue(&queueB);
+    freeQueue(&queueC);
+    freeQueue(&queueD);
+    for (int road = 0; road < LANE_COUNT; road++) {
+        freeQueue(&freeLeft[road]);
+    }
+    SDL_DestroyMutex(queueData.mutex);
+}
+
+//Cost of one simulation step per vehicle node, from a short queue up to maxDepth per lane
+int benchmarkUpdate(int maxDepth)
+{
+    SDL_LogSetAllPriority(SDL_LOG_PRIORITY_WARN);
+    long plateNumber = 0;
+    for (int depth = 16; depth < maxDepth; depth *= 4) {
+        measureUpdate(depth, &plateNumber);
+    }
+    measureUpdate(maxDepth, &plateNumber);
+    return 0;
+}
@@ -1,52 +1,465 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
 #include <time.h>
-#include <unistd.h> // For sleep()
+#include <signal.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h> // For write(), usleep()
+#include "vehicle_ring.h"
+#include "segment_log.h"
 
 #define FILENAME "vehicles.data"
+#define LANE_COUNT 4
+#define RECORD_LENGTH 11            // "LLDLLDDD:R\n", R lower case for the free left-turn lane
+#define WRITE_BUFFER_SIZE (1 << 20) // bytes collected before each write()
+#define MAX_SLEEP_US 100000         // never sleep longer than this so Ctrl+C stays responsive
+#define RING_BATCH 4096             // records collected before each push into the shared ring
 
-// Function to generate a random vehicle number
+typedef enum {
+    ARRIVAL_UNIFORM,  // fixed spacing of 1/rate (the original one per second)
+    ARRIVAL_POISSON,  // exponential gaps with mean 1/rate
+    ARRIVAL_BURST,    // groups of burstSize vehicles, groups spaced burstSize/rate apart
+    ARRIVAL_PROFILE   // Poisson with the rate following a 24 hour demand curve
+} ArrivalModel;
+
+typedef struct {
+    const char *output;
+    double rate;                // vehicles per second (peak rate for the profile model)
+    double weights[LANE_COUNT]; // relative demand of lanes A B C D
+    double freeLeft;            // share of each road's vehicles in its free left-turn lane
+    ArrivalModel model;
+    int burstSize;
+    double dayLength;           // seconds of real time per simulated day (profile model)
+    double duration;            // seconds to run, 0 for no limit
+    long count;                 // vehicles to generate, 0 for no limit
+    uint64_t seed;
+    bool maxRate;               // ignore timing and write as fast as possible
+    bool quiet;
+    const char *shmName;        // write into this shared-memory ring instead of the file
+    long segmentSize;           // > 0: write size-capped segments output.000001, output.000002, ...
+    long maxSegments;           // > 0: delete the oldest segments beyond this many
+} GeneratorOptions;
+
+// Where generated vehicles go: text records in a file, or binary records in the shared ring
+typedef struct {
+    int fd;
+    char buffer[WRITE_BUFFER_SIZE];
+    size_t length;
+    VehicleRing *ring;
+    VehicleRingRecord batch[RING_BATCH];
+    uint32_t batchCount;
+    const GeneratorOptions *opt;
+    long segment;               // current segment number in segmented mode
+    long segmentBytes;          // bytes already in the current segment
+} Output;
+
+// Relative demand per hour of day, morning and evening peaks
+static const double dayProfile[24] = {
+    0.10, 0.06, 0.05, 0.05, 0.08, 0.20, 0.45, 0.85, 1.00, 0.75, 0.55, 0.55,
+    0.60, 0.58, 0.55, 0.60, 0.75, 0.95, 0.90, 0.65, 0.45, 0.32, 0.22, 0.15
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+static uint64_t rngState;
+
+static void handleSignal(int signum) {
+    (void)signum;
+    stopRequested = 1;
+}
+
+// xorshift64*: much cheaper than rand() and identical on every platform for a given seed
+static uint64_t nextRandom(void) {
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState * 0x2545F4914F6CDD1DULL;
+}
+
+// Uniform double in (0, 1]
+static double nextUniform(void) {
+    return ((nextRandom() >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to generate a random vehicle number (LL D LL DDD) from one random draw
 void generateVehicleNumber(char* buffer) {
-    buffer[0] = 'A' + rand() % 26;
-    buffer[1] = 'A' + rand() % 26;
-    buffer[2] = '0' + rand() % 10;
-    buffer[3] = 'A' + rand() % 26;
-    buffer[4] = 'A' + rand() % 26;
-    buffer[5] = '0' + rand() % 10;
-    buffer[6] = '0' + rand() % 10;
-    buffer[7] = '0' + rand() % 10;
+    uint64_t r = nextRandom();
+    buffer[0] = 'A' + r % 26; r /= 26;
+    buffer[1] = 'A' + r % 26; r /= 26;
+    buffer[2] = '0' + r % 10; r /= 10;
+    buffer[3] = 'A' + r % 26; r /= 26;
+    buffer[4] = 'A' + r % 26; r /= 26;
+    buffer[5] = '0' + r % 10; r /= 10;
+    buffer[6] = '0' + r % 10; r /= 10;
+    buffer[7] = '0' + r % 10;
     buffer[8] = '\0';
 }
 
-// Function to generate a random lane
-char generateLane() {
-    char lanes[] = {'A', 'B', 'C', 'D'};
-    return lanes[rand() % 4];
+// Function to generate a random lane using the cumulative lane weights
+char generateLane(const double *cumulative) {
+    double u = nextUniform() * cumulative[LANE_COUNT - 1];
+    for (int i = 0; i < LANE_COUNT - 1; i++) {
+        if (u <= cumulative[i]) {
+            return 'A' + i;
+        }
+    }
+    return 'A' + LANE_COUNT - 1;
+}
+
+// Demand multiplier at time t, interpolated between hourly profile points
+static double profileFactor(double t, double dayLength) {
+    double hour = fmod(t / dayLength * 24.0, 24.0);
+    int h = (int)hour;
+    double frac = hour - h;
+    return dayProfile[h] * (1.0 - frac) + dayProfile[(h + 1) % 24] * frac;
+}
+
+// Time of the next arrival after t
+static double nextArrival(const GeneratorOptions *opt, double t, long generated) {
+    switch (opt->model) {
+        case ARRIVAL_UNIFORM:
+            return t + 1.0 / opt->rate;
+        case ARRIVAL_POISSON:
+            return t - log(nextUniform()) / opt->rate;
+        case ARRIVAL_BURST:
+            // vehicles within a burst arrive together
+            if ((generated + 1) % opt->burstSize != 0) {
+                return t;
+            }
+            return t + opt->burstSize / opt->rate;
+        case ARRIVAL_PROFILE:
+            // thinning: draw at the peak rate, keep each candidate with probability factor(t)
+            do {
+                t -= log(nextUniform()) / opt->rate;
+            } while (nextUniform() > profileFactor(t, opt->dayLength));
+            return t;
+    }
+    return t + 1.0 / opt->rate;
+}
+
+// Open (or continue) the segment out->segment for appending
+static bool openSegment(Output *out) {
+    char path[512];
+    segmentPath(path, sizeof(path), out->opt->output, out->segment);
+    out->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (out->fd < 0) {
+        perror("Error opening segment");
+        return false;
+    }
+    struct stat st;
+    fstat(out->fd, &st);
+    out->segmentBytes = st.st_size;
+
+    // Retention cap: only drops data the simulator has not read if it is far behind
+    if (out->opt->maxSegments > 0) {
+        long lowest, highest;
+        while (segmentRange(out->opt->output, &lowest, &highest) &&
+               highest - lowest + 1 > out->opt->maxSegments) {
+            segmentPath(path, sizeof(path), out->opt->output, lowest);
+            fprintf(stderr, "Deleting old segment %s\n", path);
+            if (unlink(path) != 0) break;
+        }
+    }
+    return true;
+}
+
+// Write len bytes, retrying on short writes
+static bool writeAll(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            perror("Error writing file");
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Hand everything buffered to the simulator: write the whole text buffer
+// (retrying on short writes) or push the batch into the ring, waiting while it is full
+static bool flushOutput(Output *out) {
+    if (out->ring) {
+        uint32_t pushed = 0;
+        while (pushed < out->batchCount && !stopRequested) {
+            uint32_t n = vehicleRingPush(out->ring, out->batch + pushed, out->batchCount - pushed);
+            if (n == 0) {
+                vehicleRingWaitForSpace(out->ring);
+            }
+            pushed += n;
+        }
+        out->batchCount = 0;
+        return true;
+    }
+
+    if (out->opt->segmentSize <= 0) {
+        bool ok = writeAll(out->fd, out->buffer, out->length);
+        out->length = 0;
+        return ok;
+    }
+
+    // Segmented: fill the current segment up to the cap with whole records, then rotate
+    size_t written = 0;
+    while (written < out->length) {
+        long room = out->opt->segmentSize - out->segmentBytes;
+        size_t chunk = out->length - written;
+        if ((long)chunk > room) {
+            chunk = room > 0 ? (size_t)(room / RECORD_LENGTH) * RECORD_LENGTH : 0;
+        }
+        if (chunk == 0 && out->segmentBytes == 0) {
+            chunk = RECORD_LENGTH;  // cap smaller than one record
+        }
+        if (chunk > 0) {
+            if (!writeAll(out->fd, out->buffer + written, chunk)) return false;
+            written += chunk;
+            out->segmentBytes += chunk;
+        }
+        if (written < out->length) {
+            close(out->fd);
+            out->segment++;
+            if (!openSegment(out)) return false;
+        }
+    }
+    out->length = 0;
+    return true;
+}
+
+static bool emitVehicle(Output *out, const char *vehicle, char lane) {
+    if (out->ring) {
+        VehicleRingRecord *record = &out->batch[out->batchCount++];
+        memcpy(record->plate, vehicle, 8);
+        record->road = lane;
+        record->producedNs = vehicleRingNowNs();
+        return out->batchCount < RING_BATCH || flushOutput(out);
+    }
+
+    memcpy(out->buffer + out->length, vehicle, 8);
+    out->buffer[out->length + 8] = ':';
+    out->buffer[out->length + 9] = lane;
+    out->buffer[out->length + 10] = '\n';
+    out->length += RECORD_LENGTH;
+    return out->length + RECORD_LENGTH <= sizeof(out->buffer) || flushOutput(out);
+}
+
+static bool parseWeights(const char *text, double *weights) {
+    char *end;
+    for (int i = 0; i < LANE_COUNT; i++) {
+        weights[i] = strtod(text, &end);
+        if (end == text || weights[i] < 0) return false;
+        text = end;
+        if (i < LANE_COUNT - 1) {
+            if (*text != ',') return false;
+            text++;
+        }
+    }
+    return *text == '\0' && weights[0] + weights[1] + weights[2] + weights[3] > 0;
+}
+
+static void printUsage(const char *program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  -r, --rate N          vehicles per second (default 1, peak rate for --arrivals profile)\n");
+    printf("  -w, --weights A,B,C,D relative lane demand (default 1,1,1,1)\n");
+    printf("  -f, --free-left P     share of each road's vehicles sent to its free left-turn lane (default 0)\n");
+    printf("  -a, --arrivals MODEL  uniform, poisson, burst or profile (default uniform)\n");
+    printf("  -b, --burst-size N    vehicles per burst (default 10)\n");
+    printf("  -l, --day-length S    seconds per simulated day for the profile (default 86400)\n");
+    printf("  -d, --duration S      stop after S seconds\n");
+    printf("  -n, --count N         stop after N vehicles\n");
+    printf("  -s, --seed N          random seed (default: time)\n");
+    printf("  -m, --max-rate        ignore timing, write as fast as possible\n");
+    printf("  -o, --output FILE     output file (default %s)\n", FILENAME);
+    printf("  -g, --segment-size N  write size-capped segments FILE.000001, FILE.000002, ... of N bytes\n");
+    printf("  -k, --max-segments N  keep at most N segments, deleting the oldest\n");
+    printf("  -S, --shm NAME        write into the shared-memory ring NAME instead (e.g. %s)\n", VEHICLE_RING_DEFAULT_NAME);
+    printf("  -q, --quiet           don't print each vehicle\n");
 }
 
-int main() {
-    FILE* file = fopen(FILENAME, "a");
-    if (!file) {
-        perror("Error opening file");
+static bool parseOptions(int argc, char *argv[], GeneratorOptions *opt) {
+    static const struct option longOptions[] = {
+        {"rate", required_argument, NULL, 'r'},
+        {"weights", required_argument, NULL, 'w'},
+        {"free-left", required_argument, NULL, 'f'},
+        {"arrivals", required_argument, NULL, 'a'},
+        {"burst-size", required_argument, NULL, 'b'},
+        {"day-length", required_argument, NULL, 'l'},
+        {"duration", required_argument, NULL, 'd'},
+        {"count", required_argument, NULL, 'n'},
+        {"seed", required_argument, NULL, 's'},
+        {"max-rate", no_argument, NULL, 'm'},
+        {"output", required_argument, NULL, 'o'},
+        {"quiet", no_argument, NULL, 'q'},
+        {"shm", required_argument, NULL, 'S'},
+        {"segment-size", required_argument, NULL, 'g'},
+        {"max-segments", required_argument, NULL, 'k'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    opt->output = FILENAME;
+    opt->rate = 1.0;
+    for (int i = 0; i < LANE_COUNT; i++) opt->weights[i] = 1.0;
+    opt->freeLeft = 0;
+    opt->model = ARRIVAL_UNIFORM;
+    opt->burstSize = 10;
+    opt->dayLength = 86400.0;
+    opt->duration = 0;
+    opt->count = 0;
+    opt->seed = (uint64_t)time(NULL);
+    opt->maxRate = false;
+    opt->quiet = false;
+    opt->shmName = NULL;
+    opt->segmentSize = 0;
+    opt->maxSegments = 0;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "r:w:f:a:b:l:d:n:s:mo:qS:g:k:h", longOptions, NULL)) != -1) {
+        switch (c) {
+            case 'r': opt->rate = atof(optarg); break;
+            case 'w':
+                if (!parseWeights(optarg, opt->weights)) {
+                    fprintf(stderr, "Invalid weights '%s', expected four numbers like 2,1,1,1\n", optarg);
+                    return false;
+                }
+                break;
+            case 'f': opt->freeLeft = atof(optarg); break;
+            case 'a':
+                if (strcmp(optarg, "uniform") == 0) opt->model = ARRIVAL_UNIFORM;
+                else if (strcmp(optarg, "poisson") == 0) opt->model = ARRIVAL_POISSON;
+                else if (strcmp(optarg, "burst") == 0) opt->model = ARRIVAL_BURST;
+                else if (strcmp(optarg, "profile") == 0) opt->model = ARRIVAL_PROFILE;
+                else {
+                    fprintf(stderr, "Unknown arrival model '%s'\n", optarg);
+                    return false;
+                }
+                break;
+            case 'b': opt->burstSize = atoi(optarg); break;
+            case 'l': opt->dayLength = atof(optarg); break;
+            case 'd': opt->duration = atof(optarg); break;
+            case 'n': opt->count = atol(optarg); break;
+            case 's': opt->seed = strtoull(optarg, NULL, 10); break;
+            case 'm': opt->maxRate = true; break;
+            case 'o': opt->output = optarg; break;
+            case 'q': opt->quiet = true; break;
+            case 'S': opt->shmName = optarg; break;
+            case 'g': opt->segmentSize = atol(optarg); break;
+            case 'k': opt->maxSegments = atol(optarg); break;
+            default:
+                printUsage(argv[0]);
+                return false;
+        }
+    }
+    if (opt->rate <= 0 || opt->burstSize < 1 || opt->dayLength <= 0) {
+        fprintf(stderr, "Rate, burst size and day length must be positive\n");
+        return false;
+    }
+    if (opt->freeLeft < 0 || opt->freeLeft > 1) {
+        fprintf(stderr, "Free left-turn share must be between 0 and 1\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    GeneratorOptions opt;
+    if (!parseOptions(argc, argv, &opt)) {
         return 1;
     }
 
-    srand(time(NULL)); // Initialize random seed
+    static Output out;
+    out.fd = -1;
+    out.opt = &opt;
+    if (opt.shmName) {
+        out.ring = vehicleRingAttach(opt.shmName, VEHICLE_RING_DEFAULT_CAPACITY);
+        if (!out.ring) {
+            perror("Error attaching shared-memory ring");
+            return 1;
+        }
+    } else if (opt.segmentSize > 0) {
+        // Continue the newest segment so restarts don't leave a trail of small files
+        long lowest;
+        if (!segmentRange(opt.output, &lowest, &out.segment)) {
+            out.segment = 1;
+        }
+        if (!openSegment(&out)) {
+            return 1;
+        }
+    } else {
+        out.fd = open(opt.output, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (out.fd < 0) {
+            perror("Error opening file");
+            return 1;
+        }
+    }
+
+    rngState = opt.seed ? opt.seed : 0x9E3779B97F4A7C15ULL; // Initialize random seed
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+
+    double cumulative[LANE_COUNT];
+    double total = 0;
+    for (int i = 0; i < LANE_COUNT; i++) {
+        total += opt.weights[i];
+        cumulative[i] = total;
+    }
+
+    long generated = 0;
+    double start = nowSeconds();
+    double arrival = 0;  // seconds since start of the next vehicle
+    bool ok = true;
+
+    while (!stopRequested && ok) {
+        if (opt.count > 0 && generated >= opt.count) break;
+
+        double elapsed = nowSeconds() - start;
+        if (opt.duration > 0 && (opt.maxRate ? elapsed : arrival) >= opt.duration) break;
+
+        if (!opt.maxRate && arrival > elapsed) {
+            // Nothing due yet: hand what we have to the simulator and wait
+            ok = flushOutput(&out);
+            double wait = (arrival - elapsed) * 1e6;
+            usleep(wait < MAX_SLEEP_US ? (useconds_t)wait : MAX_SLEEP_US);
+            continue;
+        }
 
-    while (1) {
         char vehicle[9];
         generateVehicleNumber(vehicle);
-        char lane = generateLane();
-
-        // Write to file
-        fprintf(file, "%s:%c\n", vehicle, lane);
-        fflush(file); // Ensure data is written immediately
+        char lane = generateLane(cumulative);
+        if (opt.freeLeft > 0 && nextUniform() <= opt.freeLeft) {
+            lane = lane - 'A' + 'a';
+        }
 
-        printf("Generated: %s:%c\n", vehicle, lane); // Print to console
+        // Write to buffer
+        ok = emitVehicle(&out, vehicle, lane);
+        generated++;
 
-        sleep(1); // Wait 1 second before generating next entry
+        if (!opt.quiet && !opt.maxRate) {
+            printf("Generated: %s:%c\n", vehicle, lane); // Print to console
+        }
+        if (!opt.maxRate) {
+            arrival = nextArrival(&opt, arrival, generated - 1);
+        }
+    }
+    if (ok) {
+        flushOutput(&out);
+    }
+    if (out.ring) {
+        vehicleRingDetach(out.ring);
+    } else {
+        close(out.fd);
     }
 
-    fclose(file);
-    return 0;
-}
\ No newline at end of file
+    double elapsed = nowSeconds() - start;
+    fprintf(stderr, "Generated %ld vehicles in %.2f s (%.0f vehicles/s)\n",
+            generated, elapsed, elapsed > 0 ? generated / elapsed : 0.0);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,231 @@
+//Shared-memory ring buffer carrying arrivals from traffic_generator to the simulator.
+//
+//Single producer, single consumer. The producer fills records past head and then
+//publishes head; the consumer reads records up to head and then publishes tail.
+//Neither side takes a lock. A side that finds the ring empty (consumer) or full
+//(producer) sleeps on a futex in the shared mapping instead of polling, and the
+//other side only issues a wake syscall when it sees the sleeping flag set.
+//
+//Linux only (shm_open + mmap + futex).
+#ifndef VEHICLE_RING_H
+#define VEHICLE_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define VEHICLE_RING_MAGIC 0x474E5256u  //"VRNG"
+#define VEHICLE_RING_VERSION 1
+#define VEHICLE_RING_DEFAULT_NAME "/junction_vehicles"
+#define VEHICLE_RING_DEFAULT_CAPACITY (1u << 20)  //records, must be a power of two
+#define VEHICLE_RING_WAIT_MS 100  //sleepers re-check at least this often
+
+typedef struct {
+    char plate[8];       //not NUL terminated when all 8 characters are used
+    char road;
+    char reserved[7];
+    uint64_t producedNs; //CLOCK_MONOTONIC at the producer, for end-to-end latency
+} VehicleRingRecord;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t recordSize;
+    _Alignas(64) _Atomic uint64_t head;        //next slot the producer writes
+    _Atomic uint32_t dataSeq;                  //bumped after head moves, consumer waits on it
+    _Atomic uint32_t consumerSleeping;
+    _Alignas(64) _Atomic uint64_t tail;        //next slot the consumer reads
+    _Atomic uint32_t spaceSeq;                 //bumped after tail moves, producer waits on it
+    _Atomic uint32_t producerSleeping;
+    _Alignas(64) VehicleRingRecord records[];
+} VehicleRing;
+
+static inline uint64_t vehicleRingNowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline size_t vehicleRingBytes(uint32_t capacity)
+{
+    return sizeof(VehicleRing) + (size_t)capacity * sizeof(VehicleRingRecord);
+}
+
+static inline void vehicleRingFutexWait(_Atomic uint32_t *word, uint32_t expected)
+{
+    struct timespec timeout = {0, VEHICLE_RING_WAIT_MS * 1000000L};
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+static inline void vehicleRingFutexWake(_Atomic uint32_t *word)
+{
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+//Map the ring called name, creating and initialising it if it does not exist yet.
+//capacity is only used by the creator. Returns NULL and sets errno on failure.
+static inline VehicleRing *vehicleRingAttach(const char *name, uint32_t capacity)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    bool creator = fd >= 0;
+    if (!creator) {
+        if (errno != EEXIST) return NULL;
+        fd = shm_open(name, O_RDWR, 0600);
+        if (fd < 0) return NULL;
+    }
+
+    if (creator) {
+        if (ftruncate(fd, vehicleRingBytes(capacity)) != 0) {
+            close(fd);
+            shm_unlink(name);
+            return NULL;
+        }
+    } else {
+        //The creator may still be sizing the object
+        struct stat st;
+        for (int tries = 0; ; tries++) {
+            if (fstat(fd, &st) != 0) {
+                close(fd);
+                return NULL;
+            }
+            if (st.st_size >= (off_t)sizeof(VehicleRing)) break;
+            if (tries == 100) {
+                close(fd);
+                errno = ETIMEDOUT;
+                return NULL;
+            }
+            usleep(10000);
+        }
+    }
+
+    size_t bytes = sizeof(VehicleRing);
+    VehicleRing *ring = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    if (creator) {
+        ring->capacity = capacity;
+        ring->recordSize = sizeof(VehicleRingRecord);
+        ring->version = VEHICLE_RING_VERSION;
+        atomic_store(&ring->head, 0);
+        atomic_store(&ring->tail, 0);
+        atomic_store(&ring->dataSeq, 0);
+        atomic_store(&ring->spaceSeq, 0);
+        atomic_store(&ring->consumerSleeping, 0);
+        atomic_store(&ring->producerSleeping, 0);
+        atomic_thread_fence(memory_order_release);
+        ring->magic = VEHICLE_RING_MAGIC;
+    } else {
+        for (int tries = 0; ring->magic != VEHICLE_RING_MAGIC; tries++) {
+            if (tries == 100) break;
+            usleep(10000);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (ring->magic != VEHICLE_RING_MAGIC || ring->version != VEHICLE_RING_VERSION ||
+            ring->recordSize != sizeof(VehicleRingRecord)) {
+            munmap(ring, bytes);
+            close(fd);
+            errno = EPROTO;
+            return NULL;
+        }
+    }
+
+    //Remap with the full record area now that the capacity is known
+    capacity = ring->capacity;
+    munmap(ring, bytes);
+    ring = mmap(NULL, vehicleRingBytes(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return ring == MAP_FAILED ? NULL : ring;
+}
+
+static inline void vehicleRingDetach(VehicleRing *ring)
+{
+    munmap(ring, vehicleRingBytes(ring->capacity));
+}
+
+//Producer: copy up to count records into the ring and publish them.
+//Returns how many fitted; 0 means the ring is full.
+static inline uint32_t vehicleRingPush(VehicleRing *ring, const VehicleRingRecord *records, uint32_t count)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t space = ring->capacity - (uint32_t)(head - tail);
+    if (count > space) count = space;
+
+    uint32_t mask = ring->capacity - 1;
+    for (uint32_t i = 0; i < count; i++) {
+        ring->records[(head + i) & mask] = records[i];
+    }
+    if (count > 0) {
+        atomic_store_explicit(&ring->head, head + count, memory_order_release);
+        atomic_fetch_add(&ring->dataSeq, 1);
+        if (atomic_load(&ring->consumerSleeping)) {
+            vehicleRingFutexWake(&ring->dataSeq);
+        }
+    }
+    return count;
+}
+
+//Producer: block until at least one slot is free (or the wait times out)
+static inline void vehicleRingWaitForSpace(VehicleRing *ring)
+{
+    uint32_t seq = atomic_load(&ring->spaceSeq);
+    atomic_store(&ring->producerSleeping, 1);
+    uint64_t head = atomic_load(&ring->head);
+    if (head - atomic_load(&ring->tail) >= ring->capacity) {
+        vehicleRingFutexWait(&ring->spaceSeq, seq);
+    }
+    atomic_store(&ring->producerSleeping, 0);
+}
+
+//Consumer: records available to read, without copying. *first receives the
+//ring index of the first one; a run may wrap, so read it with records[(first + i) & mask].
+static inline uint32_t vehicleRingPeek(VehicleRing *ring, uint64_t *first)
+{
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    *first = tail;
+    return (uint32_t)(head - tail);
+}
+
+//Consumer: release count records obtained from vehicleRingPeek
+static inline void vehicleRingConsume(VehicleRing *ring, uint32_t count)
+{
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+    atomic_fetch_add(&ring->spaceSeq, 1);
+    if (atomic_load(&ring->producerSleeping)) {
+        vehicleRingFutexWake(&ring->spaceSeq);
+    }
+}
+
+//Consumer: block until data arrives (or the wait times out)
+static inline void vehicleRingWaitForData(VehicleRing *ring)
+{
+    uint32_t seq = atomic_load(&ring->dataSeq);
+    atomic_store(&ring->consumerSleeping, 1);
+    if (atomic_load(&ring->head) == atomic_load(&ring->tail)) {
+        vehicleRingFutexWait(&ring->dataSeq, seq);
+    }
+    atomic_store(&ring->consumerSleeping, 0);
+}
+
+#endif